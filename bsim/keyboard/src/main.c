@@ -0,0 +1,426 @@
+/*
+ * An emulated HID-over-GATT keyboard for benchmarking the vtbt's Bluetooth
+ * path on BabbleSim. It serves the HID service the vtbt discovers, and runs
+ * through three phases, typing a burst of keys in each:
+ *
+ * cold_pair  The vtbt finds, connects to and pairs with the keyboard.
+ * reconnect  The keyboard ends the connection and advertises again; the vtbt
+ *            reconnects with the bond.
+ * link_loss  The keyboard holds a key down and its radio goes silent until
+ *            the vtbt's supervision timeout ends the connection.
+ *
+ * Every report sent and every phase change is printed as a JSON line with its
+ * simulation time, to be matched with the vtbt's by scripts/bt_benchmark.py.
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/settings/settings.h>
+
+#define HID_REPORT_SIZE      8
+#define HID_REPORT_FIRST_KEY 2
+
+#define KEYS_PER_PHASE 50
+/* Between a press and its release and between keys: 25 keys a second. */
+#define KEY_INTERVAL_MS 20
+/* Radio silence in the link loss phase. The vtbt notices after its
+ * supervision timeout, whatever this is. */
+#define LINK_LOSS_MS 500
+
+/* HID usages of the letters a to z. */
+#define USAGE_A 0x04
+#define USAGE_Z 0x1d
+
+enum phase {
+	PHASE_COLD_PAIR,
+	PHASE_RECONNECT,
+	PHASE_LINK_LOSS,
+	NUM_PHASES,
+};
+
+static const char *const phase_names[NUM_PHASES] = {
+	[PHASE_COLD_PAIR] = "cold_pair",
+	[PHASE_RECONNECT] = "reconnect",
+	[PHASE_LINK_LOSS] = "link_loss",
+};
+
+struct hids_info {
+	uint16_t version;
+	uint8_t country_code;
+	uint8_t flags;
+} __packed;
+
+static const struct hids_info hids_info = {
+	.version = 0x0111,
+	.country_code = 0x00,
+	.flags = 0x02, /* Normally connectable */
+};
+
+/* The boot keyboard report descriptor from the HID specification. */
+static const uint8_t report_map[] = {
+	0x05, 0x01,       /* Usage Page (Generic Desktop) */
+	0x09, 0x06,       /* Usage (Keyboard) */
+	0xa1, 0x01,       /* Collection (Application) */
+	0x05, 0x07,       /*   Usage Page (Key Codes) */
+	0x19, 0xe0,       /*   Usage Minimum (224) */
+	0x29, 0xe7,       /*   Usage Maximum (231) */
+	0x15, 0x00,       /*   Logical Minimum (0) */
+	0x25, 0x01,       /*   Logical Maximum (1) */
+	0x75, 0x01,       /*   Report Size (1) */
+	0x95, 0x08,       /*   Report Count (8) */
+	0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+	0x95, 0x01,       /*   Report Count (1) */
+	0x75, 0x08,       /*   Report Size (8) */
+	0x81, 0x01,       /*   Input (Constant) */
+	0x95, 0x05,       /*   Report Count (5) */
+	0x75, 0x01,       /*   Report Size (1) */
+	0x05, 0x08,       /*   Usage Page (LEDs) */
+	0x19, 0x01,       /*   Usage Minimum (1) */
+	0x29, 0x05,       /*   Usage Maximum (5) */
+	0x91, 0x02,       /*   Output (Data, Variable, Absolute) */
+	0x95, 0x01,       /*   Report Count (1) */
+	0x75, 0x03,       /*   Report Size (3) */
+	0x91, 0x01,       /*   Output (Constant) */
+	0x95, 0x06,       /*   Report Count (6) */
+	0x75, 0x08,       /*   Report Size (8) */
+	0x15, 0x00,       /*   Logical Minimum (0) */
+	0x25, 0x65,       /*   Logical Maximum (101) */
+	0x05, 0x07,       /*   Usage Page (Key Codes) */
+	0x19, 0x00,       /*   Usage Minimum (0) */
+	0x29, 0x65,       /*   Usage Maximum (101) */
+	0x81, 0x00,       /*   Input (Data, Array) */
+	0xc0,             /* End Collection */
+};
+
+/* Report ID 0, input report. */
+static const uint8_t input_report_ref[] = { 0x00, 0x01 };
+
+static uint8_t protocol_mode = 0x01; /* Report protocol */
+static uint8_t input_report[HID_REPORT_SIZE];
+static uint8_t output_report;
+
+static struct bt_conn *default_conn;
+static bool notify_enabled;
+static bool radio_off;
+
+static K_SEM_DEFINE(subscribed_sem, 0, 1);
+static K_SEM_DEFINE(disconnected_sem, 0, 1);
+
+static void
+record(const char *event, uint32_t arg)
+{
+	printk("BENCH {\"dev\":\"keyboard\",\"event\":\"%s\",\"t_us\":%u,"
+	       "\"arg\":%u}\n", event,
+	       (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks()), arg);
+}
+
+static ssize_t
+read_info(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf,
+          uint16_t len, uint16_t offset)
+{
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, &hids_info,
+	                         sizeof(hids_info));
+}
+
+static ssize_t
+read_report_map(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                void *buf, uint16_t len, uint16_t offset)
+{
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, report_map,
+	                         sizeof(report_map));
+}
+
+static ssize_t
+read_protocol_mode(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                   void *buf, uint16_t len, uint16_t offset)
+{
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, &protocol_mode,
+	                         sizeof(protocol_mode));
+}
+
+static ssize_t
+write_protocol_mode(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                    const void *buf, uint16_t len, uint16_t offset,
+                    uint8_t flags)
+{
+	ARG_UNUSED(conn);
+	ARG_UNUSED(attr);
+	ARG_UNUSED(flags);
+
+	if (offset != 0 || len != sizeof(protocol_mode)) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	protocol_mode = *(const uint8_t *)buf;
+
+	return len;
+}
+
+static ssize_t
+read_input_report(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                  void *buf, uint16_t len, uint16_t offset)
+{
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, input_report,
+	                         sizeof(input_report));
+}
+
+static ssize_t
+read_input_report_ref(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                      void *buf, uint16_t len, uint16_t offset)
+{
+	return bt_gatt_attr_read(conn, attr, buf, len, offset,
+	                         input_report_ref, sizeof(input_report_ref));
+}
+
+static ssize_t
+read_output_report(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                   void *buf, uint16_t len, uint16_t offset)
+{
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, &output_report,
+	                         sizeof(output_report));
+}
+
+static ssize_t
+write_output_report(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                    const void *buf, uint16_t len, uint16_t offset,
+                    uint8_t flags)
+{
+	ARG_UNUSED(conn);
+	ARG_UNUSED(attr);
+	ARG_UNUSED(flags);
+
+	if (offset != 0 || len != sizeof(output_report)) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	output_report = *(const uint8_t *)buf;
+	record("leds", output_report);
+
+	return len;
+}
+
+static ssize_t
+write_control_point(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                    const void *buf, uint16_t len, uint16_t offset,
+                    uint8_t flags)
+{
+	ARG_UNUSED(conn);
+	ARG_UNUSED(attr);
+	ARG_UNUSED(buf);
+	ARG_UNUSED(offset);
+	ARG_UNUSED(flags);
+
+	return len;
+}
+
+static void
+input_ccc_changed(const struct bt_gatt_attr *attr, uint16_t value)
+{
+	ARG_UNUSED(attr);
+
+	notify_enabled = value == BT_GATT_CCC_NOTIFY;
+	if (notify_enabled) {
+		k_sem_give(&subscribed_sem);
+	}
+}
+
+/* The vtbt subscribes to the first Report characteristic, after finding the
+ * boot keyboard reports. */
+BT_GATT_SERVICE_DEFINE(hids_svc,
+	BT_GATT_PRIMARY_SERVICE(BT_UUID_HIDS),
+	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_INFO, BT_GATT_CHRC_READ,
+	                       BT_GATT_PERM_READ, read_info, NULL, NULL),
+	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_REPORT_MAP, BT_GATT_CHRC_READ,
+	                       BT_GATT_PERM_READ, read_report_map, NULL, NULL),
+	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_PROTOCOL_MODE,
+	                       BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+	                       BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+	                       read_protocol_mode, write_protocol_mode, NULL),
+	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_REPORT,
+	                       BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+	                       BT_GATT_PERM_READ_ENCRYPT,
+	                       read_input_report, NULL, NULL),
+	BT_GATT_CCC(input_ccc_changed,
+	            BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
+	BT_GATT_DESCRIPTOR(BT_UUID_HIDS_REPORT_REF, BT_GATT_PERM_READ_ENCRYPT,
+	                   read_input_report_ref, NULL, NULL),
+	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_BOOT_KB_IN_REPORT,
+	                       BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+	                       BT_GATT_PERM_READ_ENCRYPT,
+	                       read_input_report, NULL, NULL),
+	BT_GATT_CCC(NULL,
+	            BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
+	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_BOOT_KB_OUT_REPORT,
+	                       BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE |
+	                       BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+	                       BT_GATT_PERM_READ_ENCRYPT |
+	                       BT_GATT_PERM_WRITE_ENCRYPT,
+	                       read_output_report, write_output_report, NULL),
+	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_CTRL_POINT,
+	                       BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+	                       BT_GATT_PERM_WRITE, NULL, write_control_point,
+	                       NULL),
+);
+
+/* The value attribute of the Report characteristic. */
+#define INPUT_REPORT_ATTR (&hids_svc.attrs[8])
+
+static const struct bt_data ad[] = {
+	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+	BT_DATA_BYTES(BT_DATA_UUID16_ALL, BT_UUID_16_ENCODE(BT_UUID_HIDS_VAL)),
+};
+
+static void
+advertise(void)
+{
+	int err = bt_le_adv_start(BT_LE_ADV_CONN, ad, ARRAY_SIZE(ad), NULL, 0);
+	if (err) {
+		printk("Advertising failed to start (err %d)\n", err);
+		return;
+	}
+
+	record("advertising", 0);
+}
+
+static void
+connected(struct bt_conn *conn, uint8_t err)
+{
+	if (err) {
+		return;
+	}
+
+	default_conn = bt_conn_ref(conn);
+	record("connected", 0);
+}
+
+static void
+disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	if (conn != default_conn) {
+		return;
+	}
+
+	bt_conn_unref(default_conn);
+	default_conn = NULL;
+	notify_enabled = false;
+	record("disconnected", reason);
+	k_sem_give(&disconnected_sem);
+}
+
+static void
+recycled(void)
+{
+	if (!radio_off) {
+		advertise();
+	}
+}
+
+BT_CONN_CB_DEFINE(conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+	.recycled = recycled,
+};
+
+static void
+send_report(uint8_t key)
+{
+	memset(input_report, 0, sizeof(input_report));
+	input_report[HID_REPORT_FIRST_KEY] = key;
+
+	if (default_conn == NULL || !notify_enabled) {
+		return;
+	}
+
+	/* Recorded first: the vtbt may handle the notification before this
+	 * thread runs again. */
+	record("send", key);
+	int err = bt_gatt_notify(default_conn, INPUT_REPORT_ATTR, input_report,
+	                         sizeof(input_report));
+	if (err) {
+		printk("Notify failed (err %d)\n", err);
+	}
+}
+
+static void
+type_keys(void)
+{
+	for (int i = 0; i < KEYS_PER_PHASE; i++) {
+		send_report(USAGE_A + i % (USAGE_Z - USAGE_A + 1));
+		k_msleep(KEY_INTERVAL_MS);
+		send_report(0);
+		k_msleep(KEY_INTERVAL_MS);
+	}
+}
+
+static int
+bluetooth_start(void)
+{
+	int err = bt_enable(NULL);
+	if (err) {
+		printk("Bluetooth init failed (err %d)\n", err);
+		return -1;
+	}
+
+	settings_load();
+
+	advertise();
+
+	return 0;
+}
+
+int
+main(void)
+{
+	if (bluetooth_start() < 0) {
+		return -1;
+	}
+
+	for (int phase = 0; phase < NUM_PHASES; phase++) {
+		k_sem_take(&subscribed_sem, K_FOREVER);
+		record(phase_names[phase], 0);
+
+		type_keys();
+
+		switch (phase) {
+			case PHASE_COLD_PAIR:
+				/* Advertising restarts once the connection
+				 * is recycled. */
+				record("disconnect", 0);
+				bt_conn_disconnect(default_conn,
+				        BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+				k_sem_take(&disconnected_sem, K_FOREVER);
+				break;
+			case PHASE_RECONNECT:
+				/* Stop without telling the vtbt, with a key
+				 * held down. */
+				send_report(USAGE_A);
+				record("link_lost", 0);
+				radio_off = true;
+				bt_disable();
+				if (default_conn != NULL) {
+					bt_conn_unref(default_conn);
+					default_conn = NULL;
+					notify_enabled = false;
+				}
+				k_sem_reset(&disconnected_sem);
+				k_msleep(LINK_LOSS_MS);
+				radio_off = false;
+				if (bluetooth_start() < 0) {
+					return -1;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+	record("done", 0);
+
+	return 0;
+}
@@ -0,0 +1,181 @@
+# Bluetooth benchmark of the vtbt against an emulated keyboard on BabbleSim.
+#
+# Usage: bt_benchmark.py [-o results.json] [--sim-length SECONDS]
+#                        vtbt.exe keyboard.exe
+#
+# vtbt.exe is the vtbt built for nrf52_bsim with overlay-bt-benchmark.conf
+# and keyboard.exe is bsim/keyboard built for nrf52_bsim. BSIM_OUT_PATH must
+# point at a BabbleSim installation. Both devices start with erased flash, so
+# the first connection is a cold pair.
+#
+# The emulated keyboard types a burst of keys in each of three phases:
+# cold_pair (from boot), reconnect (after it ends the connection) and
+# link_loss (after its radio goes silent with a key held down). Each device
+# prints its milestones and reports with the shared simulation time, and this
+# script matches them up into:
+#
+# cold_pair       Time from boot to the vtbt's scan start, connection,
+#                 encryption, subscription and first report.
+# reconnect       Time from the keyboard ending the connection to the vtbt
+#                 reconnecting, encrypting with the bond, subscribing and
+#                 receiving its first report.
+# link_loss       Time from the keyboard going silent to the vtbt noticing
+#                 the supervision timeout, reconnecting and receiving its
+#                 first report.
+# notify_latency  Microseconds from the keyboard sending a notification to
+#                 the vtbt handing the report to hid_report_cb(), over all
+#                 reports.
+#
+# Times are in microseconds, with the resolution of the simulated nRF52's
+# 32768 Hz RTC. The results are printed (or written with -o) as JSON so that
+# runs can be compared.
+import argparse
+import bisect
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+MARKER = 'BENCH '
+
+
+def run(vtbt, keyboard, sim_length):
+    """Runs the simulation and returns the records of both devices."""
+    bsim = os.environ.get('BSIM_OUT_PATH')
+    if bsim is None:
+        sys.exit('BSIM_OUT_PATH is not set')
+    bin_dir = os.path.join(bsim, 'bin')
+    sim_id = f'vtbt_bench_{os.getpid()}'
+
+    with tempfile.TemporaryDirectory() as tmp:
+        phy = subprocess.Popen(
+            [os.path.join(bin_dir, 'bs_2G4_phy_v1'), f'-s={sim_id}', '-D=2',
+             f'-sim_length={int(sim_length * 1e6)}'],
+            cwd=bin_dir, stdout=subprocess.DEVNULL)
+        devices = [
+            subprocess.Popen(
+                [os.path.abspath(exe), f'-s={sim_id}', f'-d={d}',
+                 f'-flash={os.path.join(tmp, f"flash{d}.bin")}',
+                 '-flash_erase'],
+                cwd=bin_dir, stdout=subprocess.PIPE, text=True)
+            for d, exe in enumerate((vtbt, keyboard))
+        ]
+        outputs = [device.communicate()[0] for device in devices]
+        phy.wait()
+
+    records = []
+    for output in outputs:
+        for line in output.splitlines():
+            # bsim prefixes device output with the device number and time.
+            _, marker, record = line.partition(MARKER)
+            if marker:
+                records.append(json.loads(record))
+    return sorted(records, key=lambda r: r['t_us'])
+
+
+def first(records, dev, event, after=0):
+    for r in records:
+        if r['dev'] == dev and r['event'] == event and r['t_us'] >= after:
+            return r['t_us']
+    return None
+
+
+CONNECT_EVENTS = ('scan_start', 'connected', 'security', 'subscribed',
+                  'report')
+
+
+def milestones(records, start, events):
+    """Times from start to each of the vtbt's events in turn. Events that
+    don't happen (no security change on a reconnect that fails to encrypt)
+    are left out. The last one, the first report, is the total."""
+    result = {}
+    t = start
+    for event in events:
+        found = first(records, 'vtbt', event, t)
+        if found is None:
+            continue
+        t = found
+        result[event + '_us'] = t - start
+    if 'report_us' in result:
+        result['total_us'] = result.pop('report_us')
+    return result
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def notify_latency(records):
+    """Matches the keyboard's sends with the vtbt's reports in order, within
+    each of the vtbt's connections."""
+    sends = [r for r in records if r['dev'] == 'keyboard'
+             and r['event'] == 'send']
+    reports = [r for r in records if r['dev'] == 'vtbt'
+               and r['event'] == 'report']
+    disconnects = [r['t_us'] for r in records if r['dev'] == 'vtbt'
+                   and r['event'] == 'disconnected']
+
+    def connection(r):
+        return bisect.bisect_left(disconnects, r['t_us'])
+
+    latencies = []
+    i = 0
+    for report in reports:
+        # Sends lost with a connection have no report.
+        while (i < len(sends) and sends[i]['t_us'] <= report['t_us'] and
+               (sends[i]['arg'] != report['arg'] or
+                connection(sends[i]) != connection(report))):
+            i += 1
+        if i == len(sends) or sends[i]['t_us'] > report['t_us']:
+            continue
+        latencies.append(report['t_us'] - sends[i]['t_us'])
+        i += 1
+
+    if not latencies:
+        return {}
+    latencies.sort()
+    return {
+        'count': len(latencies),
+        'lost': len(sends) - len(latencies),
+        'min_us': latencies[0],
+        'avg_us': sum(latencies) // len(latencies),
+        'p50_us': percentile(latencies, 50),
+        'p99_us': percentile(latencies, 99),
+        'max_us': latencies[-1],
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('vtbt')
+    parser.add_argument('keyboard')
+    parser.add_argument('-o', '--output')
+    parser.add_argument('--sim-length', type=float, default=30,
+                        help='simulated seconds (default 30)')
+    args = parser.parse_args()
+
+    records = run(args.vtbt, args.keyboard, args.sim_length)
+    if first(records, 'keyboard', 'done') is None:
+        print('warning: the keyboard didn\'t finish its phases',
+              file=sys.stderr)
+
+    results = {'cold_pair': milestones(records, 0, CONNECT_EVENTS)}
+    for phase, event in (('reconnect', 'disconnect'),
+                         ('link_loss', 'link_lost')):
+        start = first(records, 'keyboard', event)
+        if start is not None:
+            results[phase] = milestones(records, start,
+                                        ('disconnected',) + CONNECT_EVENTS)
+    results['notify_latency'] = notify_latency(records)
+
+    text = json.dumps(results, indent=2)
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(text + '\n')
+    else:
+        print(text)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,129 @@
+# Stand-in for a wired keyboard bridge on the vtbt's input UART.
+#
+# Usage: hid_bridge.py [--baud 115200] [--text TEXT [--cps 10]] port
+#
+# port is the serial device of a vtbt port whose keyboard-source is "serial",
+# or the pseudo-terminal printed at startup by a native_sim build with
+# serial-input.overlay. Without --text, the keys typed on this terminal are
+# pressed and released one at a time until Ctrl-] is typed; with --text, the
+# text is typed at --cps characters per second and the script exits.
+#
+# Reports are sent in the frames described in src/serial_input.h: on every
+# change, and repeated while nothing changes so that the vtbt doesn't count
+# the keyboard as lost. Requires pyserial.
+import argparse
+import sys
+import termios
+import threading
+import time
+import tty
+
+import serial
+
+FRAME_SYNC = b'\x57\xab'
+REPORT_SIZE = 8
+KEEPALIVE_S = 0.25
+# Hold time of each typed key.
+PRESS_S = 0.03
+QUIT = '\x1d'
+
+MOD_LEFT_CTRL = 0x01
+MOD_LEFT_SHIFT = 0x02
+
+# US layout: characters to (usage, shifted).
+KEYS = {'\n': (0x28, False), '\r': (0x28, False), '\x1b': (0x29, False),
+        '\x7f': (0x2a, False), '\b': (0x2a, False), '\t': (0x2b, False),
+        ' ': (0x2c, False)}
+for i, c in enumerate('abcdefghijklmnopqrstuvwxyz'):
+    KEYS[c] = (0x04 + i, False)
+    KEYS[c.upper()] = (0x04 + i, True)
+for i, c in enumerate('1234567890'):
+    KEYS[c] = (0x1e + i, False)
+    KEYS['!@#$%^&*()'[i]] = (0x1e + i, True)
+for usage, (plain, shifted) in {0x2d: '-_', 0x2e: '=+', 0x2f: '[{',
+                                0x30: ']}', 0x31: '\\|', 0x33: ';:',
+                                0x34: '\'"', 0x35: '`~', 0x36: ',<',
+                                0x37: '.>', 0x38: '/?'}.items():
+    KEYS[plain] = (usage, False)
+    KEYS[shifted] = (usage, True)
+
+
+def frame(report):
+    body = bytes([REPORT_SIZE]) + report
+    return FRAME_SYNC + body + bytes([sum(body) & 0xff])
+
+
+def report_for(c):
+    """Returns the report pressing c, or None if c has no key."""
+    modifiers = 0
+    if '\x01' <= c <= '\x1a' and c not in '\b\t\n\r':
+        c = chr(ord(c) + 0x60)
+        modifiers = MOD_LEFT_CTRL
+    if c not in KEYS:
+        return None
+    usage, shifted = KEYS[c]
+    if shifted:
+        modifiers |= MOD_LEFT_SHIFT
+    return bytes([modifiers, 0, usage, 0, 0, 0, 0, 0])
+
+
+class Bridge:
+    def __init__(self, port):
+        self.port = port
+        self.report = bytes(REPORT_SIZE)
+        self.lock = threading.Lock()
+        threading.Thread(target=self.keepalive, daemon=True).start()
+
+    def send(self, report):
+        with self.lock:
+            self.report = report
+            self.port.write(frame(report))
+
+    def keepalive(self):
+        while True:
+            time.sleep(KEEPALIVE_S)
+            with self.lock:
+                self.port.write(frame(self.report))
+
+    def type(self, c):
+        report = report_for(c)
+        if report is None:
+            return
+        self.send(report)
+        time.sleep(PRESS_S)
+        self.send(bytes(REPORT_SIZE))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('port')
+    parser.add_argument('--baud', type=int, default=115200)
+    parser.add_argument('--text', help='type this text and exit')
+    parser.add_argument('--cps', type=float, default=10,
+                        help='characters per second for --text')
+    args = parser.parse_args()
+
+    bridge = Bridge(serial.Serial(args.port, args.baud))
+
+    if args.text is not None:
+        for c in args.text:
+            start = time.monotonic()
+            bridge.type(c)
+            time.sleep(max(0, 1 / args.cps - (time.monotonic() - start)))
+        return
+
+    print('Typing to the vtbt, Ctrl-] to quit', file=sys.stderr)
+    attrs = termios.tcgetattr(sys.stdin)
+    try:
+        tty.setraw(sys.stdin)
+        while True:
+            c = sys.stdin.read(1)
+            if c in ('', QUIT):
+                break
+            bridge.type(c)
+    finally:
+        termios.tcsetattr(sys.stdin, termios.TCSADRAIN, attrs)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,86 @@
+# Placement report for the application's functions and data.
+#
+# Usage: iram_map.py zephyr.elf zephyr.map
+#
+# Prints the memory region, address and size of every function and object
+# linked from the application's sources, grouped by region, to check what
+# CONFIG_VTBT_IRAM moved out of flash. Regions come from the linker's memory
+# configuration, as in mem_budget.py.
+import bisect
+import collections
+import sys
+
+from elftools.elf.elffile import ELFFile
+from elftools.elf.sections import SymbolTableSection
+
+from mem_budget import component, read_map
+
+
+def app_ranges(inputs):
+    """Returns the sorted (start, end) address ranges of the application's
+    input sections."""
+    return sorted((addr, addr + size) for _, addr, size, obj in inputs
+                  if size and component(obj) == 'app')
+
+
+def in_ranges(ranges, starts, addr):
+    i = bisect.bisect_right(starts, addr) - 1
+    return i >= 0 and addr < ranges[i][1]
+
+
+def app_symbols(path, ranges):
+    """Returns (name, kind, address, size) for the application's functions
+    and objects."""
+    starts = [start for start, _ in ranges]
+    symbols = []
+    with open(path, 'rb') as f:
+        elf = ELFFile(f)
+        for section in elf.iter_sections():
+            if not isinstance(section, SymbolTableSection):
+                continue
+            for symbol in section.iter_symbols():
+                kind = symbol['st_info']['type']
+                if kind not in ('STT_FUNC', 'STT_OBJECT'):
+                    continue
+                addr = symbol['st_value']
+                if symbol['st_size'] == 0 or \
+                        not in_ranges(ranges, starts, addr):
+                    continue
+                symbols.append((symbol.name,
+                                'func' if kind == 'STT_FUNC' else 'data',
+                                addr, symbol['st_size']))
+    return symbols
+
+
+def region_of(regions, addr):
+    for name, origin, length in regions:
+        if origin <= addr < origin + length:
+            return name
+    return '?'
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(f'usage: {sys.argv[0]} zephyr.elf zephyr.map')
+
+    regions, inputs, _ = read_map(sys.argv[2])
+    symbols = app_symbols(sys.argv[1], app_ranges(inputs))
+
+    by_region = collections.defaultdict(list)
+    for symbol in symbols:
+        by_region[region_of(regions, symbol[2])].append(symbol)
+
+    order = [name for name, _, _ in regions] + ['?']
+    for region in order:
+        if region not in by_region:
+            continue
+        placed = sorted(by_region[region], key=lambda s: s[2])
+        print(region)
+        for name, kind, addr, size in placed:
+            print(f'  {addr:#010x} {size:>7} {kind:<4} {name}')
+        print(f'  {"Total":<10} {sum(s[3] for s in placed):>7}')
+        print()
+
+
+if __name__ == '__main__':
+    main()
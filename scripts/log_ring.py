@@ -0,0 +1,66 @@
+# Decoder for the log ring kept by CONFIG_VTBT_LOG_RING.
+#
+# Usage: log_ring.py build/zephyr/log_dictionary.json ring.bin
+#
+# ring.bin is the log_ring variable read out of the vtbt with a debugger,
+# e.g. with `dump binary value ring.bin log_ring` in gdb. The records are
+# printed oldest first, rendered with Zephyr's dictionary log parser (found
+# through ZEPHYR_BASE) and the database from the same build.
+import os
+import struct
+import sys
+
+LOG_RING_MAGIC = 0x4c4f4752
+HEADER = struct.Struct('<4I')
+RECORD_SIZE = struct.Struct('<H')
+
+
+def read_ring(path):
+    """Returns the records in the ring, oldest first, as one byte string."""
+    with open(path, 'rb') as f:
+        dump = f.read()
+
+    magic, head, tail, used = HEADER.unpack_from(dump)
+    buf = dump[HEADER.size:]
+    if magic != LOG_RING_MAGIC:
+        sys.exit(f'{path}: not a log ring (magic {magic:#010x})')
+    if used > len(buf) or (tail + used) % len(buf) != head:
+        sys.exit(f'{path}: inconsistent ring (head {head}, tail {tail}, '
+                 f'used {used}, size {len(buf)})')
+
+    # Unwrap the ring, then split it into records.
+    ring = (buf[tail:] + buf[:tail])[:used]
+    data = bytearray()
+    offset = 0
+    while offset < len(ring):
+        size, = RECORD_SIZE.unpack_from(ring, offset)
+        offset += RECORD_SIZE.size
+        data += ring[offset:offset + size]
+        offset += size
+    return bytes(data)
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(f'usage: {sys.argv[0]} log_dictionary.json ring.bin')
+
+    zephyr_base = os.environ.get('ZEPHYR_BASE')
+    if zephyr_base is None:
+        sys.exit('ZEPHYR_BASE is not set')
+    sys.path.insert(0, os.path.join(zephyr_base, 'scripts', 'logging',
+                                    'dictionary'))
+    import dictionary_parser
+    from dictionary_parser.log_database import LogDatabase
+
+    database = LogDatabase.read_json_database(sys.argv[1])
+    if database is None:
+        sys.exit(f'{sys.argv[1]}: cannot read the dictionary database')
+    parser = dictionary_parser.get_parser(database)
+    if parser is None:
+        sys.exit(f'{sys.argv[1]}: unsupported database version')
+
+    parser.parse_log_data(read_ring(sys.argv[2]))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,140 @@
+# RAM and flash budget report for a Zephyr build.
+#
+# Usage: mem_budget.py zephyr.elf zephyr.map
+#
+# Prints the use of each memory region from the linker's memory configuration
+# and splits RAM and flash use by library, so that the application, Bluetooth
+# host, kernel and drivers can be budgeted separately.
+import collections
+import re
+import sys
+
+from elftools.elf.constants import SH_FLAGS
+from elftools.elf.elffile import ELFFile
+
+REGION_RE = re.compile(r'^(\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)')
+OUTPUT_RE = re.compile(r'^(\.?[\w.]+)(?:\s+0x([0-9a-f]+)\s+0x([0-9a-f]+))?')
+INPUT_RE = re.compile(r'^ (\S+)(?:\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S+))?$')
+LOAD_RE = re.compile(r'load address 0x([0-9a-f]+)')
+CONT_RE = re.compile(r'^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S+)$')
+LIBRARY_RE = re.compile(r'(?:^|/)lib([^/]+)\.a\(')
+
+
+def elf_sections(path):
+    """Returns {name: (ram, flash)} for the allocated sections."""
+    sections = {}
+    with open(path, 'rb') as f:
+        elf = ELFFile(f)
+        for section in elf.iter_sections():
+            flags = section['sh_flags']
+            if not flags & SH_FLAGS.SHF_ALLOC or section['sh_size'] == 0:
+                continue
+            nobits = section['sh_type'] == 'SHT_NOBITS'
+            writable = flags & SH_FLAGS.SHF_WRITE
+            # Initialized data is copied from flash to RAM at boot.
+            sections[section.name] = (bool(nobits or writable), not nobits)
+    return sections
+
+
+def read_map(path):
+    """Returns the memory regions, the input sections and the load addresses of
+    output sections that are loaded somewhere else than where they run."""
+    regions = []
+    inputs = []
+    loads = {}
+    with open(path) as f:
+        lines = f.read().splitlines()
+
+    i = 0
+    while i < len(lines) and lines[i] != 'Memory Configuration':
+        i += 1
+    i += 3
+    while i < len(lines) and lines[i].strip():
+        m = REGION_RE.match(lines[i])
+        if m and m.group(1) != '*default*':
+            regions.append((m.group(1), int(m.group(2), 16),
+                            int(m.group(3), 16)))
+        i += 1
+
+    output = None
+    pending = None
+    for line in lines[i:]:
+        if not line.strip():
+            continue
+        if pending is not None:
+            m = CONT_RE.match(line)
+            if m:
+                inputs.append((output, int(m.group(1), 16),
+                               int(m.group(2), 16), m.group(3)))
+            pending = None
+            continue
+        if not line[0].isspace():
+            m = OUTPUT_RE.match(line)
+            output = m.group(1)
+            load = LOAD_RE.search(line)
+            if load and m.group(2):
+                loads[output] = int(load.group(1), 16) - int(m.group(2), 16)
+            continue
+        m = INPUT_RE.match(line)
+        if not m or m.group(1).startswith('*'):
+            continue
+        if m.group(2) is None:
+            pending = m.group(1)
+        else:
+            inputs.append((output, int(m.group(2), 16),
+                           int(m.group(3), 16), m.group(4)))
+    return regions, inputs, loads
+
+
+def component(obj):
+    m = LIBRARY_RE.search(obj)
+    if m:
+        return m.group(1).replace('__', '/')
+    return obj.rsplit('/', 1)[-1]
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(f'usage: {sys.argv[0]} zephyr.elf zephyr.map')
+
+    sections = elf_sections(sys.argv[1])
+    regions, inputs, loads = read_map(sys.argv[2])
+
+    used = collections.Counter()
+    ram = collections.Counter()
+    flash = collections.Counter()
+    for output, addr, size, obj in inputs:
+        if output not in sections or size == 0:
+            continue
+        in_ram, in_flash = sections[output]
+        addrs = [addr]
+        # Only initialized data has a load image; .bss has none.
+        if output in loads and in_flash:
+            addrs.append(addr + loads[output])
+        for name, origin, length in regions:
+            for a in addrs:
+                if origin <= a < origin + length:
+                    used[name] += size
+        if in_ram:
+            ram[component(obj)] += size
+        if in_flash:
+            flash[component(obj)] += size
+
+    print('Memory regions')
+    for name, origin, length in regions:
+        if used[name] == 0:
+            continue
+        print(f'  {name:<24} {used[name]:>9} of {length:>9} bytes '
+              f'({100 * used[name] / length:5.1f}%)')
+
+    print()
+    print(f'  {"Component":<40} {"RAM":>9} {"Flash":>9}')
+    for name in sorted(set(ram) | set(flash),
+                       key=lambda n: (-ram[n], -flash[n])):
+        print(f'  {name:<40} {ram[name]:>9} {flash[name]:>9}')
+    print(f'  {"Total":<40} {sum(ram.values()):>9} '
+          f'{sum(flash.values()):>9}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,102 @@
+# Flat profile from the output of CONFIG_VTBT_PROFILER.
+#
+# Usage: profile.py zephyr.elf console.log
+#
+# console.log is the console output of a profiling run (or a decoded log
+# ring). The program counter samples of all reports in it are added up and
+# attributed to the functions of the ELF from the same build, and each
+# thread's CPU share and the idle time are averaged over the reports.
+import bisect
+import collections
+import re
+import sys
+
+from elftools.elf.elffile import ELFFile
+from elftools.elf.sections import SymbolTableSection
+
+REPORT_RE = re.compile(r'profile (\d+) samples, (\d+) lost')
+SHARE_RE = re.compile(r'profile (idle|thread .+) (\d+)\.(\d)%\s*$')
+PC_RE = re.compile(r'profile pc 0x([0-9a-f]+) (\d+)')
+
+
+def functions(path):
+    """Returns the sorted start addresses, ends and names of the ELF's
+    functions."""
+    funcs = []
+    with open(path, 'rb') as f:
+        elf = ELFFile(f)
+        for section in elf.iter_sections():
+            if not isinstance(section, SymbolTableSection):
+                continue
+            for symbol in section.iter_symbols():
+                if symbol['st_info']['type'] != 'STT_FUNC' or \
+                        symbol['st_size'] == 0:
+                    continue
+                # Bit 0 of the address only selects the ISA on some cores.
+                start = symbol['st_value'] & ~1
+                funcs.append((start, start + symbol['st_size'], symbol.name))
+    funcs.sort()
+    return [f[0] for f in funcs], funcs
+
+
+def symbolize(starts, funcs, pc):
+    i = bisect.bisect_right(starts, pc) - 1
+    if i >= 0 and pc < funcs[i][1]:
+        return funcs[i][2]
+    return f'{pc:#x}'
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(f'usage: {sys.argv[0]} zephyr.elf console.log')
+
+    starts, funcs = functions(sys.argv[1])
+
+    reports = 0
+    taken = 0
+    lost = 0
+    shares = collections.Counter()
+    hits = collections.Counter()
+    with open(sys.argv[2], errors='replace') as f:
+        for line in f:
+            m = REPORT_RE.search(line)
+            if m:
+                reports += 1
+                taken += int(m.group(1))
+                lost += int(m.group(2))
+                continue
+            m = SHARE_RE.search(line)
+            if m:
+                shares[m.group(1)] += int(m.group(2)) * 10 + int(m.group(3))
+                continue
+            m = PC_RE.search(line)
+            if m:
+                pc = int(m.group(1), 16)
+                hits[symbolize(starts, funcs, pc)] += int(m.group(2))
+
+    if reports == 0:
+        sys.exit(f'{sys.argv[2]}: no profiler reports')
+
+    print(f'{reports} reports, {taken} samples, {lost} lost')
+    print()
+    print(f'  {"CPU":>6}  Thread')
+    for name, permille in shares.most_common():
+        print(f'  {permille / reports / 10:5.1f}%  {name}')
+
+    total = sum(hits.values())
+    if total == 0:
+        print()
+        print('No program counter samples (not sampled on this target)')
+        return
+
+    print()
+    print(f'  {"Self":>6} {"Cum":>6} {"Samples":>8}  Function')
+    cumulative = 0
+    for name, count in hits.most_common():
+        cumulative += count
+        print(f'  {100 * count / total:5.1f}% {100 * cumulative / total:5.1f}% '
+              f'{count:>8}  {name}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,52 @@
+# Application RAM and flash use of each terminal profile.
+#
+# Usage: profile_size.py [board]
+#
+# Builds the firmware with west once per CONFIG_VTBT_PROFILE_* choice, in
+# build-profile-<profile>, and prints the application's RAM and flash use in
+# each build, split as by mem_budget.py. The board defaults to the vtbt's.
+import os
+import subprocess
+import sys
+
+from mem_budget import component, elf_sections, read_map
+
+PROFILES = ['VT220_LK201', 'VT420_LK201', 'VT420_LK401']
+
+
+def app_use(build):
+    """Returns the application's RAM and flash use in a build."""
+    zephyr = os.path.join(build, 'zephyr')
+    sections = elf_sections(os.path.join(zephyr, 'zephyr.elf'))
+    _, inputs, _ = read_map(os.path.join(zephyr, 'zephyr.map'))
+    ram = flash = 0
+    for output, _, size, obj in inputs:
+        if output not in sections or component(obj) != 'app':
+            continue
+        in_ram, in_flash = sections[output]
+        ram += size if in_ram else 0
+        flash += size if in_flash else 0
+    return ram, flash
+
+
+def main():
+    if len(sys.argv) > 2:
+        sys.exit(f'usage: {sys.argv[0]} [board]')
+    source = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    board = ['-b', sys.argv[1]] if len(sys.argv) == 2 else []
+
+    results = []
+    for profile in PROFILES:
+        build = f'build-profile-{profile.lower()}'
+        subprocess.run(['west', 'build', '-p', 'auto', '-d', build, *board,
+                        source, '--', f'-DCONFIG_VTBT_PROFILE_{profile}=y'],
+                       check=True, stdout=subprocess.DEVNULL)
+        results.append((profile, *app_use(build)))
+
+    print(f'  {"Profile":<16} {"RAM":>9} {"Flash":>9}')
+    for profile, ram, flash in results:
+        print(f'  {profile:<16} {ram:>9} {flash:>9}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,176 @@
+# Timelines, checks and audio from a native_sim peripheral recording.
+#
+# Usage: simrec.py [--check] [--wav beeper.wav] recording.txt
+#
+# recording.txt is written by a native_sim build with sim-recorder.overlay
+# when run with --recorder=recording.txt. The beeper's sounds, key presses,
+# LED and status LED changes are printed in order, followed by the keyclick
+# latency and the click and bell lengths. With --check, the exit status is 1
+# if a click or bell is off its nominal length or a click comes too long after
+# its key press, so the recording can be checked by a test. With --wav, the
+# beeper is rendered to a WAV file.
+import argparse
+import struct
+import sys
+import wave
+
+CLICK_MS = 2
+BELL_MS = 125
+# Sounds up to this long are clicks, longer ones bells.
+CLICK_MAX_MS = 20
+SAMPLE_RATE = 48000
+
+
+def read_recording(path):
+    """Returns the records as (us, kind, device, args) tuples in time order.
+    Key presses are timed at their HID report's arrival, so they can be
+    written after later events."""
+    records = []
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            fields = line.split()
+            if not fields:
+                continue
+            if len(fields) < 3:
+                sys.exit(f'{path}:{number}: malformed record')
+            records.append((int(fields[0]), fields[1], fields[2],
+                            fields[3:]))
+    records.sort(key=lambda r: r[0])
+    return records
+
+
+def sounds(records):
+    """Returns the beeper's sounds as (start us, end us, period ns, duty)
+    tuples, duty being the pulse width over the period."""
+    result = []
+    on = {}
+    for us, kind, device, args in records:
+        if kind != 'pwm':
+            continue
+        channel, period, pulse = args[0], int(args[1]), int(args[2])
+        key = (device, channel)
+        if key in on:
+            start, last_period, duty = on.pop(key)
+            result.append((start, us, last_period, duty))
+        if pulse > 0:
+            on[key] = (us, period, pulse / period)
+    return result
+
+
+def key_latencies(records, clicks):
+    """Returns the time from each key press to the first click starting at or
+    after it, in microseconds, for key presses followed by a click before the
+    next key press."""
+    keys = [us for us, kind, _, _ in records if kind == 'key']
+    starts = sorted(start for start, _, _, _ in clicks)
+    latencies = []
+    c = 0
+    for i, key in enumerate(keys):
+        while c < len(starts) and starts[c] < key:
+            c += 1
+        if c == len(starts):
+            break
+        following = keys[i + 1] if i + 1 < len(keys) else None
+        if following is None or starts[c] < following:
+            latencies.append(starts[c] - key)
+            c += 1
+    return latencies
+
+
+def print_timeline(records, beeps):
+    starts = {start: (end, period) for start, end, period, _ in beeps}
+    for us, kind, device, args in records:
+        if kind == 'key':
+            print(f'{us / 1000:12.1f} ms  key {device} {args[0]}')
+        elif kind == 'gpio':
+            state = 'on' if args[1] == '1' else 'off'
+            print(f'{us / 1000:12.1f} ms  {device} pin {args[0]} {state}')
+        elif kind == 'strip':
+            print(f'{us / 1000:12.1f} ms  {device} pixel {args[0]} '
+                  f'rgb {args[1]} {args[2]} {args[3]}')
+        elif kind == 'pwm' and us in starts:
+            end, period = starts[us]
+            print(f'{us / 1000:12.1f} ms  {device} {1e9 / period:.0f} Hz '
+                  f'for {(end - us) / 1000:.1f} ms')
+
+
+def summary(name, values_us):
+    if not values_us:
+        return f'  {name:<16} none'
+    values = sorted(v / 1000 for v in values_us)
+    return (f'  {name:<16} {len(values):>5}  min {values[0]:7.2f} ms  '
+            f'median {values[len(values) // 2]:7.2f} ms  '
+            f'max {values[-1]:7.2f} ms')
+
+
+def write_wav(path, beeps):
+    """Renders the beeper as a square wave at each sound's PWM frequency and
+    duty cycle."""
+    end = max((e for _, e, _, _ in beeps), default=0)
+    samples = [0] * (end * SAMPLE_RATE // 1000000 + 1)
+    for start, stop, period, duty in beeps:
+        period_s = period / 1e9
+        first = start * SAMPLE_RATE // 1000000
+        last = stop * SAMPLE_RATE // 1000000
+        for n in range(first, last):
+            phase = (n / SAMPLE_RATE) % period_s / period_s
+            samples[n] = 8000 if phase < duty else -8000
+    with wave.open(path, 'wb') as w:
+        w.setnchannels(1)
+        w.setsampwidth(2)
+        w.setframerate(SAMPLE_RATE)
+        w.writeframes(struct.pack(f'<{len(samples)}h', *samples))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('recording')
+    parser.add_argument('--check', action='store_true',
+                        help='fail on clicks and bells off their lengths '
+                             'and on slow keyclicks')
+    parser.add_argument('--tolerance-ms', type=float, default=1.0,
+                        help='allowed error of click and bell lengths')
+    parser.add_argument('--max-latency-ms', type=float, default=5.0,
+                        help='longest allowed key press to click time')
+    parser.add_argument('--wav', help='render the beeper to this WAV file')
+    parser.add_argument('--quiet', action='store_true',
+                        help="don't print the timeline")
+    args = parser.parse_args()
+
+    records = read_recording(args.recording)
+    beeps = sounds(records)
+    clicks = [b for b in beeps if b[1] - b[0] <= CLICK_MAX_MS * 1000]
+    bells = [b for b in beeps if b[1] - b[0] > CLICK_MAX_MS * 1000]
+    latencies = key_latencies(records, clicks)
+
+    if not args.quiet:
+        print_timeline(records, beeps)
+        print()
+    print(summary('Keyclick latency', latencies))
+    print(summary('Click length', [e - s for s, e, _, _ in clicks]))
+    print(summary('Bell length', [e - s for s, e, _, _ in bells]))
+
+    if args.wav:
+        write_wav(args.wav, beeps)
+
+    if args.check:
+        failures = []
+        tolerance = args.tolerance_ms * 1000
+        for name, nominal, group in (('Click', CLICK_MS, clicks),
+                                     ('Bell', BELL_MS, bells)):
+            for start, end, _, _ in group:
+                if abs(end - start - nominal * 1000) > tolerance:
+                    failures.append(f'{name} at {start / 1000:.1f} ms '
+                                    f'lasted {(end - start) / 1000:.1f} ms')
+        for latency in latencies:
+            if latency > args.max_latency_ms * 1000:
+                failures.append(f'Keyclick {latency / 1000:.1f} ms after '
+                                'its key press')
+        for failure in failures:
+            print(failure, file=sys.stderr)
+        if failures:
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
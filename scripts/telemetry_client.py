@@ -0,0 +1,192 @@
+# Client for the vtbt telemetry service (CONFIG_VTBT_TELEMETRY).
+#
+# Prints the notifications from a vtbt and optionally sends a control request
+# first. Works with a vtbt board or with the native_sim build running on a
+# second Bluetooth adapter. Needs bleak (pip install bleak).
+#
+#   python3 scripts/telemetry_client.py
+#   python3 scripts/telemetry_client.py --repeat 0 0 300 33
+#   python3 scripts/telemetry_client.py --link-profile low-latency
+#   python3 scripts/telemetry_client.py --reset-stats
+#   python3 scripts/telemetry_client.py --repeat-profile 7 200 30 160 800
+#   python3 scripts/telemetry_client.py --repeat-profile-mode clamp
+#   python3 scripts/telemetry_client.py --key-stats
+#
+# Records are little-endian:
+#
+# counters   u8 port, u8 host queue used, u8 host queue max, u8 event queue
+#            used, u8 event queue max, u16 events dropped, u16 journal depth,
+#            u16 bytes lost to journal overflow, u32 keys, u16 key latency
+#            avg (us), u16 key latency max (us)
+# histogram  u8 port, u8 bucket count, u16 buckets; bucket i counts key
+#            latencies below 250 << i us, the last one counts the rest
+# link       u8 connected, u8 security level, u16 interval (1.25 ms),
+#            u16 latency, u16 timeout (10 ms), u32 reports, u16 disconnects,
+#            u8 link profile, u32 connection to first report (us)
+# line       u8 port, u8 class (key, special, metronome), u32 bytes sent,
+#            u32 metronome codes dropped, u16 queueing delay avg (us),
+#            u16 queueing delay max (us)
+# keys       0x00 u8 LK201 keycode, u32 presses, u32 repeats, for every key
+#            used; 0x01 u8 division (1-14), u8 first bucket, u32 4 buckets
+#            of the division's dwell histogram, where bucket i counts keys
+#            held for less than 32 << i ms and the last one counts the
+#            rest; 0x02 u32 saves, u16 saves put off by typing, u32 bytes
+#            written, u16 longest save (ms), u16 key presses during saves,
+#            u16 their key latency avg (us), u16 max (us)
+# boot       u32 first TX byte, u32 scan start, u32 first HID report, each in
+#            us from kernel start or 0xffffffff if not reached yet (read only)
+# control    0x01 u8 port, u8 repeat buffer, u16 timeout (ms), u8 rate (/s)
+#            0x02 u8 link profile
+#            0x03 reset statistics
+#            0x04 u8 division (1-14), u16 timeout (ms), u8 rate (/s), u8 rate
+#                 max (/s), u16 acceleration time (ms)
+#            0x05 u8 enabled, u8 clamp to the terminal's settings
+#            0x06 send the key statistics (CONFIG_VTBT_KEY_STATS)
+import argparse
+import asyncio
+import struct
+
+from bleak import BleakClient, BleakScanner
+
+
+def uuid(n):
+    return f'7674627a-{n:04x}-4c4b-8201-564554424c45'
+
+
+SERVICE_UUID = uuid(0)
+COUNTERS_UUID = uuid(1)
+HISTOGRAM_UUID = uuid(2)
+LINK_UUID = uuid(3)
+CONTROL_UUID = uuid(4)
+LINE_UUID = uuid(5)
+KEYS_UUID = uuid(6)
+BOOT_UUID = uuid(7)
+BOOT_PHASES = ['first TX byte', 'scan start', 'first HID report']
+
+LINK_PROFILES = ['default', 'low-latency', 'low-power']
+LINE_CLASSES = ['key', 'special', 'metronome']
+REPEAT_PROFILE_MODES = {'off': (0, 1), 'clamp': (1, 1), 'replace': (1, 0)}
+
+
+def print_counters(_, data):
+    (port, host_used, host_max, event_used, event_max, dropped, journal,
+     lost, keys, avg_us, max_us) = struct.unpack('<5BHHHIHH', data)
+    print(f'vt{port}: host queue {host_used}/{host_max} '
+          f'event queue {event_used}/{event_max} dropped {dropped} '
+          f'journal {journal} lost {lost} keys {keys} '
+          f'latency avg {avg_us} us max {max_us} us')
+
+
+def print_histogram(_, data):
+    port, count = struct.unpack_from('<BB', data)
+    buckets = struct.unpack_from(f'<{count}H', data, 2)
+    edges = [f'<{250 << i}' for i in range(count - 1)] + ['rest']
+    print(f'vt{port}: ' + ' '.join(f'{e}:{n}' for e, n in
+                                   zip(edges, buckets)))
+
+
+def print_link(_, data):
+    (connected, security, interval, latency, timeout, reports, disconnects,
+     profile, setup_us) = struct.unpack('<BBHHHIHBI', data)
+    print(f'keyboard: {"connected" if connected else "disconnected"} '
+          f'security L{security} interval {interval * 1.25} ms '
+          f'latency {latency} timeout {timeout * 10} ms reports {reports} '
+          f'disconnects {disconnects} profile {LINK_PROFILES[profile]} '
+          f'setup {setup_us} us')
+
+
+def print_boot(data):
+    phases = struct.unpack(f'<{len(BOOT_PHASES)}I', data)
+    print('boot: ' + ', '.join(
+        f'{name} {"-" if us == 0xffffffff else f"{us} us"}'
+        for name, us in zip(BOOT_PHASES, phases)))
+
+
+def print_line(_, data):
+    port, line_class, sent, dropped, avg_us, max_us = struct.unpack(
+        '<BBIIHH', data)
+    print(f'vt{port}: {LINE_CLASSES[line_class]} bytes {sent} '
+          f'dropped {dropped} delay avg {avg_us} us max {max_us} us')
+
+
+def print_keys(_, data):
+    if data[0] == 0x00:
+        keycode, presses, repeats = struct.unpack_from('<BII', data, 1)
+        print(f'key 0x{keycode:02x}: presses {presses} repeats {repeats}')
+    elif data[0] == 0x01:
+        division, first = struct.unpack_from('<BB', data, 1)
+        buckets = struct.unpack_from('<4I', data, 3)
+        edges = [f'<{32 << i}' if i < 7 else 'rest'
+                 for i in range(first, first + 4)]
+        print(f'division {division} dwell (ms): ' +
+              ' '.join(f'{e}:{n}' for e, n in zip(edges, buckets)))
+    elif data[0] == 0x02:
+        (saves, deferred, written, longest, keys, avg_us,
+         max_us) = struct.unpack_from('<IHIHHHH', data, 1)
+        print(f'key statistics: saves {saves} deferred {deferred} '
+              f'bytes {written} longest {longest} ms, {keys} keys during '
+              f'saves latency avg {avg_us} us max {max_us} us')
+
+
+async def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--name', default='vtbt')
+    parser.add_argument('--repeat', nargs=4, type=int,
+                        metavar=('PORT', 'BUFFER', 'TIMEOUT_MS', 'RATE'))
+    parser.add_argument('--link-profile', choices=LINK_PROFILES)
+    parser.add_argument('--reset-stats', action='store_true')
+    parser.add_argument('--repeat-profile', nargs=5, type=int,
+                        metavar=('DIVISION', 'TIMEOUT_MS', 'RATE', 'RATE_MAX',
+                                 'ACCEL_MS'))
+    parser.add_argument('--repeat-profile-mode',
+                        choices=REPEAT_PROFILE_MODES)
+    parser.add_argument('--key-stats', action='store_true',
+                        help='print the lifetime key statistics')
+    args = parser.parse_args()
+
+    device = await BleakScanner.find_device_by_name(args.name)
+    if device is None:
+        raise SystemExit(f'{args.name} not found')
+
+    async with BleakClient(device) as client:
+        if args.repeat:
+            port, buffer, timeout, rate = args.repeat
+            await client.write_gatt_char(
+                CONTROL_UUID, struct.pack('<BBBHB', 0x01, port, buffer,
+                                          timeout, rate), response=True)
+        if args.link_profile:
+            await client.write_gatt_char(
+                CONTROL_UUID,
+                bytes([0x02, LINK_PROFILES.index(args.link_profile)]),
+                response=True)
+        if args.reset_stats:
+            await client.write_gatt_char(CONTROL_UUID, bytes([0x03]),
+                                         response=True)
+        if args.repeat_profile:
+            await client.write_gatt_char(
+                CONTROL_UUID, struct.pack('<BBHBBH', 0x04,
+                                          *args.repeat_profile),
+                response=True)
+        if args.repeat_profile_mode:
+            await client.write_gatt_char(
+                CONTROL_UUID,
+                bytes([0x05,
+                       *REPEAT_PROFILE_MODES[args.repeat_profile_mode]]),
+                response=True)
+
+        print_boot(await client.read_gatt_char(BOOT_UUID))
+        print_link(None, await client.read_gatt_char(LINK_UUID))
+        await client.start_notify(KEYS_UUID, print_keys)
+        if args.key_stats:
+            await client.write_gatt_char(CONTROL_UUID, bytes([0x06]),
+                                         response=True)
+        await client.start_notify(COUNTERS_UUID, print_counters)
+        await client.start_notify(HISTOGRAM_UUID, print_histogram)
+        await client.start_notify(LINK_UUID, print_link)
+        await client.start_notify(LINE_UUID, print_line)
+        while client.is_connected:
+            await asyncio.sleep(1)
+
+
+if __name__ == '__main__':
+    asyncio.run(main())
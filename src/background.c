@@ -0,0 +1,27 @@
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+
+#include "background.h"
+
+#define BACKGROUND_STACK_SIZE CONFIG_VTBT_BACKGROUND_STACK_SIZE
+#define BACKGROUND_PRIORITY   K_LOWEST_APPLICATION_THREAD_PRIO
+
+K_THREAD_STACK_DEFINE(background_stack, BACKGROUND_STACK_SIZE);
+struct k_work_q background_work_q;
+
+static int
+background_init(void)
+{
+	const struct k_work_queue_config config = {
+		.name = "background",
+	};
+
+	k_work_queue_init(&background_work_q);
+	k_work_queue_start(&background_work_q, background_stack,
+	                   K_THREAD_STACK_SIZEOF(background_stack),
+	                   BACKGROUND_PRIORITY, &config);
+
+	return 0;
+}
+
+SYS_INIT(background_init, POST_KERNEL, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,12 @@
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+#include <zephyr/kernel.h>
+
+/* A work queue for slow work such as flash writes and telemetry. Its thread
+ * runs below every vtbt thread and, unlike the system workqueue's, is
+ * preemptible, so the work never delays a keystroke. Running from POST_KERNEL
+ * init on. */
+extern struct k_work_q background_work_q;
+
+#endif /* BACKGROUND_H */
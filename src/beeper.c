@@ -3,101 +3,127 @@
 #include <zephyr/logging/log.h>
 
 #include "beeper.h"
+#include "trace.h"
 
 LOG_MODULE_REGISTER(beeper, CONFIG_LOG_DEFAULT_LEVEL);
 
-K_MUTEX_DEFINE(beeper_mutex);
-
-static const struct pwm_dt_spec pwm_beeper0 =
-	PWM_DT_SPEC_GET(DT_ALIAS(pwm_beeper0));
-
-static int keyclick_volume = -1;
-static int bell_volume = -1;
+static void beeper_off_work_handler(struct k_work *work);
+static void beeper_off_timer_handler(struct k_timer *timer);
 
 int
-beeper_init(void)
+beeper_init(struct beeper *beeper)
 {
-	int ret = pwm_is_ready_dt(&pwm_beeper0);
+	k_mutex_init(&beeper->mutex);
+	k_work_init(&beeper->off_work, beeper_off_work_handler);
+	k_timer_init(&beeper->off_timer, beeper_off_timer_handler, NULL);
+
+	VTBT_TRACE_OBJECT("beeper_mutex", &beeper->mutex);
+
+	if (beeper->pwm == NULL) {
+		return 0;
+	}
+
+	int ret = pwm_is_ready_dt(beeper->pwm);
         if (!ret) {
                 printk("Error: Beeper PWM device %s is not ready\n",
-                       pwm_beeper0.dev->name);
+                       beeper->pwm->dev->name);
         }
 	return ret;
 }
 
 void
-beeper_set_bell_volume(int volume)
+beeper_set_bell_volume(struct beeper *beeper, int volume)
 {
-	bell_volume = volume;
+	beeper->bell_volume = volume;
 }
 
 void
-beeper_set_keyclick_volume(int volume)
+beeper_set_keyclick_volume(struct beeper *beeper, int volume)
 {
-	keyclick_volume = volume;
+	beeper->keyclick_volume = volume;
+}
+
+int
+beeper_get_bell_volume(struct beeper *beeper)
+{
+	return beeper->bell_volume;
+}
+
+int
+beeper_get_keyclick_volume(struct beeper *beeper)
+{
+	return beeper->keyclick_volume;
 }
 
 static void
-beeper_on(int volume)
+beeper_on(struct beeper *beeper, int volume)
 {
-	const uint32_t pulse = (pwm_beeper0.period / 2U) * (8 - volume) / 8;
-	k_mutex_lock(&beeper_mutex, K_FOREVER);
-	int ret = pwm_set_dt(&pwm_beeper0, pwm_beeper0.period, pulse);
-	k_mutex_unlock(&beeper_mutex);
+	if (beeper->pwm == NULL) {
+		return;
+	}
+
+	const uint32_t pulse = (beeper->pwm->period / 2U) * (8 - volume) / 8;
+	k_mutex_lock(&beeper->mutex, K_FOREVER);
+	int ret = pwm_set_dt(beeper->pwm, beeper->pwm->period, pulse);
+	k_mutex_unlock(&beeper->mutex);
 	if (ret) {
 		LOG_ERR("Error %d: failed to set pulse width", ret);
 	}
 }
 
 static void
-beeper_off(void)
+beeper_off(struct beeper *beeper)
 {
-	k_mutex_lock(&beeper_mutex, K_FOREVER);
-	int ret = pwm_set_dt(&pwm_beeper0, pwm_beeper0.period, 0);
-	k_mutex_unlock(&beeper_mutex);
+	if (beeper->pwm == NULL) {
+		return;
+	}
+
+	k_mutex_lock(&beeper->mutex, K_FOREVER);
+	int ret = pwm_set_dt(beeper->pwm, beeper->pwm->period, 0);
+	k_mutex_unlock(&beeper->mutex);
 	if (ret) {
 		LOG_ERR("Error %d: failed to set pulse width", ret);
 	}
 }
 
-void beeper_off_work_handler(struct k_work *work)
+static void
+beeper_off_work_handler(struct k_work *work)
 {
-	ARG_UNUSED(work);
+	struct beeper *beeper = CONTAINER_OF(work, struct beeper, off_work);
 
-	beeper_off();
+	beeper_off(beeper);
 }
 
-K_WORK_DEFINE(beeper_off_work, beeper_off_work_handler);
-
-void beeper_off_timer_handler(struct k_timer *dummy)
+static void
+beeper_off_timer_handler(struct k_timer *timer)
 {
-	ARG_UNUSED(dummy);
+	struct beeper *beeper = CONTAINER_OF(timer, struct beeper, off_timer);
 
-	k_work_submit(&beeper_off_work);
+	k_work_submit(&beeper->off_work);
 }
 
-K_TIMER_DEFINE(beeper_off_timer, beeper_off_timer_handler, NULL);
-
 void
-beeper_sound_keyclick(void)
+beeper_sound_keyclick(struct beeper *beeper)
 {
-	if (keyclick_volume < 0) {
+	if (beeper->keyclick_volume < 0) {
 		return;
 	}
 
-	beeper_on(keyclick_volume);
+	VTBT_TRACE("keyclick", beeper->keyclick_volume, 0);
+
+	beeper_on(beeper, beeper->keyclick_volume);
 
-	k_timer_start(&beeper_off_timer, K_MSEC(2), K_FOREVER);
+	k_timer_start(&beeper->off_timer, K_MSEC(2), K_FOREVER);
 }
 
 void
-beeper_sound_bell(void)
+beeper_sound_bell(struct beeper *beeper)
 {
-	if (bell_volume < 0) {
+	if (beeper->bell_volume < 0) {
 		return;
 	}
 
-	beeper_on(bell_volume);
+	beeper_on(beeper, beeper->bell_volume);
 
-	k_timer_start(&beeper_off_timer, K_MSEC(125), K_FOREVER);
+	k_timer_start(&beeper->off_timer, K_MSEC(125), K_FOREVER);
 }
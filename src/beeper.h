@@ -1,12 +1,38 @@
 #ifndef BEEPER_H
 #define BEEPER_H
 
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/pwm.h>
+
 /* Volumes are 0 (highest) to 7 (lowest) or -1 (disabled) */
 
-int beeper_init(void);
-void beeper_set_bell_volume(int volume);
-void beeper_set_keyclick_volume(int volume);
-void beeper_sound_bell(void);
-void beeper_sound_keyclick(void);
+struct beeper {
+	/* NULL for ports without a beeper, which still track the volumes. */
+	const struct pwm_dt_spec *pwm;
+	struct k_mutex mutex;
+	struct k_work off_work;
+	struct k_timer off_timer;
+	int keyclick_volume;
+	int bell_volume;
+};
+
+/* Static initializer for the devicetree parts of a struct beeper. */
+#define BEEPER_DT_INIT(node_id)                                         \
+	{                                                               \
+		.pwm = COND_CODE_1(DT_NODE_HAS_PROP(node_id, pwms),     \
+		                   (&(const struct pwm_dt_spec)         \
+		                    PWM_DT_SPEC_GET(node_id)),          \
+		                   (NULL)),                             \
+		.keyclick_volume = -1,                                  \
+		.bell_volume = -1,                                      \
+	}
+
+int beeper_init(struct beeper *beeper);
+void beeper_set_bell_volume(struct beeper *beeper, int volume);
+void beeper_set_keyclick_volume(struct beeper *beeper, int volume);
+int beeper_get_bell_volume(struct beeper *beeper);
+int beeper_get_keyclick_volume(struct beeper *beeper);
+void beeper_sound_bell(struct beeper *beeper);
+void beeper_sound_keyclick(struct beeper *beeper);
 
 #endif /* BEEPER_H */
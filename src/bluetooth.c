@@ -26,18 +26,63 @@
 #include <zephyr/drivers/led_strip.h>
 
 #include "vtbt.h"
-#include "lk201.h"
+#include "bluetooth.h"
+#include "bonds.h"
+#include "bt_benchmark.h"
+#include "metrics.h"
+#include "report_map.h"
+#include "telemetry.h"
+#include "trace.h"
 
 #define STRIP_NODE              DT_ALIAS(led_strip)
-#define STRIP_NUM_PIXELS        DT_PROP(DT_ALIAS(led_strip), chain_length)
+#define STRIP_NUM_PIXELS        DT_PROP_OR(DT_ALIAS(led_strip), chain_length, 0)
+
+/* Bluetooth bring-up runs below every other application thread so that it
+ * never delays the LK201 event loop. */
+#define BT_INIT_STACK_SIZE      CONFIG_VTBT_BT_INIT_STACK_SIZE
+#define BT_INIT_PRIORITY        K_LOWEST_APPLICATION_THREAD_PRIO
+
+/* Input reports subscribed to on one keyboard: keys, media keys and the like
+ * come as separate reports. The keyboard's own report is always the first,
+ * and the only one passed on as a boot keyboard report. */
+#define INPUT_REPORTS_MAX       BOND_INPUT_REPORTS
+#define KEYBOARD_REPORT         0
+
+/* Report type in a Report Reference descriptor. */
+#define REPORT_TYPE_INPUT       0x01
+
+BUILD_ASSERT(BONDS_MAX <= 9, "Bond slots are chosen with the digits 1 to 9");
 
 LOG_MODULE_REGISTER(main, CONFIG_LOG_DEFAULT_LEVEL);
 
-static void (*hid_report_cb)(const uint8_t *report);
+static hid_report_cb_t hid_report_cb;
+static link_lost_cb_t link_lost_cb;
+static void *hid_report_user_data;
+
+static const struct bt_le_conn_param link_profiles[NUM_LINK_PROFILES] = {
+	[LINK_PROFILE_DEFAULT] = BT_LE_CONN_PARAM_INIT(24, 40, 0, 400),
+	[LINK_PROFILE_LOW_LATENCY] = BT_LE_CONN_PARAM_INIT(6, 6, 0, 400),
+	[LINK_PROFILE_LOW_POWER] = BT_LE_CONN_PARAM_INIT(80, 80, 4, 600),
+};
+
+static struct link_stats link_stats;
+
+/* Keyboard LED output report: the state wanted by the terminal and the last
+ * state written, or -1 when the keyboard's LEDs are unknown. */
+static atomic_t hid_leds;
+static atomic_t hid_leds_written = ATOMIC_INIT(-1);
+static uint16_t out_report_handle;
+
+static void leds_write(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(leds_work, leds_write);
 
+/* Boards without a status LED (e.g. native_sim) skip the status colors. */
+#if DT_NODE_EXISTS(STRIP_NODE)
 static struct led_rgb pixels[STRIP_NUM_PIXELS];
 
 static const struct device *const strip = DEVICE_DT_GET(STRIP_NODE);
+#endif
 
 static const struct led_rgb color_black = { .r = 0x00, .g = 0x00, .b = 0x00 };
 static const struct led_rgb color_amber = { .r = 0x03, .g = 0x01, .b = 0x00 };
@@ -47,6 +92,7 @@ static const struct led_rgb color_green = { .r = 0x00, .g = 0x04, .b = 0x00 };
 static void
 rgb_led_set(const struct led_rgb *color)
 {
+#if DT_NODE_EXISTS(STRIP_NODE)
 	memset(&pixels, 0x00, sizeof(pixels));
 	for (int i = 0; i < STRIP_NUM_PIXELS; i++) {
 		memcpy(&pixels[i], color, sizeof(struct led_rgb));
@@ -55,29 +101,91 @@ rgb_led_set(const struct led_rgb *color)
 	if (rc) {
 		LOG_ERR("Couldn't update strip: %d", rc);
 	}
+#else
+	ARG_UNUSED(color);
+#endif
 }
 
 static void start_scan(void);
 
 static struct bt_conn *default_conn;
 
-static struct bt_uuid_16 discover_uuid = BT_UUID_INIT_16(0);
 static struct bt_gatt_discover_params discover_params;
-static struct bt_gatt_subscribe_params subscribe_params;
+static struct bt_gatt_subscribe_params subscribe_params[INPUT_REPORTS_MAX];
+static int num_input_reports;
+static bool subscribed;
+/* k_uptime_ticks() of the connection, for link_stats.setup_us. */
+static int64_t connected_time;
+/* Set while subscribing with the handles cached in the keyboard's bond. */
+static bool cached_handles;
+
+/* The bond of the connected keyboard, once it is bonded, and the keyboard
+ * picked with the switch chord to connect to next. */
+static struct bond *active_bond;
+static struct bond *switch_bond;
+
+static void switch_keyboard(struct k_work *work);
+static void apply_link_profile(struct k_work *work);
+
+static K_WORK_DEFINE(switch_work, switch_keyboard);
+static K_WORK_DEFINE(profile_work, apply_link_profile);
+
+/* Record the connected keyboard as the most recently used one if it's bonded,
+ * along with its handles once it's subscribed. */
+static void
+bond_update(struct bt_conn *conn)
+{
+	const bt_addr_le_t *addr = bt_conn_get_dst(conn);
+
+	if (!bt_le_bond_exists(BT_ID_DEFAULT, addr)) {
+		return;
+	}
+
+	active_bond = bonds_use(addr);
+	if (subscribed) {
+		for (int i = 0; i < BOND_INPUT_REPORTS; i++) {
+			bool used = i < num_input_reports;
+
+			active_bond->report_handles[i] = used ?
+				subscribe_params[i].value_handle : 0;
+			active_bond->ccc_handles[i] = used ?
+				subscribe_params[i].ccc_handle : 0;
+		}
+		active_bond->out_report_handle = out_report_handle;
+	}
+	active_bond->profile = link_stats.profile;
+	bonds_save(active_bond);
+
+	LOG_INF("Keyboard in slot %d", bonds_slot(active_bond) + 1);
+}
 
 static void
 pairing_complete_func(struct bt_conn *conn, bool bonded)
 {
-	ARG_UNUSED(conn);
-	ARG_UNUSED(bonded);
+	/* Telemetry clients pair too. */
+	if (conn != default_conn) {
+		return;
+	}
 
 	rgb_led_set(&color_amber);
+
+	if (bonded) {
+		bond_update(conn);
+	}
+}
+
+static void
+bond_deleted_func(uint8_t id, const bt_addr_le_t *peer)
+{
+	ARG_UNUSED(id);
+
+	bonds_remove(peer);
 }
 
 static struct bt_conn_auth_info_cb auth_info_cb = {
 	.pairing_complete = pairing_complete_func,
 	.pairing_failed = NULL,
-	.bond_deleted = NULL,
+	.bond_deleted = bond_deleted_func,
 };
 
 static uint8_t
@@ -87,14 +195,38 @@ notify_func(struct bt_conn *conn,
 {
 	ARG_UNUSED(conn);
 
+	int64_t time = k_uptime_ticks();
+
+	VTBT_TRACE("notify", length, 0);
+
 	if (!data) {
 		LOG_INF("[UNSUBSCRIBED]");
 		params->value_handle = 0U;
 		return BT_GATT_ITER_STOP;
 	}
 
+	/* Media keys, mice and the like send 8-byte reports too. */
+	if (params->value_handle !=
+	    subscribe_params[KEYBOARD_REPORT].value_handle) {
+		return BT_GATT_ITER_CONTINUE;
+	}
+
 	if (length == HID_REPORT_SIZE) {
-		hid_report_cb((const uint8_t *)data);
+		metrics_boot_phase_mark(BOOT_PHASE_FIRST_REPORT);
+		if (link_stats.setup_us == 0) {
+			link_stats.setup_us =
+				k_ticks_to_us_floor32(time - connected_time);
+			LOG_INF("First report %u us after connecting",
+			        link_stats.setup_us);
+		}
+		link_stats.reports++;
+		hid_report_cb((const uint8_t *)data, time,
+		              hid_report_user_data);
+		if (IS_ENABLED(CONFIG_VTBT_BT_BENCHMARK)) {
+			bt_benchmark_record(BT_BENCHMARK_REPORT, time,
+			                    ((const uint8_t *)data)[
+			                            HID_REPORT_FIRST_KEY]);
+		}
 	} else {
 		LOG_INF("[NOTIFICATION] data %p length %u", data, length);
 	}
@@ -102,90 +234,396 @@ notify_func(struct bt_conn *conn,
 	return BT_GATT_ITER_CONTINUE;
 }
 
-static uint16_t hids_handle = 0;
+static void
+subscribe_func(struct bt_conn *conn, uint8_t err,
+               struct bt_gatt_subscribe_params *params)
+{
+	ARG_UNUSED(conn);
+
+	/* The keyboard's attributes moved since the handles were cached. The
+	 * other subscriptions are already out with stale handles, so forget
+	 * them and reconnect, which discovers the keyboard again. */
+	if (err && cached_handles) {
+		LOG_INF("Cached handle %u is stale (err 0x%02x)",
+		        params->value_handle, err);
+		cached_handles = false;
+		if (active_bond != NULL) {
+			memset(active_bond->ccc_handles, 0,
+			       sizeof(active_bond->ccc_handles));
+			bonds_save(active_bond);
+		}
+		k_work_submit(&switch_work);
+	}
+}
 
-static uint8_t
-discover_func(struct bt_conn *conn,
-              const struct bt_gatt_attr *attr,
-              struct bt_gatt_discover_params *params)
+/* Subscribe to all of the keyboard's input reports at once. Subscriptions
+ * sent before the link is encrypted are retried by the stack once it is. */
+static void
+subscribe(struct bt_conn *conn)
 {
 	int err;
 
-	if (!attr) {
-		LOG_INF("Discover complete");
-		(void)memset(params, 0, sizeof(*params));
-		return BT_GATT_ITER_STOP;
+	if (num_input_reports == 0) {
+		LOG_ERR("No input reports");
+		return;
+	}
+
+	for (int i = 0; i < num_input_reports; i++) {
+		struct bt_gatt_subscribe_params *params = &subscribe_params[i];
+
+		params->notify = notify_func;
+		params->subscribe = subscribe_func;
+		params->value = BT_GATT_CCC_NOTIFY;
+		/* Resubscribe on every connection, with handles that may
+		 * have been discovered again. */
+		atomic_set_bit(params->flags,
+		               BT_GATT_SUBSCRIBE_FLAG_VOLATILE);
+
+		err = bt_gatt_subscribe(conn, params);
+		if (err && err != -EALREADY) {
+			LOG_ERR("Subscribe to handle %u failed (err %d)",
+			        params->value_handle, err);
+			return;
+		}
+	}
+
+	LOG_ERR("[SUBSCRIBED] %d input reports", num_input_reports);
+	if (IS_ENABLED(CONFIG_VTBT_BT_BENCHMARK)) {
+		bt_benchmark_record(BT_BENCHMARK_SUBSCRIBED, k_uptime_ticks(),
+		                    0);
+	}
+	if (bt_conn_get_security(conn) >= BT_SECURITY_L2) {
+		rgb_led_set(&color_amber);
+	} else {
+		rgb_led_set(&color_green);
+	}
+
+	subscribed = true;
+	bond_update(conn);
+
+	/* The keyboard's LEDs are off after a reconnect. */
+	atomic_set(&hid_leds_written, -1);
+	k_work_schedule(&leds_work, K_NO_WAIT);
+}
+
+/* What the characteristic being walked by discovery is, and the handle of
+ * its value, which follows its declaration. */
+enum hids_chrc {
+	HIDS_CHRC_OTHER,
+	HIDS_CHRC_REPORT,
+	HIDS_CHRC_BOOT_KB_IN_REPORT,
+};
+
+static enum hids_chrc chrc_type;
+static uint16_t chrc_value_handle;
+static uint16_t chrc_ccc_handle;
+static uint16_t chrc_report_ref_handle;
+/* The boot keyboard input report, used if there are no report mode input
+ * reports. */
+static uint16_t boot_in_handle;
+static uint16_t boot_in_ccc_handle;
+
+/* Report Reference descriptors of the input reports, and their values: the
+ * report ID and type. */
+static uint16_t report_ref_handles[INPUT_REPORTS_MAX];
+static uint8_t report_refs[INPUT_REPORTS_MAX][2];
+/* Indices of the input reports whose descriptors are being read. */
+static uint8_t report_ref_reads[INPUT_REPORTS_MAX];
+static uint16_t report_ref_read_handles[INPUT_REPORTS_MAX];
+static size_t report_ref_count;
+static size_t report_ref_bytes;
+static uint16_t report_map_handle;
+static struct report_map_parser report_map;
+static struct bt_gatt_read_params read_params;
+
+/* Called at the end of each characteristic walked by discovery. Report
+ * characteristics with a CCC descriptor are input reports; output and feature
+ * reports can't notify. */
+static void
+hids_chrc_done(void)
+{
+	if (chrc_type != HIDS_CHRC_REPORT || chrc_ccc_handle == 0) {
+		return;
 	}
 
-	LOG_INF("[ATTRIBUTE] handle %u", attr->handle);
+	if (num_input_reports == INPUT_REPORTS_MAX) {
+		LOG_ERR("Ignoring input report %u", chrc_value_handle);
+		return;
+	}
 
-	if (!bt_uuid_cmp(discover_params.uuid, BT_UUID_HIDS)) {
-		hids_handle = attr->handle;
-		memcpy(&discover_uuid, BT_UUID_HIDS_BOOT_KB_IN_REPORT,
-		       sizeof(discover_uuid));
-		discover_params.uuid = &discover_uuid.uuid;
-		discover_params.start_handle = hids_handle + 1;
-		discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+	subscribe_params[num_input_reports].value_handle = chrc_value_handle;
+	subscribe_params[num_input_reports].ccc_handle = chrc_ccc_handle;
+	report_ref_handles[num_input_reports] = chrc_report_ref_handle;
+	num_input_reports++;
+}
 
-		err = bt_gatt_discover(conn, &discover_params);
-		if (err) {
-			LOG_ERR("Discover failed (err %d)", err);
+/* Discovery by attribute only gives types and handles. The values that tell
+ * the keyboard's report from the others are read once the walk is done. */
+static void
+hids_attribute_found(const struct bt_gatt_attr *attr)
+{
+	if (!bt_uuid_cmp(attr->uuid, BT_UUID_GATT_CHRC)) {
+		hids_chrc_done();
+		chrc_type = HIDS_CHRC_OTHER;
+		chrc_value_handle = attr->handle + 1;
+		chrc_ccc_handle = 0;
+		chrc_report_ref_handle = 0;
+	} else if (attr->handle == chrc_value_handle) {
+		if (!bt_uuid_cmp(attr->uuid, BT_UUID_HIDS_REPORT)) {
+			chrc_type = HIDS_CHRC_REPORT;
+		} else if (!bt_uuid_cmp(attr->uuid, BT_UUID_HIDS_REPORT_MAP)) {
+			report_map_handle = attr->handle;
+		} else if (!bt_uuid_cmp(attr->uuid,
+		                        BT_UUID_HIDS_BOOT_KB_IN_REPORT)) {
+			chrc_type = HIDS_CHRC_BOOT_KB_IN_REPORT;
+			boot_in_handle = attr->handle;
+		} else if (!bt_uuid_cmp(attr->uuid,
+		                        BT_UUID_HIDS_BOOT_KB_OUT_REPORT)) {
+			out_report_handle = attr->handle;
 		}
-	} else if (!bt_uuid_cmp(discover_params.uuid,
-	                        BT_UUID_HIDS_BOOT_KB_IN_REPORT)) {
-		memcpy(&discover_uuid, BT_UUID_HIDS_BOOT_KB_OUT_REPORT,
-		       sizeof(discover_uuid));
-		discover_params.uuid = &discover_uuid.uuid;
-		discover_params.start_handle = hids_handle + 1;
-		discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
-
-		err = bt_gatt_discover(conn, &discover_params);
-		if (err) {
-			LOG_ERR("Discover failed (err %d)", err);
+	} else if (!bt_uuid_cmp(attr->uuid, BT_UUID_GATT_CCC)) {
+		switch (chrc_type) {
+		case HIDS_CHRC_REPORT:
+			chrc_ccc_handle = attr->handle;
+			break;
+		case HIDS_CHRC_BOOT_KB_IN_REPORT:
+			boot_in_ccc_handle = attr->handle;
+			break;
+		default:
+			break;
 		}
-	} else if (!bt_uuid_cmp(discover_params.uuid,
-	                        BT_UUID_HIDS_BOOT_KB_OUT_REPORT)) {
-		memcpy(&discover_uuid, BT_UUID_HIDS_REPORT,
-		       sizeof(discover_uuid));
-		discover_params.uuid = &discover_uuid.uuid;
-		discover_params.start_handle = hids_handle + 1;
-		discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
-
-		err = bt_gatt_discover(conn, &discover_params);
-		if (err) {
-			LOG_ERR("Discover failed (err %d)", err);
+	} else if (!bt_uuid_cmp(attr->uuid, BT_UUID_HIDS_REPORT_REF) &&
+	           chrc_type == HIDS_CHRC_REPORT) {
+		chrc_report_ref_handle = attr->handle;
+	}
+}
+
+/* Move the input report with the keyboard's report ID to KEYBOARD_REPORT,
+ * then subscribe. Without a match, the first input report is taken. */
+static void
+keyboard_report_pick(struct bt_conn *conn)
+{
+	int id = report_map_keyboard_id(&report_map);
+	int keyboard = -1;
+
+	for (int i = 0; i < num_input_reports && id >= 0; i++) {
+		if (report_ref_handles[i] != 0 && report_refs[i][0] == id &&
+		    report_refs[i][1] == REPORT_TYPE_INPUT) {
+			keyboard = i;
+			break;
+		}
+	}
+
+	if (keyboard < 0) {
+		LOG_WRN("No keyboard report found, using handle %u",
+		        subscribe_params[KEYBOARD_REPORT].value_handle);
+	} else if (keyboard != KEYBOARD_REPORT) {
+		struct bt_gatt_subscribe_params *from =
+			&subscribe_params[keyboard];
+		struct bt_gatt_subscribe_params *to =
+			&subscribe_params[KEYBOARD_REPORT];
+		uint16_t value_handle = to->value_handle;
+		uint16_t ccc_handle = to->ccc_handle;
+
+		to->value_handle = from->value_handle;
+		to->ccc_handle = from->ccc_handle;
+		from->value_handle = value_handle;
+		from->ccc_handle = ccc_handle;
+	}
+
+	LOG_INF("Keyboard report ID %d at handle %u", id,
+	        subscribe_params[KEYBOARD_REPORT].value_handle);
+	subscribe(conn);
+}
+
+static uint8_t
+report_map_read_func(struct bt_conn *conn, uint8_t err,
+                     struct bt_gatt_read_params *params, const void *data,
+                     uint16_t length)
+{
+	ARG_UNUSED(params);
+
+	if (err) {
+		LOG_ERR("Reading the report map failed (err 0x%02x)", err);
+		keyboard_report_pick(conn);
+		return BT_GATT_ITER_STOP;
+	}
+
+	/* Long maps come in several reads. */
+	if (data != NULL) {
+		report_map_parse(&report_map, data, length);
+		return BT_GATT_ITER_CONTINUE;
+	}
+
+	keyboard_report_pick(conn);
+
+	return BT_GATT_ITER_STOP;
+}
+
+static void
+report_map_read(struct bt_conn *conn)
+{
+	int err;
+
+	report_map_init(&report_map);
+	if (report_map_handle == 0) {
+		keyboard_report_pick(conn);
+		return;
+	}
+
+	memset(&read_params, 0, sizeof(read_params));
+	read_params.func = report_map_read_func;
+	read_params.handle_count = 1;
+	read_params.single.handle = report_map_handle;
+	read_params.single.offset = 0;
+
+	err = bt_gatt_read(conn, &read_params);
+	if (err) {
+		LOG_ERR("Read report map failed (err %d)", err);
+		keyboard_report_pick(conn);
+	}
+}
+
+static uint8_t
+report_refs_read_func(struct bt_conn *conn, uint8_t err,
+                      struct bt_gatt_read_params *params, const void *data,
+                      uint16_t length)
+{
+	ARG_UNUSED(params);
+
+	const uint8_t *bytes = data;
+
+	if (err) {
+		LOG_ERR("Reading report references failed (err 0x%02x)", err);
+		memset(report_ref_handles, 0, sizeof(report_ref_handles));
+		report_map_read(conn);
+		return BT_GATT_ITER_STOP;
+	}
+
+	/* The values are 2 bytes each, one after the other. */
+	if (data != NULL) {
+		for (uint16_t i = 0; i < length &&
+		     report_ref_bytes < 2 * report_ref_count; i++) {
+			int report = report_ref_reads[report_ref_bytes / 2];
+
+			report_refs[report][report_ref_bytes % 2] = bytes[i];
+			report_ref_bytes++;
 		}
-	} else if (!bt_uuid_cmp(discover_params.uuid, BT_UUID_HIDS_REPORT)) {
-		memcpy(&discover_uuid, BT_UUID_GATT_CCC, sizeof(discover_uuid));
-		discover_params.uuid = &discover_uuid.uuid;
-		discover_params.start_handle = attr->handle + 1;
-		discover_params.type = BT_GATT_DISCOVER_DESCRIPTOR;
-		subscribe_params.value_handle = bt_gatt_attr_value_handle(attr);
-
-		err = bt_gatt_discover(conn, &discover_params);
-		if (err) {
-			LOG_ERR("Discover failed (err %d)", err);
+		return BT_GATT_ITER_CONTINUE;
+	}
+
+	report_map_read(conn);
+
+	return BT_GATT_ITER_STOP;
+}
+
+/* Find out which input report is the keyboard's, from the report IDs in the
+ * Report Reference descriptors and the keyboard's report ID in the report
+ * map. Only done after discovery; the bond keeps the result. */
+static void
+keyboard_report_find(struct bt_conn *conn)
+{
+	size_t count = 0;
+	int err;
+
+	memset(report_refs, 0, sizeof(report_refs));
+	for (int i = 0; i < num_input_reports; i++) {
+		if (report_ref_handles[i] != 0) {
+			report_ref_reads[count] = i;
+			report_ref_read_handles[count] = report_ref_handles[i];
+			count++;
 		}
+	}
+
+	if (count == 0) {
+		report_map_read(conn);
+		return;
+	}
+	report_ref_count = count;
+
+	memset(&read_params, 0, sizeof(read_params));
+	read_params.func = report_refs_read_func;
+	read_params.handle_count = count;
+	if (count == 1) {
+		read_params.single.handle = report_ref_read_handles[0];
+		read_params.single.offset = 0;
 	} else {
-		subscribe_params.notify = notify_func;
-		subscribe_params.value = BT_GATT_CCC_NOTIFY;
-		subscribe_params.ccc_handle = attr->handle;
+		read_params.multiple.handles = report_ref_read_handles;
+		read_params.multiple.variable = false;
+	}
+	report_ref_bytes = 0;
 
-		err = bt_gatt_subscribe(conn, &subscribe_params);
-		if (err && err != -EALREADY) {
-			LOG_ERR("Subscribe failed (err %d)", err);
+	err = bt_gatt_read(conn, &read_params);
+	if (err) {
+		LOG_ERR("Read report references failed (err %d)", err);
+		memset(report_ref_handles, 0, sizeof(report_ref_handles));
+		report_map_read(conn);
+	}
+}
+
+static uint8_t
+discover_func(struct bt_conn *conn,
+              const struct bt_gatt_attr *attr,
+              struct bt_gatt_discover_params *params)
+{
+	int err;
+
+	if (!attr) {
+		bool walked = params->type == BT_GATT_DISCOVER_ATTRIBUTE;
+
+		LOG_INF("Discover complete");
+		(void)memset(params, 0, sizeof(*params));
+		if (!walked) {
+			LOG_ERR("No HID service");
+			return BT_GATT_ITER_STOP;
+		}
+
+		hids_chrc_done();
+		if (num_input_reports == 0 && boot_in_ccc_handle != 0) {
+			subscribe_params[0].value_handle = boot_in_handle;
+			subscribe_params[0].ccc_handle = boot_in_ccc_handle;
+			num_input_reports = 1;
+		}
+		if (num_input_reports > 1) {
+			keyboard_report_find(conn);
 		} else {
-			LOG_ERR("[SUBSCRIBED]");
-			if (bt_conn_get_security(conn) >= BT_SECURITY_L2) {
-				rgb_led_set(&color_amber);
-			} else {
-				rgb_led_set(&color_green);
-			}
+			subscribe(conn);
 		}
 
 		return BT_GATT_ITER_STOP;
 	}
 
+	if (params->type == BT_GATT_DISCOVER_ATTRIBUTE) {
+		hids_attribute_found(attr);
+		return BT_GATT_ITER_CONTINUE;
+	}
+
+	const struct bt_gatt_service_val *service = attr->user_data;
+
+	LOG_INF("[SERVICE] handles %u-%u", attr->handle, service->end_handle);
+
+	/* Walk the service once for every characteristic and descriptor,
+	 * rather than with a discovery round trip for each. */
+	num_input_reports = 0;
+	chrc_type = HIDS_CHRC_OTHER;
+	chrc_value_handle = 0;
+	chrc_ccc_handle = 0;
+	chrc_report_ref_handle = 0;
+	report_map_handle = 0;
+	boot_in_handle = 0;
+	boot_in_ccc_handle = 0;
+	out_report_handle = 0;
+
+	discover_params.uuid = NULL;
+	discover_params.start_handle = attr->handle + 1;
+	discover_params.end_handle = service->end_handle;
+	discover_params.type = BT_GATT_DISCOVER_ATTRIBUTE;
+
+	err = bt_gatt_discover(conn, &discover_params);
+	if (err) {
+		LOG_ERR("Discover failed (err %d)", err);
+	}
+
 	return BT_GATT_ITER_STOP;
 }
 
@@ -204,7 +642,7 @@ eir_found(struct bt_data *data, void *user_data)
 		}
 
 		for (i = 0; i < data->data_len; i += sizeof(uint16_t)) {
-			struct bt_le_conn_param *param;
+			const struct bt_le_conn_param *param;
 			const struct bt_uuid *uuid;
 			uint16_t u16;
 			int err;
@@ -221,7 +659,7 @@ eir_found(struct bt_data *data, void *user_data)
 				continue;
 			}
 
-			param = BT_LE_CONN_PARAM_DEFAULT;
+			param = &link_profiles[link_stats.profile];
 			err = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN,
 						param, &default_conn);
 			if (err) {
@@ -275,14 +713,75 @@ start_scan(void)
 
 	LOG_INF("Scanning successfully started");
 
+	metrics_boot_phase_mark(BOOT_PHASE_SCAN_START);
+	if (IS_ENABLED(CONFIG_VTBT_BT_BENCHMARK)) {
+		bt_benchmark_record(BT_BENCHMARK_SCAN_START, k_uptime_ticks(),
+		                    0);
+	}
+
+	rgb_led_set(&color_blue);
+}
+
+/* Connect to the keyboard picked with the switch chord, or else the most
+ * recently used one, by address rather than by scanning. A keyboard using a
+ * resolvable private address is found through the controller's resolving
+ * list. If it doesn't show up before the connection times out, scan for any
+ * keyboard. */
+static void
+reconnect(void)
+{
+	struct bond *bond = switch_bond != NULL ? switch_bond :
+	                                          bonds_most_recent();
+	int err;
+
+	switch_bond = NULL;
+	if (bond == NULL) {
+		start_scan();
+		return;
+	}
+
+	link_stats.profile = bond->profile;
+	err = bt_conn_le_create(&bond->addr, BT_CONN_LE_CREATE_CONN,
+	                        &link_profiles[bond->profile], &default_conn);
+	if (err) {
+		LOG_ERR("Create conn failed (err %d)", err);
+		start_scan();
+		return;
+	}
+
+	LOG_INF("Connecting to the keyboard in slot %d", bonds_slot(bond) + 1);
+
 	rgb_led_set(&color_blue);
 }
 
+static void
+discover(struct bt_conn *conn)
+{
+	int err;
+
+	discover_params.uuid = BT_UUID_HIDS;
+	discover_params.func = discover_func;
+	discover_params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+	discover_params.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+	discover_params.type = BT_GATT_DISCOVER_PRIMARY;
+
+	err = bt_gatt_discover(conn, &discover_params);
+	if (err) {
+		LOG_ERR("Discover failed(err %d)", err);
+	}
+}
+
 static void
 connected(struct bt_conn *conn, uint8_t conn_err)
 {
 	char addr[BT_ADDR_LE_STR_LEN];
-	int err;
+	struct bt_conn_info info;
+	struct bond *bond;
+
+	/* Telemetry clients are handled in telemetry.c. */
+	if (conn != default_conn) {
+		return;
+	}
 
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
@@ -297,22 +796,51 @@ connected(struct bt_conn *conn, uint8_t conn_err)
 	}
 
 	LOG_INF("Connected: %s", addr);
+	connected_time = k_uptime_ticks();
+	link_stats.setup_us = 0;
+	if (IS_ENABLED(CONFIG_VTBT_BT_BENCHMARK)) {
+		bt_benchmark_record(BT_BENCHMARK_CONNECTED, k_uptime_ticks(),
+		                    0);
+	}
 
-	if (conn == default_conn) {
-		bt_conn_set_security(conn, BT_SECURITY_L2);
-
-		memcpy(&discover_uuid, BT_UUID_HIDS, sizeof(discover_uuid));
-		discover_params.uuid = &discover_uuid.uuid;
-		discover_params.func = discover_func;
-		discover_params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
-		discover_params.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
-		discover_params.type = BT_GATT_DISCOVER_PRIMARY;
+	if (bt_conn_get_info(conn, &info) == 0) {
+		link_stats.interval = info.le.interval;
+		link_stats.latency = info.le.latency;
+		link_stats.timeout = info.le.timeout;
+	}
+	link_stats.connected = true;
+
+	/* A new keyboard gets a slot once it has paired, which unpairs the
+	 * least recently used one if there's no room, so a failed pairing
+	 * costs no other keyboard its bond. */
+	bond = bonds_find(bt_conn_get_dst(conn));
+	if (bond != NULL && bond->profile != link_stats.profile) {
+		/* Found by scanning with another profile. */
+		link_stats.profile = bond->profile;
+		k_work_submit(&profile_work);
+	}
 
-		err = bt_gatt_discover(default_conn, &discover_params);
-		if (err) {
-			LOG_ERR("Discover failed(err %d)", err);
-			return;
+	/* Encryption is set up alongside discovery, which doesn't need it. */
+	bt_conn_set_security(conn, BT_SECURITY_L2);
+
+	/* A bonded keyboard's reports are subscribed to straight away; the
+	 * subscriptions wait for encryption. */
+	if (bond != NULL && bond->ccc_handles[0] != 0) {
+		cached_handles = true;
+		num_input_reports = 0;
+		while (num_input_reports < BOND_INPUT_REPORTS &&
+		       bond->ccc_handles[num_input_reports] != 0) {
+			int i = num_input_reports++;
+
+			subscribe_params[i].value_handle =
+				bond->report_handles[i];
+			subscribe_params[i].ccc_handle = bond->ccc_handles[i];
 		}
+		out_report_handle = bond->out_report_handle;
+		subscribe(conn);
+	} else {
+		cached_handles = false;
+		discover(conn);
 	}
 }
 
@@ -329,55 +857,241 @@ disconnected(struct bt_conn *conn, uint8_t reason)
 		return;
 	}
 
+	link_stats.connected = false;
+	link_stats.security = 0;
+	link_stats.disconnects++;
+	if (IS_ENABLED(CONFIG_VTBT_BT_BENCHMARK)) {
+		bt_benchmark_record(BT_BENCHMARK_DISCONNECTED,
+		                    k_uptime_ticks(), reason);
+	}
+
+	out_report_handle = 0;
+	k_work_cancel_delayable(&leds_work);
+
+	/* Keys held when the keyboard went away are never released by it. */
+	link_lost_cb(k_uptime_ticks(), hid_report_user_data);
+
+	subscribed = false;
+	active_bond = NULL;
+
 	bt_conn_unref(default_conn);
 	default_conn = NULL;
 
-	start_scan();
+	reconnect();
+}
+
+static void
+le_param_updated(struct bt_conn *conn, uint16_t interval, uint16_t latency,
+                 uint16_t timeout)
+{
+	if (conn != default_conn) {
+		return;
+	}
+
+	link_stats.interval = interval;
+	link_stats.latency = latency;
+	link_stats.timeout = timeout;
+}
+
+static void
+security_changed(struct bt_conn *conn, bt_security_t level,
+                 enum bt_security_err err)
+{
+	ARG_UNUSED(err);
+
+	if (conn != default_conn) {
+		return;
+	}
+
+	link_stats.security = level;
+	if (IS_ENABLED(CONFIG_VTBT_BT_BENCHMARK)) {
+		bt_benchmark_record(BT_BENCHMARK_SECURITY, k_uptime_ticks(),
+		                    level);
+	}
 }
 
 BT_CONN_CB_DEFINE(conn_callbacks) = {
 	.connected = connected,
 	.disconnected = disconnected,
+	.le_param_updated = le_param_updated,
+	.security_changed = security_changed,
 };
 
-int
-bluetooth_listen(void (*callback)(const uint8_t *))
+static void
+bt_ready(int err)
 {
-	hid_report_cb = callback;
+	if (err) {
+		LOG_ERR("Bluetooth init failed (err %d)", err);
+		return;
+	}
+
+	/* This runs on the Bluetooth bring-up thread, below every vtbt thread
+	 * and preemptible, so loading bonds from flash doesn't hold up the
+	 * terminal. */
+	if (IS_ENABLED(CONFIG_SETTINGS)) {
+		settings_load();
+	}
 
+	bt_set_bondable(true);
+
+	bt_passkey_set(123456);
+
+	bt_conn_auth_info_cb_register(&auth_info_cb);
+
+	bonds_prune();
+
+	LOG_INF("Bluetooth initialized");
+
+	reconnect();
+
+	if (IS_ENABLED(CONFIG_VTBT_TELEMETRY)) {
+		telemetry_start();
+	}
+
+	LOG_INF("Listening");
+}
+
+static void
+bt_init_thread(void *p1, void *p2, void *p3)
+{
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+#if DT_NODE_EXISTS(STRIP_NODE)
 	if (device_is_ready(strip)) {
 		LOG_INF("Found LED strip device %s", strip->name);
 	} else {
 		LOG_ERR("LED strip device %s is not ready", strip->name);
 	}
+#endif
 
 	/* Not sure why this needs to be called two times at first */
 	rgb_led_set(&color_black);
 	rgb_led_set(&color_black);
 
-	int err;
-	err = bt_enable(NULL);
+	/* Without a callback, bt_enable() returns once Bluetooth is ready. A
+	 * callback would run the rest on the cooperative system workqueue. */
+	bt_ready(bt_enable(NULL));
+}
 
-	if (IS_ENABLED(CONFIG_SETTINGS)) {
-		settings_load();
+K_THREAD_DEFINE(bt_init_tid, BT_INIT_STACK_SIZE, bt_init_thread,
+                NULL, NULL, NULL, BT_INIT_PRIORITY, 0, SYS_FOREVER_MS);
+
+int
+bluetooth_listen(hid_report_cb_t callback, link_lost_cb_t link_lost,
+                 void *user_data)
+{
+	hid_report_cb = callback;
+	link_lost_cb = link_lost;
+	hid_report_user_data = user_data;
+
+	k_thread_start(bt_init_tid);
+
+	return 0;
+}
+
+int
+bluetooth_link_profile_set(enum link_profile profile)
+{
+	if (profile >= NUM_LINK_PROFILES) {
+		return -1;
 	}
 
-	bt_set_bondable(true);
+	link_stats.profile = profile;
+	if (active_bond != NULL) {
+		active_bond->profile = profile;
+		bonds_save(active_bond);
+	}
 
-	bt_passkey_set(123456);
+	if (default_conn == NULL || !link_stats.connected) {
+		return 0;
+	}
 
+	int err = bt_conn_le_param_update(default_conn,
+	                                  &link_profiles[profile]);
 	if (err) {
-		LOG_ERR("Bluetooth init failed (err %d)", err);
-		return 0;
+		LOG_ERR("Connection parameter update failed (err %d)", err);
+		return -1;
 	}
 
-	bt_conn_auth_info_cb_register(&auth_info_cb);
+	return 0;
+}
 
-	LOG_INF("Bluetooth initialized");
+void
+bluetooth_link_stats_get(struct link_stats *stats)
+{
+	*stats = link_stats;
+}
 
-	start_scan();
+int
+bluetooth_keyboard_switch(int slot)
+{
+	struct bond *bond = bonds_get(slot);
 
-	LOG_INF("Listening");
+	if (bond == NULL) {
+		return -1;
+	}
+
+	/* The keys still down are released when the link goes. */
+	if (bond != active_bond) {
+		switch_bond = bond;
+		k_work_submit(&switch_work);
+	}
 
 	return 0;
 }
+
+static void
+switch_keyboard(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	/* reconnect() picks switch_bond once the link is down. */
+	if (default_conn != NULL) {
+		bt_conn_disconnect(default_conn,
+		                   BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+	}
+}
+
+static void
+apply_link_profile(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	bluetooth_link_profile_set(link_stats.profile);
+}
+
+static void
+leds_write(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	uint8_t report = atomic_get(&hid_leds);
+
+	if (default_conn == NULL || out_report_handle == 0 ||
+	    atomic_get(&hid_leds_written) == report) {
+		return;
+	}
+
+	int err = bt_gatt_write_without_response(default_conn,
+	                                         out_report_handle,
+	                                         &report, sizeof(report),
+	                                         false);
+	if (err) {
+		LOG_ERR("LED output report write failed (err %d)", err);
+		return;
+	}
+
+	atomic_set(&hid_leds_written, report);
+}
+
+void
+bluetooth_leds_set(uint8_t report)
+{
+	atomic_set(&hid_leds, report);
+
+	/* Scheduling leaves an already pending write alone, so everything
+	 * up to the next connection event goes out in one write. */
+	k_work_schedule(&leds_work, K_USEC(link_stats.interval * 1250U));
+}
@@ -1,8 +1,60 @@
 #ifndef BLUETOOTH_H
 #define BLUETOOTH_H
 
+#include <stdint.h>
+
+#include "vtbt.h"
+
+/* Connection parameters requested from the keyboard. */
+enum link_profile {
+	/* 30-50 ms connection interval. */
+	LINK_PROFILE_DEFAULT,
+	/* 7.5 ms connection interval, for the lowest keystroke latency. */
+	LINK_PROFILE_LOW_LATENCY,
+	/* 100 ms connection interval with a peripheral latency of 4, for
+	 * keyboards running on batteries. */
+	LINK_PROFILE_LOW_POWER,
+	NUM_LINK_PROFILES,
+};
+
+/* State and counters of the link to the keyboard. */
+struct link_stats {
+	bool connected;
+	uint8_t security;
+	/* Current connection parameters, in the units of the Bluetooth
+	 * specification (1.25 ms, connection events, 10 ms). */
+	uint16_t interval;
+	uint16_t latency;
+	uint16_t timeout;
+	enum link_profile profile;
+	uint32_t reports;
+	uint32_t disconnects;
+	/* Microseconds from the last connection to its first keyboard report,
+	 * or 0 until then. */
+	uint32_t setup_us;
+};
+
 /* Scan and connect to a Bluetooth keyboard, sending keyboard HID reports to
- * the callback function. */
-int bluetooth_listen(void (*callback)(const uint8_t *report));
+ * the callback function along with the k_uptime_ticks() timestamp of the
+ * notification, and calling link_lost when the keyboard disconnects. This
+ * returns immediately; the Bluetooth stack is brought up in the
+ * background. */
+int bluetooth_listen(hid_report_cb_t callback, link_lost_cb_t link_lost,
+                     void *user_data);
+
+/* Use a link profile for the keyboard connection. The connection parameters
+ * of an existing connection are updated. Must not be called from the
+ * Bluetooth RX thread. */
+int bluetooth_link_profile_set(enum link_profile profile);
+void bluetooth_link_stats_get(struct link_stats *stats);
+
+/* Switch to the keyboard bonded in a slot (0 to BONDS_MAX - 1), which only has
+ * to be awake. Returns -1 if the slot is empty. */
+int bluetooth_keyboard_switch(int slot);
+
+/* Set the keyboard's own LEDs to a HID keyboard LED output report. Changes
+ * are written at most once per connection event, so only the latest state
+ * of a burst reaches the keyboard, and again after every reconnect. */
+void bluetooth_leds_set(uint8_t report);
 
 #endif /* BLUETOOTH_H */
@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/settings/settings.h>
+
+#include "bonds.h"
+
+#include "bluetooth.h"
+
+LOG_MODULE_REGISTER(bonds, CONFIG_LOG_DEFAULT_LEVEL);
+
+/* The host keeps the keys of a keyboard that is still pairing while the
+ * table is full, until bonds_use() evicts one. */
+BUILD_ASSERT(CONFIG_BT_MAX_PAIRED > BONDS_MAX,
+             "CONFIG_BT_MAX_PAIRED must exceed the bond table size");
+
+#define BONDS_SETTINGS_KEY "vtbt/bond"
+
+static struct bond bonds[BONDS_MAX];
+static uint32_t use_count;
+
+static int
+bonds_settings_set(const char *name, size_t len, settings_read_cb read_cb,
+                   void *cb_arg)
+{
+	unsigned long slot = strtoul(name, NULL, 10);
+
+	if (slot >= BONDS_MAX || len != sizeof(struct bond)) {
+		return -EINVAL;
+	}
+
+	if (read_cb(cb_arg, &bonds[slot], len) != (ssize_t)len) {
+		memset(&bonds[slot], 0, sizeof(bonds[slot]));
+		return -EINVAL;
+	}
+
+	use_count = MAX(use_count, bonds[slot].last_used);
+
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(vtbt_bonds, BONDS_SETTINGS_KEY, NULL,
+                               bonds_settings_set, NULL, NULL);
+
+void
+bonds_save(struct bond *bond)
+{
+	char key[sizeof(BONDS_SETTINGS_KEY "/00")];
+
+	snprintk(key, sizeof(key), BONDS_SETTINGS_KEY "/%d", bonds_slot(bond));
+	int err = settings_save_one(key, bond, sizeof(*bond));
+	if (err) {
+		LOG_ERR("Saving bond failed (err %d)", err);
+	}
+}
+
+static void
+bonds_clear(struct bond *bond)
+{
+	char key[sizeof(BONDS_SETTINGS_KEY "/00")];
+
+	snprintk(key, sizeof(key), BONDS_SETTINGS_KEY "/%d", bonds_slot(bond));
+	settings_delete(key);
+	memset(bond, 0, sizeof(*bond));
+}
+
+void
+bonds_prune(void)
+{
+	for (int i = 0; i < BONDS_MAX; i++) {
+		if (bonds[i].last_used != 0 &&
+		    !bt_le_bond_exists(BT_ID_DEFAULT, &bonds[i].addr)) {
+			bonds_clear(&bonds[i]);
+		}
+	}
+}
+
+struct bond *
+bonds_find(const bt_addr_le_t *addr)
+{
+	for (int i = 0; i < BONDS_MAX; i++) {
+		if (bonds[i].last_used != 0 &&
+		    bt_addr_le_eq(&bonds[i].addr, addr)) {
+			return &bonds[i];
+		}
+	}
+
+	return NULL;
+}
+
+struct bond *
+bonds_get(int slot)
+{
+	if (slot < 0 || slot >= BONDS_MAX || bonds[slot].last_used == 0) {
+		return NULL;
+	}
+
+	return &bonds[slot];
+}
+
+int
+bonds_slot(const struct bond *bond)
+{
+	return bond - bonds;
+}
+
+struct bond *
+bonds_most_recent(void)
+{
+	struct bond *most_recent = NULL;
+
+	for (int i = 0; i < BONDS_MAX; i++) {
+		if (bonds[i].last_used != 0 &&
+		    (most_recent == NULL ||
+		     bonds[i].last_used > most_recent->last_used)) {
+			most_recent = &bonds[i];
+		}
+	}
+
+	return most_recent;
+}
+
+/* If every slot is taken, unpair the least recently used keyboard. */
+static void
+bonds_make_room(void)
+{
+	struct bond *least_recent = NULL;
+
+	for (int i = 0; i < BONDS_MAX; i++) {
+		if (bonds[i].last_used == 0) {
+			return;
+		}
+		if (least_recent == NULL ||
+		    bonds[i].last_used < least_recent->last_used) {
+			least_recent = &bonds[i];
+		}
+	}
+
+	LOG_INF("Unpairing the keyboard in slot %d",
+	        bonds_slot(least_recent) + 1);
+	bt_unpair(BT_ID_DEFAULT, &least_recent->addr);
+	bonds_clear(least_recent);
+}
+
+struct bond *
+bonds_use(const bt_addr_le_t *addr)
+{
+	struct bond *bond = bonds_find(addr);
+
+	if (bond == NULL) {
+		for (int i = 0; i < BONDS_MAX; i++) {
+			if (bonds[i].last_used == 0) {
+				bond = &bonds[i];
+				break;
+			}
+		}
+		if (bond == NULL) {
+			bonds_make_room();
+			return bonds_use(addr);
+		}
+		bt_addr_le_copy(&bond->addr, addr);
+		bond->profile = LINK_PROFILE_DEFAULT;
+	}
+
+	bond->last_used = ++use_count;
+
+	return bond;
+}
+
+void
+bonds_remove(const bt_addr_le_t *addr)
+{
+	struct bond *bond = bonds_find(addr);
+
+	if (bond != NULL) {
+		bonds_clear(bond);
+	}
+}
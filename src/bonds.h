@@ -0,0 +1,57 @@
+#ifndef BONDS_H
+#define BONDS_H
+
+#include <stdint.h>
+
+#include <zephyr/bluetooth/addr.h>
+
+/* The keyboards bonded with the vtbt. Alongside the Bluetooth host's keys,
+ * each bond keeps the handles of the keyboard's HID reports, so that a
+ * reconnection can subscribe without discovery, and the link profile last
+ * used with it. The table is kept in settings. When it is full, pairing a new
+ * keyboard unpairs the least recently used one.
+ *
+ * Bonds stay in the same slot until they are evicted, so that a slot number
+ * can be used to pick a keyboard. */
+
+#define BONDS_MAX CONFIG_VTBT_KEYBOARD_BONDS
+
+/* Input reports kept per keyboard. */
+#define BOND_INPUT_REPORTS 4
+
+struct bond {
+	bt_addr_le_t addr;
+	/* Value of a counter that goes up every time a keyboard is used, or
+	 * 0 if the slot is empty. */
+	uint32_t last_used;
+	/* Attribute handles of the input reports and their CCC descriptors,
+	 * the keyboard's own report first and followed by zeroes, and of the
+	 * boot keyboard output report. 0 if they aren't known. */
+	uint16_t report_handles[BOND_INPUT_REPORTS];
+	uint16_t ccc_handles[BOND_INPUT_REPORTS];
+	uint16_t out_report_handle;
+	/* An enum link_profile. */
+	uint8_t profile;
+};
+
+/* Drop bonds whose keys the Bluetooth host no longer has. Called once
+ * settings are loaded. */
+void bonds_prune(void);
+/* Returns the bond of a keyboard by identity address, or NULL. */
+struct bond *bonds_find(const bt_addr_le_t *addr);
+/* Returns the bond in a slot (0 to BONDS_MAX - 1), or NULL if it's empty. */
+struct bond *bonds_get(int slot);
+int bonds_slot(const struct bond *bond);
+/* Returns the most recently used bond, or NULL if there are none. */
+struct bond *bonds_most_recent(void);
+/* Mark a bonded keyboard as the most recently used, adding it to the table if
+ * it's new. If every slot is taken, the least recently used keyboard is
+ * unpaired to make room. Returns its bond, to be saved with bonds_save() once
+ * updated. */
+struct bond *bonds_use(const bt_addr_le_t *addr);
+/* Save changes to a bond's handles or profile. */
+void bonds_save(struct bond *bond);
+/* Forget a keyboard, e.g. after its keys were deleted. */
+void bonds_remove(const bt_addr_le_t *addr);
+
+#endif /* BONDS_H */
@@ -0,0 +1,21 @@
+#include <zephyr/kernel.h>
+
+#include "bt_benchmark.h"
+
+static const char *const event_names[NUM_BT_BENCHMARK_EVENTS] = {
+	[BT_BENCHMARK_SCAN_START] = "scan_start",
+	[BT_BENCHMARK_CONNECTED] = "connected",
+	[BT_BENCHMARK_SECURITY] = "security",
+	[BT_BENCHMARK_SUBSCRIBED] = "subscribed",
+	[BT_BENCHMARK_REPORT] = "report",
+	[BT_BENCHMARK_DISCONNECTED] = "disconnected",
+};
+
+void
+bt_benchmark_record(enum bt_benchmark_event event, int64_t time, uint32_t arg)
+{
+	/* 32 bits of microseconds last over an hour of simulation. */
+	printk("BENCH {\"dev\":\"vtbt\",\"event\":\"%s\",\"t_us\":%u,"
+	       "\"arg\":%u}\n", event_names[event],
+	       (uint32_t)k_ticks_to_us_floor64(time), arg);
+}
@@ -0,0 +1,24 @@
+#ifndef BT_BENCHMARK_H
+#define BT_BENCHMARK_H
+
+#include <stdint.h>
+
+/* Milestones of the keyboard connection and every HID report, printed as
+ * JSON lines for scripts/bt_benchmark.py. On nrf52_bsim every device's uptime
+ * is the simulation time, so the records line up with those of the emulated
+ * keyboard in bsim/keyboard. */
+enum bt_benchmark_event {
+	BT_BENCHMARK_SCAN_START,
+	BT_BENCHMARK_CONNECTED,
+	BT_BENCHMARK_SECURITY,     /* arg: security level */
+	BT_BENCHMARK_SUBSCRIBED,
+	BT_BENCHMARK_REPORT,       /* arg: first key of the report */
+	BT_BENCHMARK_DISCONNECTED, /* arg: HCI reason */
+	NUM_BT_BENCHMARK_EVENTS,
+};
+
+/* Print a record for an event that happened at a k_uptime_ticks() time. */
+void bt_benchmark_record(enum bt_benchmark_event event, int64_t time,
+                         uint32_t arg);
+
+#endif /* BT_BENCHMARK_H */
@@ -0,0 +1,111 @@
+/* Measures what chord recognition adds to every HID report. A few seconds
+ * after boot, a run of typing reports with rollover is passed through
+ * chords_filter() as keyboard_event() does, once as ordinary typing and once
+ * with Right Alt held, and the added cost per report is logged next to that
+ * of copying the report. Each figure is the fastest of several passes, so
+ * that interrupts don't count. */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "chords.h"
+#include "vtbt.h"
+
+LOG_MODULE_REGISTER(chord_benchmark, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define BENCHMARK_STACK_SIZE 1024
+#define BENCHMARK_PRIORITY   K_LOWEST_APPLICATION_THREAD_PRIO
+#define BENCHMARK_DELAY_MS   3000
+#define BENCHMARK_PASSES     8
+#define BENCHMARK_REPORTS    1024
+
+#define HID_MODIFIER_LEFT_SHIFT BIT(1)
+#define HID_MODIFIER_RIGHT_ALT  BIT(6)
+
+/* "Hello" typed with rollover: each report adds or drops one key. */
+static const uint8_t typing[][HID_REPORT_SIZE] = {
+	{ HID_MODIFIER_LEFT_SHIFT, 0, 0x0b },
+	{ HID_MODIFIER_LEFT_SHIFT, 0, 0x0b, 0x08 },
+	{ 0, 0, 0x0b, 0x08 },
+	{ 0, 0, 0x08 },
+	{ 0, 0, 0x08, 0x0f },
+	{ 0, 0, 0x0f },
+	{ 0 },
+	{ 0, 0, 0x0f },
+	{ 0, 0, 0x0f, 0x12 },
+	{ 0, 0, 0x12 },
+	{ 0, 0, 0x12, 0x2c },
+	{ 0, 0, 0x2c },
+	{ 0 },
+};
+
+enum pass_kind {
+	PASS_COPY,
+	PASS_TYPING,
+	PASS_RIGHT_ALT,
+};
+
+static volatile const struct chord *sink;
+
+static uint32_t
+run_pass(enum pass_kind kind)
+{
+	struct chords chords = { 0 };
+	uint8_t last[HID_REPORT_SIZE] = { 0 };
+	uint8_t report[HID_REPORT_SIZE];
+	uint32_t start = k_cycle_get_32();
+
+	for (int i = 0; i < BENCHMARK_REPORTS; i++) {
+		memcpy(report, typing[i % ARRAY_SIZE(typing)], sizeof(report));
+		if (kind == PASS_RIGHT_ALT) {
+			report[0] |= HID_MODIFIER_RIGHT_ALT;
+		}
+		if (kind != PASS_COPY) {
+			sink = chords_filter(&chords, report, last);
+		}
+		memcpy(last, report, sizeof(last));
+	}
+
+	return k_cycle_get_32() - start;
+}
+
+/* Fastest pass, in hundredths of a cycle per report. */
+static uint32_t
+measure(enum pass_kind kind)
+{
+	uint32_t best = UINT32_MAX;
+
+	for (int pass = 0; pass < BENCHMARK_PASSES; pass++) {
+		best = MIN(best, run_pass(kind));
+	}
+
+	return (uint64_t)best * 100 / BENCHMARK_REPORTS;
+}
+
+static void
+benchmark_thread(void *p1, void *p2, void *p3)
+{
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	uint32_t copy = measure(PASS_COPY);
+	uint32_t typing_cost = measure(PASS_TYPING);
+	uint32_t right_alt = measure(PASS_RIGHT_ALT);
+
+	/* What chords_filter() adds to the copying. */
+	typing_cost -= MIN(typing_cost, copy);
+	right_alt -= MIN(right_alt, copy);
+
+	LOG_INF("Chords add %u.%02u cycles per report typing and %u.%02u "
+	        "with Right Alt down, to %u.%02u for copying the report "
+	        "(%u cycles per second)",
+	        typing_cost / 100, typing_cost % 100,
+	        right_alt / 100, right_alt % 100, copy / 100, copy % 100,
+	        sys_clock_hw_cycles_per_sec());
+}
+
+K_THREAD_DEFINE(chord_benchmark_tid, BENCHMARK_STACK_SIZE, benchmark_thread,
+                NULL, NULL, NULL, BENCHMARK_PRIORITY, 0, BENCHMARK_DELAY_MS);
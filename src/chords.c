@@ -0,0 +1,193 @@
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+
+#include "chords.h"
+
+#include "vtbt.h"
+#include "instance.h"
+#include "bluetooth.h"
+#include "bonds.h"
+#include "iram.h"
+#include "repeat_profile.h"
+
+#define HID_MODIFIER_RIGHT_ALT BIT(6)
+#define HID_USAGE_R            0x15
+#define HID_USAGE_1            0x1e
+#define HID_USAGE_DOWN         0x51
+#define HID_USAGE_UP           0x52
+
+#define KEYCLICK_VOLUME_LOUDEST 0
+#define KEYCLICK_VOLUME_SOFTEST 7
+
+static void
+switch_keyboard(struct vtbt *vt, int slot)
+{
+	ARG_UNUSED(vt);
+
+	bluetooth_keyboard_switch(slot);
+}
+
+static void
+change_keyclick_volume(struct vtbt *vt, int step)
+{
+	int volume = beeper_get_keyclick_volume(&vt->beeper);
+
+	/* Left off if the terminal disabled it. */
+	if (volume < 0) {
+		return;
+	}
+
+	beeper_set_keyclick_volume(&vt->beeper,
+	                           CLAMP(volume + step, KEYCLICK_VOLUME_LOUDEST,
+	                                 KEYCLICK_VOLUME_SOFTEST));
+	beeper_sound_keyclick(&vt->beeper);
+}
+
+#ifdef CONFIG_VTBT_REPEAT_PROFILE
+static void
+toggle_repeat_profile(struct vtbt *vt, int arg)
+{
+	ARG_UNUSED(arg);
+
+	repeat_profile_toggle();
+	beeper_sound_keyclick(&vt->beeper);
+}
+#endif
+
+#define SWITCH_CHORD(slot, _)                                           \
+	{                                                               \
+		.modifiers = HID_MODIFIER_RIGHT_ALT,                    \
+		.usage = HID_USAGE_1 + (slot),                          \
+		.action = switch_keyboard,                              \
+		.arg = (slot),                                          \
+	}
+
+static const struct chord chords_table[] VTBT_DRAM_ATTR = {
+	/* Right Alt and a slot's number switch keyboards. */
+	LISTIFY(BONDS_MAX, SWITCH_CHORD, (,)),
+	/* Up is louder, Down softer. */
+	{
+		.modifiers = HID_MODIFIER_RIGHT_ALT,
+		.usage = HID_USAGE_UP,
+		.action = change_keyclick_volume,
+		.arg = -1,
+	},
+	{
+		.modifiers = HID_MODIFIER_RIGHT_ALT,
+		.usage = HID_USAGE_DOWN,
+		.action = change_keyclick_volume,
+		.arg = 1,
+	},
+#ifdef CONFIG_VTBT_REPEAT_PROFILE
+	{
+		.modifiers = HID_MODIFIER_RIGHT_ALT,
+		.usage = HID_USAGE_R,
+		.action = toggle_repeat_profile,
+	},
+#endif
+};
+
+/* Every chord's key as a bit per usage, and every chord's modifiers, so that
+ * a report is only searched for chords when one could be in it. */
+static uint32_t chord_usages[256 / 32] VTBT_DRAM_ATTR;
+static uint8_t chord_modifiers VTBT_DRAM_ATTR;
+
+static VTBT_IRAM_ATTR bool
+is_chord_usage(uint8_t usage)
+{
+	return chord_usages[usage / 32] & BIT(usage % 32);
+}
+
+static VTBT_IRAM_ATTR bool
+is_in(const uint8_t *keys, int num_keys, uint8_t usage)
+{
+	for (int i = 0; i < num_keys; i++) {
+		if (keys[i] == usage) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static VTBT_IRAM_ATTR const struct chord *
+chord_find(uint8_t usage, uint8_t modifiers)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(chords_table); i++) {
+		const struct chord *chord = &chords_table[i];
+
+		if (chord->usage == usage &&
+		    (modifiers & chord->modifiers) == chord->modifiers) {
+			return chord;
+		}
+	}
+
+	return NULL;
+}
+
+VTBT_IRAM_ATTR const struct chord *
+chords_filter(struct chords *chords, uint8_t *report,
+              const uint8_t *last_report)
+{
+	const struct chord *pressed = NULL;
+	uint8_t held[ARRAY_SIZE(chords->held)];
+	int num_held = 0;
+
+	/* Ordinary typing stops here. */
+	if (!(report[0] & chord_modifiers) && chords->num_held == 0) {
+		return NULL;
+	}
+
+	for (int i = HID_REPORT_FIRST_KEY; i < HID_REPORT_SIZE; i++) {
+		uint8_t usage = report[i];
+		const struct chord *chord;
+
+		if (usage == 0x00 || !is_chord_usage(usage)) {
+			continue;
+		}
+
+		if (is_in(chords->held, chords->num_held, usage)) {
+			/* Stays out until released, whatever the modifiers
+			 * do meanwhile. */
+			chord = NULL;
+		} else if (is_in(&last_report[HID_REPORT_FIRST_KEY],
+		                 HID_REPORT_SIZE - HID_REPORT_FIRST_KEY,
+		                 usage)) {
+			/* Down before the modifiers, so the terminal has it. */
+			continue;
+		} else {
+			chord = chord_find(usage, report[0]);
+			if (chord == NULL) {
+				continue;
+			}
+		}
+
+		held[num_held++] = usage;
+		report[i] = 0x00;
+		if (pressed == NULL) {
+			pressed = chord;
+		}
+	}
+
+	memcpy(chords->held, held, num_held);
+	chords->num_held = num_held;
+
+	return pressed;
+}
+
+static int
+chords_init(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(chords_table); i++) {
+		uint8_t usage = chords_table[i].usage;
+
+		chord_usages[usage / 32] |= BIT(usage % 32);
+		chord_modifiers |= chords_table[i].modifiers;
+	}
+
+	return 0;
+}
+
+SYS_INIT(chords_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,34 @@
+#ifndef CHORDS_H
+#define CHORDS_H
+
+#include <stdint.h>
+
+#include "vtbt.h"
+
+struct vtbt;
+
+/* Key combinations handled by the vtbt itself: Right Alt, which isn't an
+ * LK201 key, held with one other key. A chord is recognized on the press of
+ * its key, which is taken out of the HID reports until it is released; other
+ * keys pass through untouched and are never held back. */
+
+struct chord {
+	/* Modifier bits that must all be down. */
+	uint8_t modifiers;
+	uint8_t usage;
+	void (*action)(struct vtbt *vt, int arg);
+	int arg;
+};
+
+/* Chord keys of one keyboard that are still down. */
+struct chords {
+	uint8_t held[HID_REPORT_SIZE - HID_REPORT_FIRST_KEY];
+	int num_held;
+};
+
+/* Takes the keys of chords out of a report. Returns the chord whose key was
+ * pressed since the last report, or NULL. */
+const struct chord *chords_filter(struct chords *chords, uint8_t *report,
+                                  const uint8_t *last_report);
+
+#endif /* CHORDS_H */
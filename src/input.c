@@ -0,0 +1,164 @@
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+
+#include "input.h"
+
+#include "vtbt.h"
+#include "instance.h"
+#include "bluetooth.h"
+#include "metrics.h"
+#include "serial_input.h"
+#include "synthetic.h"
+#include "workload.h"
+
+LOG_MODULE_REGISTER(input, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define BLE_INTERVAL_UNIT_US 1250
+
+/* There is only one Bluetooth keyboard. */
+static int
+bluetooth_start(int id, hid_report_cb_t callback, link_lost_cb_t link_lost,
+                void *user_data)
+{
+	static bool started;
+
+	if (started) {
+		LOG_ERR("vt%d: the Bluetooth keyboard is taken", id);
+		return -1;
+	}
+	started = true;
+
+	return bluetooth_listen(callback, link_lost, user_data);
+}
+
+/* A report waits for the keyboard's next connection event. */
+static void
+bluetooth_stats_get(int id, struct input_stats *stats)
+{
+	struct link_stats link;
+
+	ARG_UNUSED(id);
+
+	bluetooth_link_stats_get(&link);
+	stats->reports = link.reports;
+	stats->wait_max_us =
+		link.connected ? link.interval * BLE_INTERVAL_UNIT_US : 0;
+}
+
+#ifdef CONFIG_VTBT_SYNTHETIC_SOURCE
+static int
+synthetic_input_start(int id, hid_report_cb_t callback,
+                      link_lost_cb_t link_lost, void *user_data)
+{
+	ARG_UNUSED(link_lost);
+
+	return synthetic_start(id, callback, user_data);
+}
+#endif
+
+#ifdef CONFIG_VTBT_WORKLOAD
+static int
+workload_input_start(int id, hid_report_cb_t callback,
+                     link_lost_cb_t link_lost, void *user_data)
+{
+	ARG_UNUSED(link_lost);
+
+	return workload_start(id, callback, user_data);
+}
+#endif
+
+/* Indexed by enum keyboard_source. */
+static const struct input_backend backends[] = {
+	[KEYBOARD_SOURCE_BLUETOOTH] = {
+		.name = "bluetooth",
+		.start = bluetooth_start,
+		.stats_get = bluetooth_stats_get,
+	},
+	[KEYBOARD_SOURCE_SYNTHETIC] = {
+		.name = "synthetic",
+		.start = COND_CODE_1(CONFIG_VTBT_SYNTHETIC_SOURCE,
+		                     (synthetic_input_start), (NULL)),
+	},
+	[KEYBOARD_SOURCE_WORKLOAD] = {
+		.name = "workload",
+		.start = COND_CODE_1(CONFIG_VTBT_WORKLOAD,
+		                     (workload_input_start), (NULL)),
+	},
+	[KEYBOARD_SOURCE_SERIAL] = {
+		.name = "serial",
+		.start = COND_CODE_1(CONFIG_VTBT_SERIAL_INPUT,
+		                     (serial_input_start), (NULL)),
+		.stats_get = COND_CODE_1(CONFIG_VTBT_SERIAL_INPUT,
+		                         (serial_input_stats_get), (NULL)),
+	},
+};
+
+const struct input_backend *
+input_backend_get(const struct vtbt *vt)
+{
+	return &backends[vt->source];
+}
+
+int
+input_start(struct vtbt *vt, hid_report_cb_t callback,
+            link_lost_cb_t link_lost, void *user_data)
+{
+	const struct input_backend *backend = input_backend_get(vt);
+	int ret;
+
+	if (backend->start == NULL) {
+		LOG_ERR("vt%d: %s source not enabled", vt->id, backend->name);
+		return -1;
+	}
+
+	ret = backend->start(vt->id, callback, link_lost, user_data);
+	if (ret < 0) {
+		LOG_ERR("vt%d: starting %s source failed", vt->id,
+		        backend->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+#if CONFIG_VTBT_INPUT_STATS_INTERVAL > 0
+static void
+stats_work_handler(struct k_work *work)
+{
+	for (int i = 0; i < NUM_VT_PORTS; i++) {
+		const struct vtbt *vt = &vtbt_instances[i];
+		const struct input_backend *backend = input_backend_get(vt);
+		const struct latency_stats *latency = &vt->key_latency;
+		struct input_stats stats = { 0 };
+
+		if (backend->stats_get != NULL) {
+			backend->stats_get(vt->id, &stats);
+		}
+
+		LOG_INF("vt%d %s: %u reports, %u errors, wait up to %u us, "
+		        "transfer avg %u us max %u us, key latency avg %u us "
+		        "max %u us", i, backend->name, stats.reports,
+		        stats.errors, stats.wait_max_us,
+		        latency_stats_avg_us(&stats.transfer),
+		        stats.transfer.max_us, latency_stats_avg_us(latency),
+		        latency->max_us);
+	}
+
+	k_work_schedule(k_work_delayable_from_work(work),
+	                K_SECONDS(CONFIG_VTBT_INPUT_STATS_INTERVAL));
+}
+
+K_WORK_DELAYABLE_DEFINE(stats_work, stats_work_handler);
+
+static int
+input_stats_init(void)
+{
+	k_work_schedule(&stats_work,
+	                K_SECONDS(CONFIG_VTBT_INPUT_STATS_INTERVAL));
+
+	return 0;
+}
+
+SYS_INIT(input_stats_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+#endif
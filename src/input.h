@@ -0,0 +1,48 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+
+#include "vtbt.h"
+#include "metrics.h"
+
+struct vtbt;
+
+/* What a backend knows about the latency of its transport, for comparing
+ * keyboard sources. */
+struct input_stats {
+	/* Reports delivered, and reports lost to transmission errors. */
+	uint32_t reports;
+	uint32_t errors;
+	/* From a report's timestamp to its delivery, for transports that
+	 * receive a report over time, such as a serial frame. This is part of
+	 * the port's key latency. */
+	struct latency_stats transfer;
+	/* The longest a report can wait in the transport before the vtbt
+	 * sees it, such as a Bluetooth connection interval, or 0. This comes
+	 * before the timestamp and isn't part of the key latency. */
+	uint32_t wait_max_us;
+};
+
+/* A source of a port's key presses. Every backend passes boot keyboard
+ * reports to the callback, from any context, with the k_uptime_ticks() time
+ * at which the vtbt started receiving them, and calls link_lost when it loses
+ * track of the keyboard's state. */
+struct input_backend {
+	/* As in the keyboard-source property of the devicetree binding. */
+	const char *name;
+	/* Start the source of port id. NULL if not built in. */
+	int (*start)(int id, hid_report_cb_t callback,
+	             link_lost_cb_t link_lost, void *user_data);
+	/* Fill in the transport's statistics. NULL if it has none. */
+	void (*stats_get)(int id, struct input_stats *stats);
+};
+
+/* Start the backend of an instance's keyboard-source. */
+int input_start(struct vtbt *vt, hid_report_cb_t callback,
+                link_lost_cb_t link_lost, void *user_data);
+
+/* Returns the backend of an instance's keyboard-source. */
+const struct input_backend *input_backend_get(const struct vtbt *vt);
+
+#endif /* INPUT_H */
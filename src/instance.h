@@ -0,0 +1,81 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/sys/dlist.h>
+
+#include "vtbt.h"
+#include "beeper.h"
+#include "keyboard.h"
+#include "leds.h"
+#include "lk201.h"
+#include "metrics.h"
+#include "metronome.h"
+#include "uart.h"
+
+/* One instance per enabled "vtbt,vt-port" devicetree node. */
+#define NUM_VT_PORTS DT_NUM_INST_STATUS_OKAY(vtbt_vt_port)
+
+#define EVENT_QUEUE_SIZE CONFIG_VTBT_EVENT_QUEUE_SIZE
+#define HOST_QUEUE_SIZE  CONFIG_VTBT_HOST_QUEUE_SIZE
+
+/* In the order of the keyboard-source enum in the devicetree binding. */
+enum keyboard_source {
+	KEYBOARD_SOURCE_BLUETOOTH,
+	KEYBOARD_SOURCE_SYNTHETIC,
+	KEYBOARD_SOURCE_WORKLOAD,
+	KEYBOARD_SOURCE_SERIAL,
+};
+
+/* An emulated LK201 serving one terminal. */
+struct vtbt {
+	/* Index of the instance, in devicetree instance order. */
+	int id;
+	enum keyboard_source source;
+
+	struct vt_uart uart;
+	struct beeper beeper;
+	struct leds leds;
+
+	struct lk201 lk201;
+	struct keyboard keyboard;
+	struct metronome metronome;
+	bool test_mode;
+	/* Keys currently down, most recently pressed first. */
+	sys_dlist_t keys_down;
+
+	/* Held by the host and event threads while they use the instance.
+	 * Inhibiting transmission is the only thing done without it. */
+	struct k_mutex lock;
+	/* Commands from the terminal, handled by the host thread. */
+	struct k_msgq host_msgq;
+	struct event host_msgq_buf[HOST_QUEUE_SIZE];
+	/* HID reports and metronome ticks, handled by the event thread. */
+	struct k_msgq msgq;
+	struct event msgq_buf[EVENT_QUEUE_SIZE];
+	/* Most events ever waiting in each queue, and events lost because a
+	 * queue was full. */
+	atomic_t host_msgq_max;
+	atomic_t msgq_max;
+	atomic_t events_dropped;
+	/* Set when a link loss couldn't be queued, so the keys are released
+	 * before the next HID report instead. */
+	atomic_t link_lost_pending;
+	struct k_timer metronome_timer;
+	struct event metronome_evt;
+	struct event hid_evt;
+	/* Host command being assembled by the UART RX callback. */
+	struct event host_evt;
+
+	/* From the source timestamp of a key press to its keycode entering
+	 * the TX buffer. */
+	struct latency_stats key_latency;
+	/* From an Inhibit Keyboard Transmission command arriving to its ack
+	 * leaving the TX buffer, after which the line is silent. */
+	struct latency_stats inhibit_latency;
+};
+
+extern struct vtbt vtbt_instances[NUM_VT_PORTS];
+
+#endif /* INSTANCE_H */
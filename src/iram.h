@@ -0,0 +1,30 @@
+#ifndef IRAM_H
+#define IRAM_H
+
+#include <zephyr/toolchain.h>
+
+/* With CONFIG_VTBT_IRAM, the UART interrupt handler, the event loops and the
+ * keystroke path run from IRAM and their tables live in DRAM, so that they
+ * keep running while the flash cache is disabled for a flash write (e.g. when
+ * the Bluetooth host stores bonds). The sections are the ones the ESP32
+ * linker scripts place in IRAM and DRAM. Without the option, these expand to
+ * nothing.
+ *
+ * Kernel and driver functions called from these paths are placed by their
+ * own configuration. scripts/iram_map.py lists where everything landed. */
+
+#ifdef CONFIG_VTBT_IRAM
+
+#define VTBT_IRAM_ATTR \
+	__attribute__((section(".iram1." STRINGIFY(__COUNTER__))))
+#define VTBT_DRAM_ATTR \
+	__attribute__((section(".dram1." STRINGIFY(__COUNTER__))))
+
+#else
+
+#define VTBT_IRAM_ATTR
+#define VTBT_DRAM_ATTR
+
+#endif
+
+#endif /* IRAM_H */
@@ -0,0 +1,109 @@
+/* Measures the worst-case interrupt latency while settings are written to
+ * flash, which disables the flash cache on the ESP32-C3. A 1 ms timer whose
+ * handler is placed like the UART interrupt handler records the longest gap
+ * between its runs, first on an idle system and then during a run of
+ * settings writes. Both are logged a few seconds after boot, so builds with
+ * and without CONFIG_VTBT_IRAM can be compared. */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+
+#include "iram.h"
+
+LOG_MODULE_REGISTER(iram_probe, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define PROBE_STACK_SIZE   1024
+#define PROBE_PRIORITY     K_LOWEST_APPLICATION_THREAD_PRIO
+/* Late enough for Bluetooth to have loaded settings. */
+#define PROBE_DELAY_MS     5000
+#define PROBE_PERIOD_US    1000
+#define PROBE_IDLE_MS      1000
+#define PROBE_WRITES       16
+#define PROBE_SETTINGS_KEY "vtbt/probe"
+
+static struct k_timer probe_timer;
+static uint32_t last_cycles;
+static uint32_t max_gap_cycles;
+
+static VTBT_IRAM_ATTR void
+probe_expiry(struct k_timer *timer)
+{
+	ARG_UNUSED(timer);
+
+	uint32_t now = k_cycle_get_32();
+
+	if (last_cycles != 0 && now - last_cycles > max_gap_cycles) {
+		max_gap_cycles = now - last_cycles;
+	}
+	last_cycles = now;
+}
+
+static void
+probe_start(void)
+{
+	unsigned int key = irq_lock();
+
+	last_cycles = 0;
+	max_gap_cycles = 0;
+	irq_unlock(key);
+
+	k_timer_start(&probe_timer, K_USEC(PROBE_PERIOD_US),
+	              K_USEC(PROBE_PERIOD_US));
+}
+
+/* Returns the longest the timer interrupt was late, in microseconds. */
+static uint32_t
+probe_stop(void)
+{
+	k_timer_stop(&probe_timer);
+
+	uint32_t gap_us = k_cyc_to_us_floor32(max_gap_cycles);
+
+	return gap_us > PROBE_PERIOD_US ? gap_us - PROBE_PERIOD_US : 0;
+}
+
+static void
+probe_thread(void *p1, void *p2, void *p3)
+{
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	uint8_t value[64];
+	uint32_t idle_us;
+	uint32_t write_us;
+	int64_t start;
+	int writes;
+
+	k_timer_init(&probe_timer, probe_expiry, NULL);
+	settings_subsys_init();
+
+	probe_start();
+	k_msleep(PROBE_IDLE_MS);
+	idle_us = probe_stop();
+
+	probe_start();
+	start = k_uptime_get();
+	for (writes = 0; writes < PROBE_WRITES; writes++) {
+		memset(value, writes, sizeof(value));
+		int err = settings_save_one(PROBE_SETTINGS_KEY, value,
+		                            sizeof(value));
+		if (err) {
+			LOG_ERR("Settings write failed (err %d)", err);
+			break;
+		}
+	}
+	int64_t elapsed_ms = k_uptime_get() - start;
+	write_us = probe_stop();
+
+	settings_delete(PROBE_SETTINGS_KEY);
+
+	LOG_INF("Interrupt latency max %u us idle, %u us during %d settings "
+	        "writes in %lld ms", idle_us, write_us, writes, elapsed_ms);
+}
+
+K_THREAD_DEFINE(iram_probe_tid, PROBE_STACK_SIZE, probe_thread, NULL, NULL,
+                NULL, PROBE_PRIORITY, 0, PROBE_DELAY_MS);
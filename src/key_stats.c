@@ -0,0 +1,265 @@
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/atomic.h>
+
+#include "key_stats.h"
+
+#include "background.h"
+#include "lk201.h"
+#include "metrics.h"
+#include "iram.h"
+
+LOG_MODULE_REGISTER(key_stats, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define KEY_STATS_SETTINGS_KEY "vtbt/keys"
+
+/* The counts are kept in settings in chunks of keycodes, "vtbt/keys/0" to
+ * "vtbt/keys/7", and the dwell histograms in "vtbt/keys/dwell". A flush
+ * writes the chunks with a dirty bit. */
+#define KEYS_PER_CHUNK 32
+#define NUM_CHUNKS     (NUM_KEYS / KEYS_PER_CHUNK)
+#define DWELL_CHUNK    NUM_CHUNKS
+
+/* A flush waits for this long without a key press or repeat, checked
+ * before every chunk, but gives up waiting after a minute of typing. */
+#define QUIET_MS      1000
+#define MAX_DEFERRALS 60
+
+#define FLUSH_INTERVAL K_SECONDS(CONFIG_VTBT_KEY_STATS_FLUSH_INTERVAL)
+
+static struct key_counts counts[NUM_KEYS];
+static uint32_t dwell[NUM_DIVISIONS][KEY_STATS_DWELL_BUCKETS];
+static atomic_t dirty;
+/* Low bits of the source timestamp of the last key press or repeat. */
+static uint32_t last_press;
+static bool flushing;
+static struct key_stats_flush flush_stats;
+
+/* Usually set already, which makes this a load and a branch. */
+static VTBT_IRAM_ATTR void
+mark_dirty(int chunk)
+{
+	if (!atomic_test_bit(&dirty, chunk)) {
+		atomic_set_bit(&dirty, chunk);
+	}
+}
+
+VTBT_IRAM_ATTR void
+key_stats_press(int keycode, int64_t time, int64_t latency)
+{
+	counts[keycode].presses++;
+	mark_dirty(keycode / KEYS_PER_CHUNK);
+	last_press = (uint32_t)time;
+
+	if (flushing && latency >= 0) {
+		latency_stats_add(&flush_stats.key_latency, latency);
+	}
+}
+
+VTBT_IRAM_ATTR void
+key_stats_repeat(int keycode, int64_t time)
+{
+	counts[keycode].repeats++;
+	mark_dirty(keycode / KEYS_PER_CHUNK);
+	/* A held key is still typing, so flushes wait for it too. */
+	last_press = (uint32_t)time;
+}
+
+VTBT_IRAM_ATTR void
+key_stats_release(int division, int64_t dwell_ticks)
+{
+	uint32_t ms = k_ticks_to_ms_floor32(dwell_ticks);
+	int bucket = 0;
+
+	while (bucket < KEY_STATS_DWELL_BUCKETS - 1 &&
+	       ms >= KEY_STATS_DWELL_BASE_MS << bucket) {
+		bucket++;
+	}
+
+	dwell[division][bucket]++;
+	mark_dirty(DWELL_CHUNK);
+}
+
+const struct key_counts *
+key_stats_counts_get(void)
+{
+	return counts;
+}
+
+const uint32_t *
+key_stats_dwell_get(int division)
+{
+	return dwell[division];
+}
+
+void
+key_stats_flush_get(struct key_stats_flush *flush)
+{
+	*flush = flush_stats;
+}
+
+/* The loaded totals are added to what was counted since boot. Only called
+ * from load_work_handler(): without a static handler, loading all the
+ * settings, as Bluetooth does at startup, doesn't count the totals twice. */
+static int
+key_stats_load(const char *name, size_t len, settings_read_cb read_cb,
+               void *cb_arg, void *param)
+{
+	union {
+		struct key_counts counts[KEYS_PER_CHUNK];
+		uint32_t dwell[NUM_DIVISIONS][KEY_STATS_DWELL_BUCKETS];
+	} loaded;
+	uint32_t *from = (uint32_t *)&loaded;
+	uint32_t *to;
+
+	ARG_UNUSED(param);
+
+	if (name == NULL) {
+		return -ENOENT;
+	} else if (strcmp(name, "dwell") == 0) {
+		to = &dwell[0][0];
+		if (len != sizeof(dwell)) {
+			return -EINVAL;
+		}
+	} else if (name[0] >= '0' && name[0] < '0' + NUM_CHUNKS &&
+	           name[1] == '\0') {
+		to = (uint32_t *)&counts[(name[0] - '0') * KEYS_PER_CHUNK];
+		if (len != sizeof(loaded.counts)) {
+			return -EINVAL;
+		}
+	} else {
+		return -ENOENT;
+	}
+
+	if (read_cb(cb_arg, &loaded, len) != (ssize_t)len) {
+		return -EINVAL;
+	}
+
+	/* Keeps the event thread from counting in between. */
+	k_sched_lock();
+	for (size_t i = 0; i < len / sizeof(uint32_t); i++) {
+		to[i] += from[i];
+	}
+	k_sched_unlock();
+
+	return 0;
+}
+
+static void
+load_work_handler(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	settings_subsys_init();
+
+	int err = settings_load_subtree_direct(KEY_STATS_SETTINGS_KEY,
+	                                       key_stats_load, NULL);
+	if (err) {
+		LOG_ERR("Loading key statistics failed (err %d)", err);
+	}
+}
+
+static K_WORK_DEFINE(load_work, load_work_handler);
+
+static int
+save_chunk(int chunk)
+{
+	char name[sizeof(KEY_STATS_SETTINGS_KEY "/dwell")];
+	const void *value;
+	size_t len;
+
+	if (chunk == DWELL_CHUNK) {
+		strcpy(name, KEY_STATS_SETTINGS_KEY "/dwell");
+		value = dwell;
+		len = sizeof(dwell);
+	} else {
+		snprintk(name, sizeof(name), KEY_STATS_SETTINGS_KEY "/%d",
+		         chunk);
+		value = &counts[chunk * KEYS_PER_CHUNK];
+		len = KEYS_PER_CHUNK * sizeof(struct key_counts);
+	}
+
+	int err = settings_save_one(name, value, len);
+	if (err) {
+		LOG_ERR("Saving %s failed (err %d)", name, err);
+		return -1;
+	}
+
+	return len;
+}
+
+static void
+flush_work_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	static int deferrals;
+	atomic_val_t pending = atomic_clear(&dirty);
+	int64_t start = k_uptime_get();
+	uint32_t bytes = 0;
+
+	flushing = true;
+	for (int chunk = 0; chunk <= DWELL_CHUNK && pending != 0; chunk++) {
+		if (!(pending & BIT(chunk))) {
+			continue;
+		}
+
+		if (deferrals < MAX_DEFERRALS &&
+		    (uint32_t)k_uptime_ticks() - last_press <
+		    k_ms_to_ticks_ceil32(QUIET_MS)) {
+			break;
+		}
+
+		/* Counted again if it changes meanwhile. */
+		pending &= ~BIT(chunk);
+		int len = save_chunk(chunk);
+		if (len < 0) {
+			mark_dirty(chunk);
+		} else {
+			bytes += len;
+		}
+	}
+	flushing = false;
+
+	if (bytes > 0) {
+		uint32_t elapsed_ms = k_uptime_get() - start;
+
+		flush_stats.flushes++;
+		flush_stats.bytes += bytes;
+		flush_stats.max_ms = MAX(flush_stats.max_ms, elapsed_ms);
+		LOG_INF("Saved %u bytes of key statistics in %u ms", bytes,
+		        elapsed_ms);
+	}
+
+	if (pending != 0) {
+		/* Typing; the rest waits for a pause. */
+		atomic_or(&dirty, pending);
+		deferrals++;
+		flush_stats.deferrals++;
+		k_work_schedule_for_queue(&background_work_q, dwork,
+		                          K_MSEC(QUIET_MS));
+		return;
+	}
+
+	deferrals = 0;
+	k_work_schedule_for_queue(&background_work_q, dwork, FLUSH_INTERVAL);
+}
+
+static K_WORK_DELAYABLE_DEFINE(flush_work, flush_work_handler);
+
+static int
+key_stats_init(void)
+{
+	/* Loaded before the first flush, off the main thread so that it
+	 * doesn't hold up the terminals. */
+	k_work_submit_to_queue(&background_work_q, &load_work);
+	k_work_schedule_for_queue(&background_work_q, &flush_work,
+	                          FLUSH_INTERVAL);
+
+	return 0;
+}
+
+SYS_INIT(key_stats_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,55 @@
+#ifndef KEY_STATS_H
+#define KEY_STATS_H
+
+#include <stdint.h>
+
+#include "lk201.h"
+#include "metrics.h"
+
+/* Lifetime usage of every key, for planning keyboard replacements and tuning
+ * keymaps and repeat profiles: presses and auto-repeats by LK201 keycode, and
+ * how long keys of each division are held. Counted in RAM by the event
+ * thread, and added to the totals in settings under "vtbt/keys" by a
+ * low-priority thread every CONFIG_VTBT_KEY_STATS_FLUSH_INTERVAL seconds.
+ * Only the parts that changed are written, and only while no key has been
+ * pressed for a moment, so the flash writes neither wear out the flash nor
+ * stall the typing. */
+
+/* Bucket i of a dwell histogram counts keys held for less than
+ * KEY_STATS_DWELL_BASE_MS << i; the last bucket counts the rest. */
+#define KEY_STATS_DWELL_BUCKETS 8
+#define KEY_STATS_DWELL_BASE_MS 32U
+
+struct key_counts {
+	uint32_t presses;
+	/* Metronome codes and resent keycodes while the key repeated. */
+	uint32_t repeats;
+};
+
+struct key_stats_flush {
+	uint32_t flushes;
+	/* Flushes put off, or cut short, by typing. */
+	uint32_t deferrals;
+	uint32_t bytes;
+	uint32_t max_ms;
+	/* Key latency of the key presses sent while a flush was writing. */
+	struct latency_stats key_latency;
+};
+
+/* Called by the event thread for a key press, with the ticks from its source
+ * timestamp to its keycode entering the TX buffer, or -1 if it didn't. */
+void key_stats_press(int keycode, int64_t time, int64_t latency);
+/* Called by the event thread for a code sent while keycode repeats, with the
+ * source timestamp of the event that sent it. */
+void key_stats_repeat(int keycode, int64_t time);
+/* Called by the event thread for a key in a division released after being
+ * held for dwell ticks. */
+void key_stats_release(int division, int64_t dwell);
+
+/* NUM_KEYS entries, indexed by keycode. */
+const struct key_counts *key_stats_counts_get(void);
+/* KEY_STATS_DWELL_BUCKETS entries for the division. */
+const uint32_t *key_stats_dwell_get(int division);
+void key_stats_flush_get(struct key_stats_flush *flush);
+
+#endif /* KEY_STATS_H */
@@ -1,47 +1,83 @@
 #include <string.h>
 
 #include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
 
 #include "vtbt.h"
+#include "instance.h"
 #include "keyboard.h"
 #include "uart.h"
 #include "beeper.h"
 #include "metronome.h"
+#include "metrics.h"
 #include "lk201.h"
+#include "chords.h"
+#include "key_stats.h"
+#include "sim_recorder.h"
+#include "trace.h"
+#include "iram.h"
 
-/* Slab for new keys_down nodes */
+LOG_MODULE_REGISTER(keyboard, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define KEYS_DOWN_PER_PORT 16
+
+/* Slab for new keys_down nodes, shared by all instances */
 K_MEM_SLAB_DEFINE(
 	keys_down_slab,
 	ROUND_UP(sizeof(struct key_down), 4),
-	16, 4
+	KEYS_DOWN_PER_PORT * NUM_VT_PORTS, 4
 );
 
-/* New HID reports are compared to the previous HID report to identify changes
- * in the keys currently down. */
-static uint8_t last_report[HID_REPORT_SIZE] = { 0x00 };
+/* Key presses dropped because the slab was empty. */
+static atomic_t keys_down_exhausted;
+
+uint32_t
+keyboard_keys_down_max_get(void)
+{
+#ifdef CONFIG_MEM_SLAB_TRACE_MAX_UTILIZATION
+	return k_mem_slab_max_used_get(&keys_down_slab);
+#else
+	return 0;
+#endif
+}
 
-/* Keyclick on ctrl is disabled by default. */
-static bool ctrl_keyclick = false;
+uint32_t
+keyboard_keys_down_total_get(void)
+{
+	return KEYS_DOWN_PER_PORT * NUM_VT_PORTS;
+}
+
+uint32_t
+keyboard_keys_down_exhausted_get(void)
+{
+	return atomic_get(&keys_down_exhausted);
+}
 
 void
-keyboard_ctrl_keyclick_enable(void)
+keyboard_ctrl_keyclick_enable(struct keyboard *keyboard)
 {
-	ctrl_keyclick = true;
+	keyboard->ctrl_keyclick = true;
 }
 
 void
-keyboard_ctrl_keyclick_disable(void)
+keyboard_ctrl_keyclick_disable(struct keyboard *keyboard)
 {
-	ctrl_keyclick = false;
+	keyboard->ctrl_keyclick = false;
+}
+
+bool
+keyboard_ctrl_keyclick_get(struct keyboard *keyboard)
+{
+	return keyboard->ctrl_keyclick;
 }
 
 void
-keyboard_init_defaults(void)
+keyboard_init_defaults(struct keyboard *keyboard)
 {
-	ctrl_keyclick = false;
+	keyboard->ctrl_keyclick = false;
 }
 
-static bool
+static VTBT_IRAM_ATTR bool
 is_in_report(int keycode, const uint8_t *report)
 {
 	for (int i = HID_REPORT_FIRST_KEY; i < HID_REPORT_SIZE; i++) {
@@ -53,60 +89,70 @@ is_in_report(int keycode, const uint8_t *report)
 	return false;
 }
 
-static void
-key_down(sys_dlist_t *keys_down, int keycode)
+static VTBT_IRAM_ATTR void
+key_down(struct vtbt *vt, int keycode, int64_t time)
 {
 	if (keycode == 0x00) {
 		return;
 	}
 
+	if (IS_ENABLED(CONFIG_VTBT_SIM_RECORDER)) {
+		sim_recorder_key(vt->id, keycode, time);
+	}
+
 	int ret;
 	struct key_down *node;
 	ret = k_mem_slab_alloc(&keys_down_slab, (void **)&node, K_NO_WAIT);
 	if (ret < 0) {
+		atomic_inc(&keys_down_exhausted);
 		return;
 	}
 
 	sys_dnode_init(&node->node);
 
 	node->keycode = keycode;
-	node->time = k_uptime_get();
+	node->time = time;
 	node->repeating = false;
 	node->inhibit_auto_repeat = false;
 
-	sys_dlist_prepend(keys_down, &node->node);
+	sys_dlist_prepend(&vt->keys_down, &node->node);
 
-	int sent = uart_write_byte(keycode);
+	int sent = uart_write_byte(&vt->uart, keycode);
+	int64_t latency = k_uptime_ticks() - time;
 	node->sent = sent > 0;
+	VTBT_TRACE("key_down", keycode, sent);
+	if (IS_ENABLED(CONFIG_VTBT_KEY_STATS)) {
+		key_stats_press(keycode, time, sent > 0 ? latency : -1);
+	}
 	if (sent > 0) {
+		latency_stats_add(&vt->key_latency, latency);
 		if (keycode == LK201_CTRL) {
-			if (ctrl_keyclick) {
-				beeper_sound_keyclick();
+			if (vt->keyboard.ctrl_keyclick) {
+				beeper_sound_keyclick(&vt->beeper);
 			}
 		} else {
-			beeper_sound_keyclick();
+			beeper_sound_keyclick(&vt->beeper);
 		}
 	}
 
-	metronome_resend();
+	metronome_resend(&vt->metronome);
 }
 
-/* Track Down/Up keys released in this report */
-static int up_down_ups[16];
-static int up_down_ups_count = 0;
-
 /* Send codes for released Down/Up keys (or ALL UPS if none left pressed ) */
-static void
-send_up_down_ups(sys_dlist_t *keys_down) {
-	if (up_down_ups_count <= 0) {
+static VTBT_IRAM_ATTR void
+send_up_down_ups(struct vtbt *vt) {
+	struct keyboard *keyboard = &vt->keyboard;
+
+	if (keyboard->up_down_ups_count <= 0) {
 		return;
 	}
 
 	struct key_down *cn;
 	bool other_down_up = false;
-	SYS_DLIST_FOR_EACH_CONTAINER(keys_down, cn, node) {
+	SYS_DLIST_FOR_EACH_CONTAINER(&vt->keys_down, cn, node) {
 		struct division *division =
-			lk201_division_get_from_keycode(cn->keycode);
+			lk201_division_get_from_keycode(&vt->lk201,
+			                                cn->keycode);
 		if (division == NULL) {
 			continue;
 		} else if (division->mode == MODE_DOWN_UP) {
@@ -116,68 +162,85 @@ send_up_down_ups(sys_dlist_t *keys_down) {
 	}
 
 	if (!other_down_up) {
-		uart_write_byte(SPECIAL_ALL_UPS);
-		metronome_resend();
+		uart_write_byte(&vt->uart, SPECIAL_ALL_UPS);
+		metronome_resend(&vt->metronome);
 	} else {
-		while (up_down_ups_count--) {
-			uart_write_byte(up_down_ups[up_down_ups_count]);
-			metronome_resend();
+		while (keyboard->up_down_ups_count--) {
+			uart_write_byte(&vt->uart, keyboard->up_down_ups[
+				keyboard->up_down_ups_count]);
+			metronome_resend(&vt->metronome);
 		}
 	}
 }
 
-static void
-key_up(sys_dlist_t *keys_down, int keycode)
+static VTBT_IRAM_ATTR void
+key_up(struct vtbt *vt, int keycode, int64_t time)
 {
 	if (keycode == 0x00) {
 		return;
 	}
 
 	struct key_down *cn, *cns;
+	int64_t pressed = -1;
 
-	SYS_DLIST_FOR_EACH_CONTAINER_SAFE(keys_down, cn, cns, node) {
+	SYS_DLIST_FOR_EACH_CONTAINER_SAFE(&vt->keys_down, cn, cns, node) {
 		if (cn->keycode == keycode) {
+			pressed = cn->time;
 			sys_dlist_remove(&cn->node);
 			k_mem_slab_free(&keys_down_slab, (void *)cn);
 			break;
 		}
 	}
 
-	struct division *division = lk201_division_get_from_keycode(keycode);
+	struct division *division =
+		lk201_division_get_from_keycode(&vt->lk201, keycode);
 	if (division == NULL) {
 		return;
-	} else if (division->mode == MODE_DOWN_UP) {
-		up_down_ups[up_down_ups_count++] = keycode;
+	}
+
+	if (IS_ENABLED(CONFIG_VTBT_KEY_STATS) && pressed >= 0) {
+		key_stats_release(division - vt->lk201.divisions,
+		                  time - pressed);
+	}
+
+	if (division->mode == MODE_DOWN_UP) {
+		struct keyboard *keyboard = &vt->keyboard;
+		keyboard->up_down_ups[keyboard->up_down_ups_count++] = keycode;
 	}
 }
 
-void
-keyboard_event(sys_dlist_t *keys_down, const struct event *event)
+VTBT_IRAM_ATTR void
+keyboard_event(struct vtbt *vt, const struct event *event)
 {
-	const uint8_t *this_report = event->buf;
+	struct keyboard *keyboard = &vt->keyboard;
+	uint8_t report[HID_REPORT_SIZE];
+	const uint8_t *this_report = report;
+	const uint8_t *last_report = keyboard->last_report;
+
+	memcpy(report, event->buf, sizeof(report));
+	const struct chord *chord =
+		chords_filter(&keyboard->chords, report, last_report);
+
+	VTBT_TRACE("kbd_event", this_report[0], this_report[2]);
 
 	const uint8_t this_modifiers = this_report[0];
 	const uint8_t last_modifiers = last_report[0];
 
-	up_down_ups_count = 0;
+	keyboard->up_down_ups_count = 0;
 
 	/* Process the modifiers byte. */
 	for (int i = 0; i < 8; i++) {
-		int key = 0;
-		if ((i == 0) || (i == 4)) {
-			key = LK201_CTRL; /* Ctrl */
-		} else if ((i == 1) || (i == 5)) {
-			key = LK201_SHIFT; /* Shift*/
-		} else {
+		int key = lk201_keycode_get_from_modifier(i);
+		if (key == 0x00) {
 			continue;
 		}
 		if ((this_modifiers & (1 << i)) &&
 		    !(last_modifiers & (1 << i))) {
-			key_down(keys_down, key);
+			key_down(vt, key, event->time);
 		}
 		if ((last_modifiers & (1 << i)) &&
 		    !(this_modifiers & (1 << i))) {
-			key_up(keys_down, key);
+			key_up(vt, key, event->time);
 		}
 	}
 
@@ -186,17 +249,47 @@ keyboard_event(sys_dlist_t *keys_down, const struct event *event)
 		    !is_in_report(this_report[i], last_report)) {
 			int keycode =
 				lk201_keycode_get_from_hid(this_report[i]);
-			key_down(keys_down, keycode);
+			key_down(vt, keycode, event->time);
 		}
 		if ((last_report[i] != 0x00) &&
 		    !is_in_report(last_report[i], this_report)) {
 			int keycode =
 				lk201_keycode_get_from_hid(last_report[i]);
-			key_up(keys_down, keycode);
+			key_up(vt, keycode, event->time);
 		}
 	}
 
-	memcpy(last_report, this_report, sizeof(last_report));
+	memcpy(keyboard->last_report, this_report,
+	       sizeof(keyboard->last_report));
+
+	send_up_down_ups(vt);
+
+	if (chord != NULL) {
+		chord->action(vt, chord->arg);
+	}
+}
+
+void
+keyboard_release_all(struct vtbt *vt, int64_t time)
+{
+	struct keyboard *keyboard = &vt->keyboard;
+	struct event released = {
+		.source = EVT_KEYBOARD,
+		.time = time,
+		.size = HID_REPORT_SIZE,
+	};
+
+	if (sys_dlist_is_empty(&vt->keys_down) &&
+	    memcmp(keyboard->last_report, released.buf,
+	           sizeof(released.buf)) == 0) {
+		return;
+	}
+
+	/* The usual key ups, ALL UPS included, and the metronome stops with
+	 * nothing left down. */
+	keyboard_event(vt, &released);
+	keyboard->link_loss_releases++;
 
-	send_up_down_ups(keys_down);
+	LOG_WRN("vt%d: released the keys of a lost keyboard (%u times)",
+	        vt->id, keyboard->link_loss_releases);
 }
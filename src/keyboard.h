@@ -4,10 +4,38 @@
 #include <zephyr/kernel.h>
 
 #include "vtbt.h"
+#include "chords.h"
 
-void keyboard_ctrl_keyclick_enable(void);
-void keyboard_ctrl_keyclick_disable(void);
-void keyboard_init_defaults(void);
-void keyboard_event(sys_dlist_t *, const struct event *);
+struct vtbt;
+
+struct keyboard {
+	/* New HID reports are compared to the previous HID report to identify
+	 * changes in the keys currently down. */
+	uint8_t last_report[HID_REPORT_SIZE];
+	/* Keyclick on ctrl is disabled by default. */
+	bool ctrl_keyclick;
+	/* Track Down/Up keys released in this report */
+	int up_down_ups[16];
+	int up_down_ups_count;
+	/* Keys of the vtbt's own chords, kept from the terminal. */
+	struct chords chords;
+	/* Times keys were released because their keyboard went away. */
+	uint32_t link_loss_releases;
+};
+
+void keyboard_ctrl_keyclick_enable(struct keyboard *keyboard);
+void keyboard_ctrl_keyclick_disable(struct keyboard *keyboard);
+bool keyboard_ctrl_keyclick_get(struct keyboard *keyboard);
+void keyboard_init_defaults(struct keyboard *keyboard);
+void keyboard_event(struct vtbt *vt, const struct event *event);
+/* Release every key held by a keyboard that went away, as if it had sent a
+ * report with nothing down. */
+void keyboard_release_all(struct vtbt *vt, int64_t time);
+/* Most keys_down nodes ever in use across all instances, or 0 without
+ * CONFIG_MEM_SLAB_TRACE_MAX_UTILIZATION, and the number available. */
+uint32_t keyboard_keys_down_max_get(void);
+uint32_t keyboard_keys_down_total_get(void);
+/* Key presses dropped because every keys_down node was in use. */
+uint32_t keyboard_keys_down_exhausted_get(void);
 
 #endif /* KEYBOARD_H */
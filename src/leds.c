@@ -2,27 +2,26 @@
 #include <zephyr/logging/log.h>
 
 #include "leds.h"
+#include "vtbt.h"
 
 LOG_MODULE_REGISTER(leds, CONFIG_LOG_DEFAULT_LEVEL);
 
-static const struct gpio_dt_spec leds[NUM_LEDS] = {
-	GPIO_DT_SPEC_GET_OR(DT_NODELABEL(led0), gpios, {0}),
-	GPIO_DT_SPEC_GET_OR(DT_NODELABEL(led1), gpios, {0}),
-	GPIO_DT_SPEC_GET_OR(DT_NODELABEL(led2), gpios, {0}),
-	GPIO_DT_SPEC_GET_OR(DT_NODELABEL(led3), gpios, {0}),
-};
-
 int
-leds_init(void)
+leds_init(struct leds *leds)
 {
 	int ret;
 	for (int i = 0; i < NUM_LEDS; i++) {
-		if (!gpio_is_ready_dt(&leds[i])) {
+		if (leds->gpios[i].port == NULL) {
+			continue;
+		}
+
+		if (!gpio_is_ready_dt(&leds->gpios[i])) {
 			LOG_ERR("led%d pin GPIO port is not ready.", i);
 			return -1;
 		}
 
-		ret = gpio_pin_configure_dt(&leds[i], GPIO_OUTPUT_INACTIVE);
+		ret = gpio_pin_configure_dt(&leds->gpios[i],
+		                            GPIO_OUTPUT_INACTIVE);
 		if (ret != 0) {
 			LOG_ERR("Configuring led%d GPIO pin failed: %d",
 			        i, ret);
@@ -34,13 +33,45 @@ leds_init(void)
 }
 
 void
-leds_on(int which)
+leds_on(struct leds *leds, int which)
 {
-	gpio_pin_set_dt(&leds[which], 1);
+	if (leds->gpios[which].port != NULL) {
+		gpio_pin_set_dt(&leds->gpios[which], 1);
+	}
+	leds->state |= BIT(which);
 }
 
 void
-leds_off(int which)
+leds_off(struct leds *leds, int which)
+{
+	if (leds->gpios[which].port != NULL) {
+		gpio_pin_set_dt(&leds->gpios[which], 0);
+	}
+	leds->state &= ~BIT(which);
+}
+
+uint8_t
+leds_get(struct leds *leds)
 {
-	gpio_pin_set_dt(&leds[which], 0);
+	return leds->state;
+}
+
+uint8_t
+leds_hid_get(struct leds *leds)
+{
+	static const uint8_t hid_leds[NUM_LEDS] = {
+		[LED_WAIT] = HID_LED_NUM_LOCK,
+		[LED_COMPOSE] = HID_LED_COMPOSE,
+		[LED_LOCK] = HID_LED_CAPS_LOCK,
+		[LED_HOLD_SCREEN] = HID_LED_SCROLL_LOCK,
+	};
+	uint8_t report = 0;
+
+	for (int i = 0; i < NUM_LEDS; i++) {
+		if (leds->state & BIT(i)) {
+			report |= hid_leds[i];
+		}
+	}
+
+	return report;
 }
@@ -1,6 +1,10 @@
 #ifndef LEDS_H
 #define LEDS_H
 
+#include <stdint.h>
+
+#include <zephyr/drivers/gpio.h>
+
 #define NUM_LEDS 4
 
 #define LED_HOLD_SCREEN  3
@@ -8,8 +12,34 @@
 #define LED_COMPOSE      1
 #define LED_WAIT         0
 
-int leds_init(void);
-void leds_on(int which);
-void leds_off(int which);
+struct leds {
+	/* Indexed by LED number. Ports without LEDs have a zeroed array. */
+	struct gpio_dt_spec gpios[NUM_LEDS];
+	uint8_t state;
+};
+
+#define LEDS_GPIO_DT_SPEC(node_id, idx) \
+	GPIO_DT_SPEC_GET_BY_IDX_OR(node_id, led_gpios, idx, {0})
+
+/* Static initializer for the devicetree parts of a struct leds. */
+#define LEDS_DT_INIT(node_id)                                           \
+	{                                                               \
+		.gpios = {                                              \
+			LEDS_GPIO_DT_SPEC(node_id, LED_WAIT),           \
+			LEDS_GPIO_DT_SPEC(node_id, LED_COMPOSE),        \
+			LEDS_GPIO_DT_SPEC(node_id, LED_LOCK),           \
+			LEDS_GPIO_DT_SPEC(node_id, LED_HOLD_SCREEN),    \
+		},                                                      \
+	}
+
+int leds_init(struct leds *leds);
+void leds_on(struct leds *leds, int which);
+void leds_off(struct leds *leds, int which);
+/* Returns a bitmask of the LEDs that are on, bit n being LED n. */
+uint8_t leds_get(struct leds *leds);
+/* Returns the LEDs that are on as a HID keyboard LED output report: Lock is
+ * Caps Lock, Hold Screen is Scroll Lock, Compose is Compose and Wait is
+ * Num Lock. */
+uint8_t leds_hid_get(struct leds *leds);
 
 #endif /* LEDS_H */
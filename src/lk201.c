@@ -1,17 +1,42 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <zephyr/sys/util.h>
+
 #include "lk201.h"
+#include "iram.h"
+
+/* Keys that differ between terminal profiles (CONFIG_VTBT_PROFILE_*). */
+#if defined(CONFIG_VTBT_PROFILE_VT220_LK201)
+/* The VT220 has no Escape key; F11 sends ESC. ` and the non-US \ are the
+ * LK201's `~ and <> keys. */
+#define MAP_ESCAPE             0x71
+#define MAP_GRAVE              0xbf
+#define MAP_NON_US_BACKSLASH   0xc9
+#else
+/* The VT420's default "<> Key Sends `~" and "`~ Key Sends ESC" settings. */
+#define MAP_ESCAPE             0xbf
+#define MAP_GRAVE              0xc9
+#define MAP_NON_US_BACKSLASH   0x00
+#endif
+
+#ifdef CONFIG_VTBT_PROFILE_VT420_LK401
+#define MAP_LEFT_ALT           LK401_ALT_FUNCTION
+#define MAP_RIGHT_SHIFT        LK401_RIGHT_SHIFT
+#define LAST_VERTICAL_CURSOR   0xaa
+#else
+#define MAP_LEFT_ALT           0x00
+#define MAP_RIGHT_SHIFT        LK201_SHIFT
+#define LAST_VERTICAL_CURSOR   0xac
+#endif
 
-static struct repeat_buffer repeat_buffers[NUM_REPEAT_BUFFERS];
 static const struct repeat_buffer repeat_buffers_default[NUM_REPEAT_BUFFERS] = {
-	{ .timeout = 500, .interval = 1000 / 30 },
-	{ .timeout = 300, .interval = 1000 / 30 },
-	{ .timeout = 500, .interval = 1000 / 40 },
-	{ .timeout = 300, .interval = 1000 / 40 },
+	{ .timeout = 500, .rate = 30 },
+	{ .timeout = 300, .rate = 30 },
+	{ .timeout = 500, .rate = 40 },
+	{ .timeout = 300, .rate = 40 },
 };
 
-static struct division divisions[NUM_DIVISIONS];
 static const struct division divisions_default[NUM_DIVISIONS] = {
 	{ .mode = MODE_AUTO_REPEAT,   .buffer =  0 }, /* Main array */
 	{ .mode = MODE_AUTO_REPEAT,   .buffer =  0 }, /* Keypad */
@@ -30,26 +55,27 @@ static const struct division divisions_default[NUM_DIVISIONS] = {
 };
 
 void
-lk201_init_defaults(void)
+lk201_init_defaults(struct lk201 *lk201)
 {
-	memcpy(repeat_buffers, repeat_buffers_default, sizeof(repeat_buffers));
-	memcpy(divisions, divisions_default, sizeof(divisions));
+	memcpy(lk201->repeat_buffers, repeat_buffers_default,
+	       sizeof(lk201->repeat_buffers));
+	memcpy(lk201->divisions, divisions_default, sizeof(lk201->divisions));
 }
 
-struct repeat_buffer *
-lk201_repeat_buffer_get(int repeat_buffer)
+VTBT_IRAM_ATTR struct repeat_buffer *
+lk201_repeat_buffer_get(struct lk201 *lk201, int repeat_buffer)
 {
-	return &repeat_buffers[repeat_buffer];
+	return &lk201->repeat_buffers[repeat_buffer];
 }
 
 struct division *
-lk201_division_get(int division)
+lk201_division_get(struct lk201 *lk201, int division)
 {
-	return &divisions[division];
+	return &lk201->divisions[division];
 }
 
-struct division *
-lk201_division_get_from_keycode(int keycode)
+VTBT_IRAM_ATTR struct division *
+lk201_division_get_from_keycode(struct lk201 *lk201, int keycode)
 {
 	int division = -1;
 	if ((keycode >= 0x56) && (keycode <= 0x62)) {
@@ -68,9 +94,9 @@ lk201_division_get_from_keycode(int keycode)
 		division = DIVISION_KEYPAD;
 	} else if ((keycode >= 0xA6) && (keycode <= 0xA8)) {
 		division = DIVISION_HORIZONTAL_CURSORS;
-	} else if ((keycode >= 0xA9) && (keycode <= 0xAC)) {
+	} else if ((keycode >= 0xA9) && (keycode <= LAST_VERTICAL_CURSOR)) {
 		division = DIVISION_VERTICAL_CURSORS;
-	} else if ((keycode >= 0xAD) && (keycode <= 0xAF)) {
+	} else if ((keycode > LAST_VERTICAL_CURSOR) && (keycode <= 0xAF)) {
 		division = DIVISION_SHIFT_AND_CTRL;
 	} else if ((keycode >= 0xB0) && (keycode <= 0xB2)) {
 		division = DIVISION_LOCK_AND_COMPOSE;
@@ -82,28 +108,44 @@ lk201_division_get_from_keycode(int keycode)
 		division = DIVISION_MAIN_ARRAY;
 	}
 
-	return (division >= 0) ? &divisions[division] : NULL;
+	return (division >= 0) ? &lk201->divisions[division] : NULL;
 }
 
-static int hid_to_lk201_map[] = {
+static const uint8_t hid_to_lk201_map[] VTBT_DRAM_ATTR = {
 	#include "lk201_map.txt"
 };
 
-int
+/* Left Ctrl, Shift, Alt and GUI, then the right ones. Right Alt is kept for
+ * the vtbt's own chords. */
+static const uint8_t modifier_to_lk201_map[8] VTBT_DRAM_ATTR = {
+	[0] = LK201_CTRL,
+	[1] = LK201_SHIFT,
+	[2] = MAP_LEFT_ALT,
+	[4] = LK201_CTRL,
+	[5] = MAP_RIGHT_SHIFT,
+};
+
+VTBT_IRAM_ATTR int
 lk201_keycode_get_from_hid(int hid)
 {
-	if (hid < (int)sizeof(hid_to_lk201_map)) {
+	if (hid < (int)ARRAY_SIZE(hid_to_lk201_map)) {
 		return hid_to_lk201_map[hid];
 	} else {
 		return 0x00;
 	}
 }
 
+VTBT_IRAM_ATTR int
+lk201_keycode_get_from_modifier(int bit)
+{
+	return modifier_to_lk201_map[bit];
+}
+
 void
-lk201_change_all_auto_repeat_to_down_only(void)
+lk201_change_all_auto_repeat_to_down_only(struct lk201 *lk201)
 {
 	for (int i = 0; i < NUM_DIVISIONS; i++) {
-		struct division *division = &divisions[i];
+		struct division *division = &lk201->divisions[i];
 		if (division->mode == MODE_AUTO_REPEAT) {
 			division->mode = MODE_DOWN_ONLY;
 		}
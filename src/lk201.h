@@ -31,7 +31,11 @@
 
 /* Keyboard IDs */
 #define SPECIAL_KEYBOARD_ID_FIRMWARE        0x01
+#ifdef CONFIG_VTBT_PROFILE_VT420_LK401
+#define SPECIAL_KEYBOARD_ID_HARDWARE        0x02
+#else
 #define SPECIAL_KEYBOARD_ID_HARDWARE        0x00
+#endif
 /* Key down during self-test */
 #define SPECIAL_KEY_DOWN_ON_POWER_UP_ERROR  0x3d
 /* Self test failed */
@@ -97,12 +101,15 @@
 #define LK201_SHIFT  0xae
 #define LK201_CTRL   0xaf
 
+/* Keys only on the LK401. */
+#define LK401_RIGHT_SHIFT   0xab
+#define LK401_ALT_FUNCTION  0xac
+
 struct repeat_buffer {
 	/* Milliseconds before auto-repeating. */
 	int timeout;
-	/* Milliseconds between metronome codes. (This is metronome codes per
-	 * second in the spec). */
-	int interval;
+	/* Metronome codes per second. Never 0. */
+	int rate;
 };
 
 struct division {
@@ -110,11 +117,21 @@ struct division {
 	int buffer;
 };
 
-void lk201_init_defaults(void);
-struct repeat_buffer *lk201_repeat_buffer_get(int repeat_buffer);
-struct division *lk201_division_get(int division);
-struct division *lk201_division_get_from_keycode(int keycode);
+/* Division and repeat buffer settings made by the terminal. */
+struct lk201 {
+	struct repeat_buffer repeat_buffers[NUM_REPEAT_BUFFERS];
+	struct division divisions[NUM_DIVISIONS];
+};
+
+void lk201_init_defaults(struct lk201 *lk201);
+struct repeat_buffer *lk201_repeat_buffer_get(struct lk201 *lk201,
+                                              int repeat_buffer);
+struct division *lk201_division_get(struct lk201 *lk201, int division);
+struct division *lk201_division_get_from_keycode(struct lk201 *lk201,
+                                                 int keycode);
 int lk201_keycode_get_from_hid(int hid);
-void lk201_change_all_auto_repeat_to_down_only(void);
+/* Keycode for a bit of the HID report's modifier byte, or 0x00. */
+int lk201_keycode_get_from_modifier(int bit);
+void lk201_change_all_auto_repeat_to_down_only(struct lk201 *lk201);
 
 #endif /* LK201_H */
@@ -0,0 +1,208 @@
+/* A log backend keeping dictionary-format log records in RAM that survives a
+ * warm reset, so logging can stay enabled on units serving terminals without
+ * going near the VT line. Read the ring out with a debugger and decode it
+ * with scripts/log_ring.py:
+ *
+ *   (gdb) dump binary value ring.bin log_ring
+ *
+ * The ring is a header of four little-endian 32-bit words (magic, head, tail,
+ * used) followed by the buffer. Records are whole dictionary log messages,
+ * each preceded by its 16-bit length; the oldest are dropped to make room.
+ *
+ * The cycles taken by a log call on the calling thread are measured and
+ * logged at startup. */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <zephyr/linker/section_tags.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/logging/log_backend.h>
+#include <zephyr/logging/log_backend_std.h>
+#include <zephyr/logging/log_output.h>
+#include <zephyr/logging/log_output_dict.h>
+
+#include "retained.h"
+
+LOG_MODULE_REGISTER(log_ring, LOG_LEVEL_INF);
+
+#define LOG_RING_SIZE  CONFIG_VTBT_LOG_RING_SIZE
+#define LOG_RING_MAGIC 0x4c4f4752 /* "LOGR" */
+
+/* Largest record kept; longer messages are dropped. */
+#define RECORD_MAX_SIZE 128
+
+#define CALL_SAMPLES 8
+
+BUILD_ASSERT(RECORD_MAX_SIZE + sizeof(uint16_t) <= LOG_RING_SIZE,
+             "Log ring is smaller than a record");
+
+struct log_ring {
+	uint32_t magic;
+	/* Offsets of the next byte to write and of the oldest record. */
+	uint32_t head;
+	uint32_t tail;
+	uint32_t used;
+	uint8_t buf[LOG_RING_SIZE];
+};
+
+/* Not zeroed at startup, so the records before a warm reset survive. */
+VTBT_RETAINED_ATTR struct log_ring log_ring;
+
+static uint8_t record[RECORD_MAX_SIZE];
+static size_t record_size;
+static bool record_overflow;
+
+static void
+ring_write(const uint8_t *data, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		log_ring.buf[log_ring.head] = data[i];
+		log_ring.head = (log_ring.head + 1) % LOG_RING_SIZE;
+	}
+	log_ring.used += size;
+}
+
+static size_t
+ring_record_size(uint32_t offset)
+{
+	return log_ring.buf[offset] |
+	       log_ring.buf[(offset + 1) % LOG_RING_SIZE] << 8;
+}
+
+static void
+ring_put(const uint8_t *data, size_t size)
+{
+	const uint8_t size_le[sizeof(uint16_t)] = { size & 0xff, size >> 8 };
+
+	while (LOG_RING_SIZE - log_ring.used < sizeof(size_le) + size) {
+		size_t oldest = sizeof(size_le) +
+		                ring_record_size(log_ring.tail);
+
+		log_ring.tail = (log_ring.tail + oldest) % LOG_RING_SIZE;
+		log_ring.used -= oldest;
+	}
+
+	ring_write(size_le, sizeof(size_le));
+	ring_write(data, size);
+}
+
+static int
+record_out(uint8_t *data, size_t size, void *ctx)
+{
+	ARG_UNUSED(ctx);
+
+	if (record_size + size > sizeof(record)) {
+		record_overflow = true;
+	} else {
+		memcpy(&record[record_size], data, size);
+		record_size += size;
+	}
+
+	return size;
+}
+
+static uint8_t output_buf[32];
+
+LOG_OUTPUT_DEFINE(log_output_ring, record_out, output_buf,
+                  sizeof(output_buf));
+
+/* Messages are formatted into record and only put in the ring whole. */
+static void
+record_begin(void)
+{
+	record_size = 0;
+	record_overflow = false;
+}
+
+static void
+record_end(void)
+{
+	log_output_flush(&log_output_ring);
+	if (!record_overflow) {
+		ring_put(record, record_size);
+	}
+}
+
+static void
+process(const struct log_backend *const backend, union log_msg_generic *msg)
+{
+	ARG_UNUSED(backend);
+
+	log_format_func_t log_output_func =
+		log_format_func_t_get(LOG_OUTPUT_DICT);
+
+	record_begin();
+	log_output_func(&log_output_ring, &msg->log,
+	                log_backend_std_get_flags());
+	record_end();
+}
+
+static void
+dropped(const struct log_backend *const backend, uint32_t cnt)
+{
+	ARG_UNUSED(backend);
+
+	record_begin();
+	log_dict_output_dropped_process(&log_output_ring, cnt);
+	record_end();
+}
+
+static void
+panic(const struct log_backend *const backend)
+{
+	ARG_UNUSED(backend);
+
+	/* Records are written to RAM as they are processed. */
+}
+
+static void
+init(const struct log_backend *const backend)
+{
+	ARG_UNUSED(backend);
+
+	if (log_ring.magic != LOG_RING_MAGIC ||
+	    log_ring.head >= LOG_RING_SIZE ||
+	    log_ring.tail >= LOG_RING_SIZE ||
+	    log_ring.used > LOG_RING_SIZE) {
+		memset(&log_ring, 0, sizeof(log_ring));
+		log_ring.magic = LOG_RING_MAGIC;
+	}
+}
+
+static const struct log_backend_api log_backend_ring_api = {
+	.process = process,
+	.dropped = dropped,
+	.panic = panic,
+	.init = init,
+};
+
+LOG_BACKEND_DEFINE(log_backend_ring, log_backend_ring_api, true);
+
+/* Deferred logging only copies the arguments into the log buffer on the
+ * calling thread; formatting and the backends run on the log thread. */
+static int
+log_ring_measure(void)
+{
+	uint32_t call_cycles_min = UINT32_MAX;
+	uint32_t call_cycles_max = 0;
+
+	for (int i = 0; i < CALL_SAMPLES; i++) {
+		uint32_t start = k_cycle_get_32();
+
+		LOG_INF("log call sample %d of %d", i + 1, CALL_SAMPLES);
+
+		uint32_t cycles = k_cycle_get_32() - start;
+
+		call_cycles_min = MIN(call_cycles_min, cycles);
+		call_cycles_max = MAX(call_cycles_max, cycles);
+	}
+
+	LOG_INF("Log call: %u to %u cycles (%u Hz)", call_cycles_min,
+	        call_cycles_max, sys_clock_hw_cycles_per_sec());
+
+	return 0;
+}
+
+SYS_INIT(log_ring_measure, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -8,91 +8,179 @@
 #include <zephyr/sys/dlist.h>
 
 #include "vtbt.h"
+#include "instance.h"
 #include "lk201.h"
 #include "beeper.h"
 #include "bluetooth.h"
+#include "input.h"
 #include "leds.h"
 #include "metronome.h"
 #include "uart.h"
 #include "keyboard.h"
+#include "metrics.h"
+#include "retained.h"
+#include "trace.h"
+#include "iram.h"
 
 LOG_MODULE_REGISTER(vtbt, CONFIG_LOG_DEFAULT_LEVEL);
 
-static bool test_mode = false;
-
-static sys_dlist_t keys_down;
+#define DT_DRV_COMPAT vtbt_vt_port
+
+BUILD_ASSERT(NUM_VT_PORTS > 0, "No vtbt,vt-port devicetree nodes");
+
+/* Log output would corrupt the LK201 protocol, see debug-console.overlay. */
+#define VT_UART_IS_CONSOLE(inst) \
+	|| DT_SAME_NODE(DT_INST_PHANDLE(inst, uart), DT_CHOSEN(zephyr_console))
+
+#if defined(CONFIG_LOG_BACKEND_UART) && DT_HAS_CHOSEN(zephyr_console)
+BUILD_ASSERT(!(0 DT_INST_FOREACH_STATUS_OKAY(VT_UART_IS_CONSOLE)),
+             "The log UART backend would write to a VT port");
+#endif
+
+/* Host commands preempt keystroke generation, so that flow control takes
+ * effect while the event thread is busy with HID reports and repeats. */
+#define HOST_THREAD_STACK_SIZE  CONFIG_VTBT_HOST_THREAD_STACK_SIZE
+#define HOST_THREAD_PRIORITY    0
+#define EVENT_THREAD_STACK_SIZE CONFIG_VTBT_EVENT_THREAD_STACK_SIZE
+#define EVENT_THREAD_PRIORITY   1
+
+#define VTBT_INIT(inst)                                                 \
+	[inst] = {                                                      \
+		.id = inst,                                             \
+		.source = DT_INST_ENUM_IDX(inst, keyboard_source),      \
+		.uart = VT_UART_DT_INIT(DT_DRV_INST(inst)),             \
+		.beeper = BEEPER_DT_INIT(DT_DRV_INST(inst)),            \
+		.leds = LEDS_DT_INIT(DT_DRV_INST(inst)),                \
+	},
+
+struct vtbt vtbt_instances[NUM_VT_PORTS] = {
+	DT_INST_FOREACH_STATUS_OKAY(VTBT_INIT)
+};
+
+K_THREAD_STACK_ARRAY_DEFINE(host_thread_stacks, NUM_VT_PORTS,
+                            HOST_THREAD_STACK_SIZE);
+static struct k_thread host_threads[NUM_VT_PORTS];
+K_THREAD_STACK_ARRAY_DEFINE(event_thread_stacks, NUM_VT_PORTS,
+                            EVENT_THREAD_STACK_SIZE);
+static struct k_thread event_threads[NUM_VT_PORTS];
+
+/* The instance served by the Bluetooth keyboard, whose LEDs it mirrors. */
+static struct vtbt *bluetooth_vt;
+
+/* Queue an event from an ISR or the Bluetooth stack, keeping track of the
+ * queue's high-water mark. */
+static VTBT_IRAM_ATTR int
+event_put(struct vtbt *vt, struct k_msgq *msgq, atomic_t *max,
+          const struct event *event)
+{
+	int ret = k_msgq_put(msgq, event, K_NO_WAIT);
 
-K_MSGQ_DEFINE(msgq, sizeof(struct event), 32, 4);
+	if (ret == 0) {
+		metrics_high_water_mark(max, k_msgq_num_used_get(msgq));
+	} else {
+		atomic_inc(&vt->events_dropped);
+	}
 
-static struct event metronome_evt = { EVT_METRONOME, 0 , { 0 } };
+	return ret;
+}
 
-static void
+static VTBT_IRAM_ATTR void
 metronome(struct k_timer *timer_id)
 {
-	ARG_UNUSED(timer_id);
+	struct vtbt *vt = k_timer_user_data_get(timer_id);
 
-	k_msgq_put(&msgq, &metronome_evt, K_NO_WAIT);
+	vt->metronome_evt.time = k_uptime_ticks();
+	event_put(vt, &vt->msgq, &vt->msgq_max, &vt->metronome_evt);
 }
 
-K_TIMER_DEFINE(metronome_timer, metronome, NULL);
+static VTBT_IRAM_ATTR void
+hid_report_cb(const uint8_t *hid_report, int64_t time, void *user_data)
+{
+	struct vtbt *vt = user_data;
 
-static struct event hid_evt = { EVT_KEYBOARD, HID_REPORT_SIZE, { 0 } };
+	vt->hid_evt.time = time;
+	memcpy(vt->hid_evt.buf, hid_report, HID_REPORT_SIZE);
+	int ret = event_put(vt, &vt->msgq, &vt->msgq_max, &vt->hid_evt);
+	VTBT_TRACE("hid_report", ret, k_msgq_num_used_get(&vt->msgq));
+}
 
 static void
-hid_report_cb(const uint8_t *hid_report)
+link_lost_cb(int64_t time, void *user_data)
 {
-	memcpy(hid_evt.buf, hid_report, HID_REPORT_SIZE);
-	k_msgq_put(&msgq, &hid_evt, K_NO_WAIT);
+	struct vtbt *vt = user_data;
+	struct event event = {
+		.source = EVT_LINK_LOST,
+		.time = time,
+	};
+
+	if (event_put(vt, &vt->msgq, &vt->msgq_max, &event) != 0) {
+		atomic_set(&vt->link_lost_pending, 1);
+	}
 }
 
 static void
-send_power_on_test_result(void) {
+send_power_on_test_result(struct vtbt *vt) {
 	const unsigned char test_result[] = {
 		SPECIAL_KEYBOARD_ID_FIRMWARE,
 		SPECIAL_KEYBOARD_ID_HARDWARE,
 		0x00, /* ERROR */
 		0x00, /* KEYCODE */
 	};
-	uart_write(test_result, sizeof(test_result));
+	uart_write(&vt->uart, test_result, sizeof(test_result));
 }
 
-static struct event callback_evt = { EVT_HOST, 0 , { 0 } };
-
-static void
-uart_callback(uint8_t c)
+static VTBT_IRAM_ATTR void
+uart_callback(uint8_t c, void *user_data)
 {
+	struct vtbt *vt = user_data;
+	struct event *host_evt = &vt->host_evt;
+
 	if (c & 0x80) {
 		/* no more parameters */
-		callback_evt.buf[callback_evt.size++] = c;
-		k_msgq_put(&msgq, &callback_evt, K_NO_WAIT);
-		callback_evt.size = 0;
-	} else if (callback_evt.size < 3) {
-		callback_evt.buf[callback_evt.size++] = c;
+		host_evt->time = k_uptime_ticks();
+		host_evt->buf[host_evt->size++] = c;
+		int ret = event_put(vt, &vt->host_msgq, &vt->host_msgq_max,
+		                    host_evt);
+		VTBT_TRACE("host_cmd", host_evt->buf[0], ret);
+		host_evt->size = 0;
+	} else if (host_evt->size < 3) {
+		host_evt->buf[host_evt->size++] = c;
 	}
 }
 
 static void
-init_defaults(void)
+init_defaults(struct vtbt *vt)
+{
+	vt->test_mode = false;
+	lk201_init_defaults(&vt->lk201);
+	keyboard_init_defaults(&vt->keyboard);
+	beeper_set_keyclick_volume(&vt->beeper, 2);
+	beeper_set_bell_volume(&vt->beeper, 2);
+}
+
+/* Show an instance's LEDs on the Bluetooth keyboard too. */
+static void
+mirror_leds(struct vtbt *vt)
 {
-	test_mode = false;
-	lk201_init_defaults();
-	keyboard_init_defaults();
-	beeper_set_keyclick_volume(2);
-	beeper_set_bell_volume(2);
+	if (vt == bluetooth_vt) {
+		bluetooth_leds_set(leds_hid_get(&vt->leds));
+	}
 }
 
 /* FLOW CONTROL */
 
+/* Called without the instance lock. */
 static void
-inhibit_keyboard_transmission(const struct event *event)
+inhibit_keyboard_transmission(struct vtbt *vt, const struct event *event)
 {
-	ARG_UNUSED(event);
+	leds_on(&vt->leds, LED_LOCK);
 
-	leds_on(LED_LOCK);
+	uart_inhibit(&vt->uart, SPECIAL_KBD_LOCKED_ACK);
+	mirror_leds(vt);
 
-	uart_write_byte(SPECIAL_KBD_LOCKED_ACK);
-	uart_flush();
-	uart_lock();
+	/* The ack has left the TX buffer and nothing follows it. */
+	latency_stats_add(&vt->inhibit_latency, k_uptime_ticks() - event->time);
+	VTBT_TRACE("inhibit", event->buf[0], 0);
 }
 
 #define SYS_DLIST_PEEK_TAIL_CONTAINER(__dl, __cn, __n) \
@@ -109,150 +197,153 @@ inhibit_keyboard_transmission(const struct event *event)
 	     __cn = SYS_DLIST_PEEK_PREV_CONTAINER(__dl, __cn, __n))
 
 static void
-resume_keyboard_transmission(const struct event *event)
+resume_keyboard_transmission(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
-	leds_off(LED_LOCK);
+	leds_off(&vt->leds, LED_LOCK);
+	mirror_leds(vt);
 
-	uart_unlock();
-	if (uart_overflow_get()) {
-		uart_write_byte(SPECIAL_OUTPUT_ERROR);
+	uart_unlock(&vt->uart);
+	if (uart_overflow_get(&vt->uart)) {
+		uart_write_byte(&vt->uart, SPECIAL_OUTPUT_ERROR);
 	}
 
 	/* Send unsent key down in reverse order */
 	struct key_down *cn;
-	SYS_DLIST_FOR_EACH_CONTAINER_REVERSE(&keys_down, cn, node) {
+	SYS_DLIST_FOR_EACH_CONTAINER_REVERSE(&vt->keys_down, cn, node) {
 		if (cn->sent) {
 			continue;
 		}
 
-		uart_write_byte(cn->keycode);
+		uart_write_byte(&vt->uart, cn->keycode);
 		cn->sent = true;
 	}
 
-	metronome_resend();
+	metronome_resend(&vt->metronome);
 }
 
 /* INDICATORS */
 
 static void
-light_leds(const struct event *event)
+light_leds(struct vtbt *vt, const struct event *event)
 {
 	if (event->size != 2) {
-		uart_write_byte(SPECIAL_INPUT_ERROR);
-		metronome_resend();
+		uart_write_byte(&vt->uart, SPECIAL_INPUT_ERROR);
+		metronome_resend(&vt->metronome);
 		return;
 	}
 
 	for (int i = 0; i < 4; i++) {
 		if (event->buf[1] & (1 << i)) {
-			leds_on(i);
+			leds_on(&vt->leds, i);
 		}
 	}
+	mirror_leds(vt);
 }
 
 static void
-turn_off_leds(const struct event *event)
+turn_off_leds(struct vtbt *vt, const struct event *event)
 {
 	if (event->size != 2) {
-		uart_write_byte(SPECIAL_INPUT_ERROR);
-		metronome_resend();
+		uart_write_byte(&vt->uart, SPECIAL_INPUT_ERROR);
+		metronome_resend(&vt->metronome);
 		return;
 	}
 
 	for (int i = 0; i < 4; i++) {
 		if (event->buf[1] & (1 << i)) {
-			leds_off(i);
+			leds_off(&vt->leds, i);
 		}
 	}
+	mirror_leds(vt);
 }
 
 /* AUDIO */
 
 static void
-disable_keyclick(const struct event *event)
+disable_keyclick(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
-	beeper_set_keyclick_volume(-1);
+	beeper_set_keyclick_volume(&vt->beeper, -1);
 }
 
 static void
-enable_keyclick_set_volume(const struct event *event)
+enable_keyclick_set_volume(struct vtbt *vt, const struct event *event)
 {
 	if (event->size != 2) {
-		uart_write_byte(SPECIAL_INPUT_ERROR);
-		metronome_resend();
+		uart_write_byte(&vt->uart, SPECIAL_INPUT_ERROR);
+		metronome_resend(&vt->metronome);
 		return;
 	}
 
-	beeper_set_keyclick_volume(event->buf[1] & 0x07);
+	beeper_set_keyclick_volume(&vt->beeper, event->buf[1] & 0x07);
 }
 
 static void
-disable_ctrl_keyclick(const struct event *event)
+disable_ctrl_keyclick(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
-	keyboard_ctrl_keyclick_disable();
+	keyboard_ctrl_keyclick_disable(&vt->keyboard);
 }
 
 static void
-enable_ctrl_keyclick(const struct event *event)
+enable_ctrl_keyclick(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
-	keyboard_ctrl_keyclick_enable();
+	keyboard_ctrl_keyclick_enable(&vt->keyboard);
 }
 
 static void
-sound_keyclick(const struct event *event)
+sound_keyclick(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
-	beeper_sound_keyclick();
+	beeper_sound_keyclick(&vt->beeper);
 }
 
 static void
-disable_bell(const struct event *event)
+disable_bell(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
-	beeper_set_bell_volume(-1);
+	beeper_set_bell_volume(&vt->beeper, -1);
 }
 
 static void
-enable_bell_set_volume(const struct event *event)
+enable_bell_set_volume(struct vtbt *vt, const struct event *event)
 {
 	if (event->size != 2) {
-		uart_write_byte(SPECIAL_INPUT_ERROR);
-		metronome_resend();
+		uart_write_byte(&vt->uart, SPECIAL_INPUT_ERROR);
+		metronome_resend(&vt->metronome);
 		return;
 	}
 
-	beeper_set_bell_volume(event->buf[1] & 0x07);
+	beeper_set_bell_volume(&vt->beeper, event->buf[1] & 0x07);
 }
 
 static void
-sound_bell(const struct event *event)
+sound_bell(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
-	beeper_sound_bell();
+	beeper_sound_bell(&vt->beeper);
 }
 
 /* AUTO-REPEAT */
 
 static void
-temporary_auto_repeat_inhibit(const struct event *event)
+temporary_auto_repeat_inhibit(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
 	struct key_down *cn;
-	SYS_DLIST_FOR_EACH_CONTAINER(&keys_down, cn, node) {
+	SYS_DLIST_FOR_EACH_CONTAINER(&vt->keys_down, cn, node) {
 		struct division *division =
-			lk201_division_get_from_keycode(cn->keycode);
+			lk201_division_get_from_keycode(&vt->lk201, cn->keycode);
 		if (division == NULL) {
 			continue;
 		} else if (cn->inhibit_auto_repeat == true) {
@@ -265,33 +356,33 @@ temporary_auto_repeat_inhibit(const struct event *event)
 }
 
 static void
-enable_auto_repeat_across_keyboard(const struct event *event)
+enable_auto_repeat_across_keyboard(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
-	metronome_auto_repeat_enable();
+	metronome_auto_repeat_enable(&vt->metronome);
 }
 
 static void
-disable_auto_repeat_across_keyboard(const struct event *event)
+disable_auto_repeat_across_keyboard(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
-	metronome_auto_repeat_disable();
+	metronome_auto_repeat_disable(&vt->metronome);
 }
 
 static void
-change_all_auto_repeat_to_down_only(const struct event *event)
+change_all_auto_repeat_to_down_only(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
-	lk201_change_all_auto_repeat_to_down_only();
+	lk201_change_all_auto_repeat_to_down_only(&vt->lk201);
 }
 
 /* OTHER */
 
 static void
-request_keyboard_id(const struct event *event)
+request_keyboard_id(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
@@ -299,239 +390,356 @@ request_keyboard_id(const struct event *event)
 		SPECIAL_KEYBOARD_ID_FIRMWARE,
 		SPECIAL_KEYBOARD_ID_HARDWARE,
 	};
-	uart_write(keyboard_id, sizeof(keyboard_id));
+	uart_write(&vt->uart, keyboard_id, sizeof(keyboard_id));
 }
 
 static void
-jump_to_power_up(const struct event *event)
+jump_to_power_up(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
-	init_defaults();
-	send_power_on_test_result();
+	init_defaults(vt);
+	send_power_on_test_result(vt);
 }
 
 static void
-jump_to_test_mode(const struct event *event)
+jump_to_test_mode(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
-	test_mode = true;
+	vt->test_mode = true;
 
-	uart_write_byte(SPECIAL_TEST_MODE_ACK);
+	uart_write_byte(&vt->uart, SPECIAL_TEST_MODE_ACK);
 }
 
 static void
-reinstate_defaults(const struct event *event)
+reinstate_defaults(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
-	init_defaults();
+	init_defaults(vt);
 }
 
 static void
-test_mode_jump_to_power_up(const struct event *event)
+test_mode_jump_to_power_up(struct vtbt *vt, const struct event *event)
 {
 	ARG_UNUSED(event);
 
-	init_defaults();
-	send_power_on_test_result();
+	init_defaults(vt);
+	send_power_on_test_result(vt);
 }
 
 static void
-peripheral_command(const struct event *event)
+peripheral_command(struct vtbt *vt, const struct event *event)
 {
 	switch (event->buf[0]) {
 		/* FLOW CONTROL */
 		case COMMAND_RESUME_KEYBOARD_TRANSMISSION:
-			resume_keyboard_transmission(event);
+			resume_keyboard_transmission(vt, event);
 			break;
 		case COMMAND_INHIBIT_KEYBOARD_TRANSMISSION:
-			inhibit_keyboard_transmission(event);
+			/* Handled in host_event(). */
 			break;
 		/* INDICATORS */
 		case COMMAND_TURN_OFF_LEDS:
-			turn_off_leds(event);
+			turn_off_leds(vt, event);
 			break;
 		case COMMAND_LIGHT_LEDS:
-			light_leds(event);
+			light_leds(vt, event);
 			break;
 		/* AUDIO */
 		case COMMAND_DISABLE_KEYCLICK:
-			disable_keyclick(event);
+			disable_keyclick(vt, event);
 			break;
 		case COMMAND_ENABLE_KEYCLICK_SET_VOLUME:
-			enable_keyclick_set_volume(event);
+			enable_keyclick_set_volume(vt, event);
 			break;
 		case COMMAND_DISABLE_CTRL_KEYCLICK:
-			disable_ctrl_keyclick(event);
+			disable_ctrl_keyclick(vt, event);
 			break;
 		case COMMAND_ENABLE_CTRL_KEYCLICK:
-			enable_ctrl_keyclick(event);
+			enable_ctrl_keyclick(vt, event);
 			break;
 		case COMMAND_SOUND_KEYCLICK:
-			sound_keyclick(event);
+			sound_keyclick(vt, event);
 			break;
 		case COMMAND_DISABLE_BELL:
-			disable_bell(event);
+			disable_bell(vt, event);
 			break;
 		case COMMAND_ENABLE_BELL_SET_VOLUME:
-			enable_bell_set_volume(event);
+			enable_bell_set_volume(vt, event);
 			break;
 		case COMMAND_SOUND_BELL:
-			sound_bell(event);
+			sound_bell(vt, event);
 			break;
 		/* AUTO-REPEAT */
 		case COMMAND_TEMPORARY_AUTO_REPEAT_INHIBIT:
-			temporary_auto_repeat_inhibit(event);
+			temporary_auto_repeat_inhibit(vt, event);
 			break;
 		case COMMAND_ENABLE_AUTO_REPEAT_ACROSS_KEYBOARD:
-			enable_auto_repeat_across_keyboard(event);
+			enable_auto_repeat_across_keyboard(vt, event);
 			break;
 		case COMMAND_DISABLE_AUTO_REPEAT_ACROSS_KEYBOARD:
-			disable_auto_repeat_across_keyboard(event);
+			disable_auto_repeat_across_keyboard(vt, event);
 			break;
 		case COMMAND_CHANGE_ALL_AUTO_REPEAT_TO_DOWN_ONLY:
-			change_all_auto_repeat_to_down_only(event);
+			change_all_auto_repeat_to_down_only(vt, event);
 			break;
 		/* OTHER */
 		case COMMAND_REQUEST_KEYBOARD_ID:
-			request_keyboard_id(event);
+			request_keyboard_id(vt, event);
 			break;
 		case COMMAND_JUMP_TO_POWER_UP:
-			jump_to_power_up(event);
+			jump_to_power_up(vt, event);
 			break;
 		case COMMAND_JUMP_TO_TEST_MODE:
-			jump_to_test_mode(event);
+			jump_to_test_mode(vt, event);
 			break;
 		case COMMAND_REINSTATE_DEFAULTS:
-			reinstate_defaults(event);
+			reinstate_defaults(vt, event);
 			break;
 		default:
-			uart_write_byte(SPECIAL_INPUT_ERROR);
+			uart_write_byte(&vt->uart, SPECIAL_INPUT_ERROR);
 			break;
 	}
 }
 
 static void
-transmission_command(const struct event *event)
+transmission_command(struct vtbt *vt, const struct event *event)
 {
 	int division = (event->buf[0] >> 3) & 0x0f;
 	if (division == 0x0f) {
 		if (event->size != 3) {
-			uart_write_byte(SPECIAL_INPUT_ERROR);
-			metronome_resend();
+			uart_write_byte(&vt->uart, SPECIAL_INPUT_ERROR);
+			metronome_resend(&vt->metronome);
 			return;
 		}
 		int buffer = (event->buf[0] >> 1) & 0x03;
 		int timeout = ((event->buf[1]) & 0x7f) * 5;
-		int interval = 1000 / ((event->buf[2]) & 0x7f);
-		lk201_repeat_buffer_get(buffer)->timeout = timeout;
-		lk201_repeat_buffer_get(buffer)->interval = interval;
+		int rate = (event->buf[2]) & 0x7f;
+		if (rate == 0) {
+			uart_write_byte(&vt->uart, SPECIAL_INPUT_ERROR);
+			metronome_resend(&vt->metronome);
+			return;
+		}
+		lk201_repeat_buffer_get(&vt->lk201, buffer)->timeout = timeout;
+		lk201_repeat_buffer_get(&vt->lk201, buffer)->rate = rate;
 	} else if (division == 0x00) {
-		uart_write_byte(SPECIAL_INPUT_ERROR);
-		metronome_resend();
+		uart_write_byte(&vt->uart, SPECIAL_INPUT_ERROR);
+		metronome_resend(&vt->metronome);
 		return;
 	} else {
 		int mode = ((event->buf[0]) >> 1) & 0x03;
-		lk201_division_get(division-1)->mode = mode;
+		lk201_division_get(&vt->lk201, division-1)->mode = mode;
 		if (mode == MODE_AUTO_REPEAT) {
 			if (event->size == 2) {
 				int buffer = event->buf[1] & 0x7f;
-				lk201_division_get(division-1)->buffer = buffer;
+				lk201_division_get(&vt->lk201, division-1)->buffer = buffer;
 			} else {
 				/* Default buffer? */
-				lk201_division_get(division-1)->buffer = 0;
+				lk201_division_get(&vt->lk201, division-1)->buffer = 0;
 			}
 		}
 
-		uart_write_byte(SPECIAL_MODE_CHANGE_ACK);
-		metronome_resend();
+		uart_write_byte(&vt->uart, SPECIAL_MODE_CHANGE_ACK);
+		metronome_resend(&vt->metronome);
 	}
 }
 
 static void
-host_event(const struct event *event)
+host_event(struct vtbt *vt, const struct event *event)
 {
 	if (event->size == 0) {
 		return;
 	}
 
-	if (test_mode) {
+	/* Inhibiting transmission only touches the UART and the LEDs, so it
+	 * doesn't wait for the event thread to let go of the instance. Only
+	 * this thread changes test_mode. */
+	if (!vt->test_mode &&
+	    event->buf[0] == COMMAND_INHIBIT_KEYBOARD_TRANSMISSION) {
+		inhibit_keyboard_transmission(vt, event);
+	}
+
+	k_mutex_lock(&vt->lock, K_FOREVER);
+
+	if (vt->test_mode) {
 		if (event->buf[0] == TEST_MODE_COMMAND_JUMP_TO_POWER_UP) {
-			test_mode_jump_to_power_up(event);
+			test_mode_jump_to_power_up(vt, event);
 		}
 	} else {
 		if (event->buf[0] & 0x01) {
-			peripheral_command(event);
+			peripheral_command(vt, event);
 		} else {
-			transmission_command(event);
+			transmission_command(vt, event);
 		}
 	}
+
+	if (IS_ENABLED(CONFIG_VTBT_WARM_BOOT)) {
+		retained_save(vt);
+	}
+
+	k_mutex_unlock(&vt->lock);
 }
 
-static void
-handle_events(void)
+static VTBT_IRAM_ATTR void
+handle_host_events(void *p1, void *p2, void *p3)
+{
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	struct vtbt *vt = p1;
+	struct event event;
+
+	while (k_msgq_get(&vt->host_msgq, &event, K_FOREVER) == 0) {
+		VTBT_TRACE("event_begin", event.source,
+		           k_msgq_num_used_get(&vt->host_msgq));
+		host_event(vt, &event);
+		VTBT_TRACE("event_end", event.source, 0);
+	}
+}
+
+static VTBT_IRAM_ATTR void
+handle_events(void *p1, void *p2, void *p3)
 {
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	struct vtbt *vt = p1;
 	struct event event;
 
-	while (k_msgq_get(&msgq, &event, K_FOREVER) == 0) {
+	while (k_msgq_get(&vt->msgq, &event, K_FOREVER) == 0) {
+		VTBT_TRACE("event_begin", event.source,
+		           k_msgq_num_used_get(&vt->msgq));
+		k_mutex_lock(&vt->lock, K_FOREVER);
 		switch (event.source) {
-			case EVT_HOST:
-				host_event(&event);
-				break;
 			case EVT_METRONOME:
-				metronome_event(&keys_down, &event);
+				metronome_event(vt, &event);
 				break;
 			case EVT_KEYBOARD:
-				keyboard_event(&keys_down, &event);
+				/* A report from a keyboard that reconnected
+				 * after a link loss that got lost itself. */
+				if (atomic_clear(&vt->link_lost_pending)) {
+					keyboard_release_all(vt, event.time);
+				}
+				keyboard_event(vt, &event);
+				break;
+			case EVT_LINK_LOST:
+				atomic_clear(&vt->link_lost_pending);
+				keyboard_release_all(vt, event.time);
 				break;
 			default:
 				break;
 		}
+		k_mutex_unlock(&vt->lock);
+		VTBT_TRACE("event_end", event.source, 0);
 	}
 }
 
-int
-main(void)
+static int
+vtbt_start(struct vtbt *vt)
 {
 	int ret;
 
-	sys_dlist_init(&keys_down);
-
-	init_defaults();
-
-	leds_init();
-	beeper_init();
-
-	for (int i = 0; i < NUM_REPEAT_BUFFERS; i++) {
-		lk201_repeat_buffer_get(i)->timeout = 300;
-		lk201_repeat_buffer_get(i)->interval = 30;
+	sys_dlist_init(&vt->keys_down);
+	k_mutex_init(&vt->lock);
+	k_msgq_init(&vt->host_msgq, (char *)vt->host_msgq_buf,
+	            sizeof(struct event), HOST_QUEUE_SIZE);
+	k_msgq_init(&vt->msgq, (char *)vt->msgq_buf, sizeof(struct event),
+	            EVENT_QUEUE_SIZE);
+	vt->metronome_evt.source = EVT_METRONOME;
+	vt->hid_evt.source = EVT_KEYBOARD;
+	vt->hid_evt.size = HID_REPORT_SIZE;
+	vt->host_evt.source = EVT_HOST;
+	k_timer_init(&vt->metronome_timer, metronome, NULL);
+	k_timer_user_data_set(&vt->metronome_timer, vt);
+
+	VTBT_TRACE_OBJECT("host_msgq", &vt->host_msgq);
+	VTBT_TRACE_OBJECT("msgq", &vt->msgq);
+	VTBT_TRACE_OBJECT("instance_lock", &vt->lock);
+
+	leds_init(&vt->leds);
+	beeper_init(&vt->beeper);
+	metronome_init(&vt->metronome);
+
+	bool warm_boot = IS_ENABLED(CONFIG_VTBT_WARM_BOOT) &&
+	                 retained_restore(vt);
+	if (!warm_boot) {
+		init_defaults(vt);
+
+		for (int i = 0; i < NUM_REPEAT_BUFFERS; i++) {
+			lk201_repeat_buffer_get(&vt->lk201, i)->timeout = 300;
+			lk201_repeat_buffer_get(&vt->lk201, i)->rate = 33;
+		}
 	}
 
-	ret = uart_init();
+	ret = uart_init(&vt->uart);
 	if (ret < 0) {
 		LOG_ERR("UART init failed: %d", ret);
 		return -1;
 	}
 
-	ret = uart_set_rx_callback(uart_callback);
+	ret = uart_set_rx_callback(&vt->uart, uart_callback, vt);
 	if (ret < 0) {
 		LOG_ERR("UART set rx callback failed: %d", ret);
 		return -1;
 	}
 
-	send_power_on_test_result();
-	uart_write_byte(SPECIAL_INPUT_ERROR);
-	uart_write_byte(SPECIAL_MODE_CHANGE_ACK);
+	/* After a warm reset the terminal doesn't know the keyboard rebooted,
+	 * so it isn't expecting a power-up test result. */
+	if (!warm_boot) {
+		send_power_on_test_result(vt);
+		uart_write_byte(&vt->uart, SPECIAL_INPUT_ERROR);
+		uart_write_byte(&vt->uart, SPECIAL_MODE_CHANGE_ACK);
+	}
 
-	k_timer_start(&metronome_timer, K_MSEC(1), K_MSEC(1));
+	k_timer_start(&vt->metronome_timer, K_MSEC(1), K_MSEC(1));
+
+	char name[16];
+	k_tid_t tid = k_thread_create(&host_threads[vt->id],
+	                              host_thread_stacks[vt->id],
+	                              K_THREAD_STACK_SIZEOF(
+	                                      host_thread_stacks[vt->id]),
+	                              handle_host_events, vt, NULL, NULL,
+	                              HOST_THREAD_PRIORITY, 0, K_NO_WAIT);
+	snprintk(name, sizeof(name), "vt%d_host", vt->id);
+	k_thread_name_set(tid, name);
+
+	tid = k_thread_create(&event_threads[vt->id],
+	                      event_thread_stacks[vt->id],
+	                      K_THREAD_STACK_SIZEOF(event_thread_stacks[vt->id]),
+	                      handle_events, vt, NULL, NULL,
+	                      EVENT_THREAD_PRIORITY, 0, K_NO_WAIT);
+	snprintk(name, sizeof(name), "vt%d", vt->id);
+	k_thread_name_set(tid, name);
+
+	return 0;
+}
 
-	ret = bluetooth_listen(hid_report_cb);
-	if (ret < 0) {
-		LOG_ERR("Bluetooth listening failed");
-		return -1;
+int
+main(void)
+{
+	int ret;
+
+	for (int i = 0; i < NUM_VT_PORTS; i++) {
+		struct vtbt *vt = &vtbt_instances[i];
+
+		ret = vtbt_start(vt);
+		if (ret < 0) {
+			LOG_ERR("Starting vt%d failed", i);
+			continue;
+		}
+
+		/* There is only one Bluetooth keyboard. */
+		if (vt->source == KEYBOARD_SOURCE_BLUETOOTH &&
+		    bluetooth_vt == NULL) {
+			bluetooth_vt = vt;
+			/* LEDs restored on a warm boot. */
+			mirror_leds(vt);
+		}
+
+		input_start(vt, hid_report_cb, link_lost_cb, vt);
 	}
 
-	handle_events();
+	return 0;
 }
@@ -0,0 +1,44 @@
+/* Periodic report of how full the statically sized queues and buffers have
+ * ever been, for sizing them with overlay-low-memory.conf. Peak stack use is
+ * reported separately by the thread analyzer. */
+
+#include <zephyr/kernel.h>
+
+#include "instance.h"
+#include "keyboard.h"
+#include "uart.h"
+
+static void
+report_work_handler(struct k_work *work)
+{
+	for (int i = 0; i < NUM_VT_PORTS; i++) {
+		struct vtbt *vt = &vtbt_instances[i];
+
+		printk("vt%d: host queue max %ld/%d, event queue max %ld/%d, "
+		       "%ld events dropped, journal max %u, "
+		       "%u link loss releases\n", i,
+		       atomic_get(&vt->host_msgq_max), HOST_QUEUE_SIZE,
+		       atomic_get(&vt->msgq_max), EVENT_QUEUE_SIZE,
+		       atomic_get(&vt->events_dropped),
+		       uart_journal_depth_max_get(&vt->uart),
+		       vt->keyboard.link_loss_releases);
+	}
+	printk("keys down max %u/%u\n", keyboard_keys_down_max_get(),
+	       keyboard_keys_down_total_get());
+
+	k_work_schedule(k_work_delayable_from_work(work),
+	                K_SECONDS(CONFIG_VTBT_MEMORY_REPORT_INTERVAL));
+}
+
+K_WORK_DELAYABLE_DEFINE(report_work, report_work_handler);
+
+static int
+memory_report_init(void)
+{
+	k_work_schedule(&report_work,
+	                K_SECONDS(CONFIG_VTBT_MEMORY_REPORT_INTERVAL));
+
+	return 0;
+}
+
+SYS_INIT(memory_report_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
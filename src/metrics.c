@@ -0,0 +1,82 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+
+#include "metrics.h"
+#include "iram.h"
+
+LOG_MODULE_REGISTER(metrics, CONFIG_LOG_DEFAULT_LEVEL);
+
+static const char *const boot_phase_names[NUM_BOOT_PHASES] = {
+	[BOOT_PHASE_FIRST_TX] = "first TX byte",
+	[BOOT_PHASE_SCAN_START] = "scan start",
+	[BOOT_PHASE_FIRST_REPORT] = "first HID report",
+};
+
+static ATOMIC_DEFINE(boot_phases_marked, NUM_BOOT_PHASES);
+static int64_t boot_phase_times[NUM_BOOT_PHASES];
+
+VTBT_IRAM_ATTR void
+metrics_boot_phase_mark(enum boot_phase phase)
+{
+	if (atomic_test_and_set_bit(boot_phases_marked, phase)) {
+		return;
+	}
+
+	boot_phase_times[phase] = k_ticks_to_us_floor64(k_uptime_ticks());
+
+	LOG_INF("Boot: %s at %lld us", boot_phase_names[phase],
+	        boot_phase_times[phase]);
+}
+
+int64_t
+metrics_boot_phase_get(enum boot_phase phase)
+{
+	if (!atomic_test_bit(boot_phases_marked, phase)) {
+		return -1;
+	}
+
+	return boot_phase_times[phase];
+}
+
+VTBT_IRAM_ATTR void
+metrics_high_water_mark(atomic_t *mark, atomic_val_t value)
+{
+	atomic_val_t old;
+
+	do {
+		old = atomic_get(mark);
+		if (value <= old) {
+			return;
+		}
+	} while (!atomic_cas(mark, old, value));
+}
+
+VTBT_IRAM_ATTR void
+latency_stats_add(struct latency_stats *stats, int64_t ticks)
+{
+	uint32_t us = (uint32_t)k_ticks_to_us_floor64(ticks);
+
+	stats->count++;
+	stats->total_us += us;
+	if (us > stats->max_us) {
+		stats->max_us = us;
+	}
+
+	int bucket = 0;
+	while ((bucket < LATENCY_HISTOGRAM_BUCKETS - 1) &&
+	       (us >= (LATENCY_HISTOGRAM_BASE_US << bucket))) {
+		bucket++;
+	}
+	stats->histogram[bucket]++;
+}
+
+uint32_t
+latency_stats_avg_us(const struct latency_stats *stats)
+{
+	if (stats->count == 0) {
+		return 0;
+	}
+
+	return (uint32_t)(stats->total_us / stats->count);
+}
@@ -0,0 +1,45 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#include <zephyr/sys/atomic.h>
+
+/* Milestones during boot, timed from kernel start. */
+enum boot_phase {
+	BOOT_PHASE_FIRST_TX,     /* First byte handed to the VT UART. */
+	BOOT_PHASE_SCAN_START,   /* Bluetooth scanning started. */
+	BOOT_PHASE_FIRST_REPORT, /* First HID report received. */
+	NUM_BOOT_PHASES,
+};
+
+/* Bucket i of a latency histogram counts latencies below
+ * LATENCY_HISTOGRAM_BASE_US << i; the last bucket counts the rest. */
+#define LATENCY_HISTOGRAM_BUCKETS 8
+#define LATENCY_HISTOGRAM_BASE_US 250U
+
+/* Running statistics for a latency. */
+struct latency_stats {
+	uint32_t count;
+	uint32_t max_us;
+	uint64_t total_us;
+	uint32_t histogram[LATENCY_HISTOGRAM_BUCKETS];
+};
+
+/* Record the time at which a boot phase was reached. Only the first call for
+ * each phase has an effect. Safe to call from an ISR. */
+void metrics_boot_phase_mark(enum boot_phase phase);
+/* Returns the microseconds from kernel start to the boot phase, or -1 if the
+ * phase hasn't been reached yet. Read by the telemetry service. */
+int64_t metrics_boot_phase_get(enum boot_phase phase);
+
+/* Raise a high-water mark to value if it's higher. Safe to call from an
+ * ISR. */
+void metrics_high_water_mark(atomic_t *mark, atomic_val_t value);
+
+/* Add a latency measured in ticks. */
+void latency_stats_add(struct latency_stats *stats, int64_t ticks);
+/* Returns the average latency in microseconds, or 0 if there are none. */
+uint32_t latency_stats_avg_us(const struct latency_stats *stats);
+
+#endif /* METRICS_H */
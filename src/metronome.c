@@ -3,48 +3,130 @@
 #include "metronome.h"
 
 #include "vtbt.h"
+#include "instance.h"
 #include "lk201.h"
 #include "uart.h"
 #include "beeper.h"
+#include "repeat_profile.h"
+#include "key_stats.h"
+#include "trace.h"
+#include "iram.h"
 
-static bool auto_repeat_enabled = true;
+/* Deadlines more than this far in the past are abandoned rather than caught
+ * up on, e.g. after transmission was inhibited. */
+#define MAX_LAG_MS 100
 
-static int repeating_keycode = 0;
-/* The k_uptime_get() timestamp when the next metronome should be sent. */
-static int repeating_next = 0;
-/* Set when a keycode has been transmitted while handling another event, so the
- * keycode of a repeating key needs to be resent before resuming metronomes. */
-static bool resend = false;
+/* Advance the deadline by one metronome interval. Intervals are whole ticks,
+ * with the remainder of ticks per second / rate accumulated so that exactly
+ * rate deadlines fall in every second. */
+static VTBT_IRAM_ATTR void
+advance_deadline(struct metronome *metronome, int rate)
+{
+	const uint32_t ticks_per_sec = CONFIG_SYS_CLOCK_TICKS_PER_SEC;
+
+	/* An accelerating key changes rate; the remainder of the old rate is
+	 * dropped. */
+	if (rate != metronome->repeating_rate) {
+		metronome->repeating_rate = rate;
+		metronome->repeating_frac = 0;
+	}
+
+	metronome->repeating_next += ticks_per_sec / rate;
+	metronome->repeating_frac += ticks_per_sec % rate;
+	if (metronome->repeating_frac >= (uint32_t)rate) {
+		metronome->repeating_frac -= rate;
+		metronome->repeating_next++;
+	}
+}
+
+/* The terminal's repeat rate, or the local profile's for a key that has been
+ * repeating since repeating_since. */
+static VTBT_IRAM_ATTR int
+repeat_rate(const struct metronome *metronome, int division,
+            const struct repeat_buffer *repeat_buffer, int64_t now)
+{
+	if (!IS_ENABLED(CONFIG_VTBT_REPEAT_PROFILE)) {
+		return repeat_buffer->rate;
+	}
+
+	return repeat_profile_rate(division, repeat_buffer,
+	                           k_ticks_to_ms_floor64(
+	                                   now - metronome->repeating_since));
+}
+
+/* Send a metronome code or the keycode of the repeating key, keycode, for the
+ * event at time now. They are dropped while the line is busy, so that key
+ * transitions don't wait behind them. Returns true if the code was sent. */
+static VTBT_IRAM_ATTR bool
+send_repeat(struct vtbt *vt, int keycode, int code, int64_t now)
+{
+	if (!vt->metronome.auto_repeat_enabled) {
+		return false;
+	}
+
+	int sent = uart_write_metronome(&vt->uart, code);
+	VTBT_TRACE("metronome", code, sent);
+	if (sent > 0) {
+		beeper_sound_keyclick(&vt->beeper);
+		if (IS_ENABLED(CONFIG_VTBT_KEY_STATS)) {
+			key_stats_repeat(keycode, now);
+		}
+	}
+
+	return sent > 0;
+}
 
 void
-metronome_resend(void)
+metronome_init(struct metronome *metronome)
 {
-	resend = true;
+	metronome->auto_repeat_enabled = true;
+	metronome->repeating_keycode = 0;
+	metronome->resend = false;
 }
 
 void
-metronome_auto_repeat_enable(void)
+metronome_resend(struct metronome *metronome)
 {
-	auto_repeat_enabled = true;
+	metronome->resend = true;
 }
 
 void
-metronome_auto_repeat_disable(void)
+metronome_auto_repeat_enable(struct metronome *metronome)
 {
-	auto_repeat_enabled = false;
+	metronome->auto_repeat_enabled = true;
 }
 
 void
-metronome_event(const sys_dlist_t *keys_down, const struct event *event)
+metronome_auto_repeat_disable(struct metronome *metronome)
+{
+	metronome->auto_repeat_enabled = false;
+}
+
+bool
+metronome_auto_repeat_get(struct metronome *metronome)
+{
+	return metronome->auto_repeat_enabled;
+}
+
+VTBT_IRAM_ATTR void
+metronome_event(struct vtbt *vt, const struct event *event)
 {
-	ARG_UNUSED(event);
+	struct metronome *metronome = &vt->metronome;
+
+	/* Metronome codes aren't worth journaling while the terminal inhibits
+	 * transmission. The repeating keycode is resent after it resumes. */
+	if (IS_ENABLED(CONFIG_VTBT_TYPEAHEAD_JOURNAL) &&
+	    uart_locked_get(&vt->uart)) {
+		return;
+	}
 
 	/* Get the most auto-repeat-capable down key. */
 	struct key_down *repeating = NULL;
 	struct division *division = NULL;
 	struct key_down *cn;
-	SYS_DLIST_FOR_EACH_CONTAINER((sys_dlist_t *)keys_down, cn, node) {
-		division = lk201_division_get_from_keycode(cn->keycode);
+	SYS_DLIST_FOR_EACH_CONTAINER(&vt->keys_down, cn, node) {
+		division = lk201_division_get_from_keycode(&vt->lk201,
+		                                           cn->keycode);
 		if (division == NULL) {
 			continue;
 		} else if (cn->inhibit_auto_repeat) {
@@ -56,66 +138,70 @@ metronome_event(const sys_dlist_t *keys_down, const struct event *event)
 	}
 
 	if (repeating == NULL) {
-		repeating_keycode = 0;
-		resend = false;
+		metronome->repeating_keycode = 0;
+		metronome->resend = false;
 		return;
 	}
 
-	int64_t now = k_uptime_get();
+	int64_t now = event->time;
+	struct repeat_buffer *repeat_buffer =
+		lk201_repeat_buffer_get(&vt->lk201, division->buffer);
+	int division_id = division - vt->lk201.divisions;
+	int timeout = repeat_buffer->timeout;
+
+	if (IS_ENABLED(CONFIG_VTBT_REPEAT_PROFILE)) {
+		timeout = repeat_profile_timeout(division_id, repeat_buffer);
+	}
 
-	if (repeating_keycode != repeating->keycode) {
+	if (metronome->repeating_keycode != repeating->keycode) {
 		/* We're already repeating a different key. */
-		struct repeat_buffer *repeat_buffer = lk201_repeat_buffer_get(
-			division->buffer);
-		int timeout = repeat_buffer->timeout;
-		if ((now - repeating->time) > timeout) {
-			int interval = repeat_buffer->interval;
-
-			if (repeating->repeating && repeating_keycode != 0) {
-				if (auto_repeat_enabled) {
-					int sent = uart_write_byte(
-						repeating->keycode);
-					if (sent > 0) {
-						beeper_sound_keyclick();
-					}
-				}
+		int64_t deadline = repeating->time +
+			k_ms_to_ticks_ceil64(timeout);
+		if (now >= deadline) {
+			/* A dropped keycode is resent before the next
+			 * metronome code. */
+			bool resend = false;
+			if (repeating->repeating &&
+			    metronome->repeating_keycode != 0) {
+				resend = !send_repeat(vt, repeating->keycode,
+				                      repeating->keycode, now);
 			} else {
-				if (auto_repeat_enabled) {
-					int sent = uart_write_byte(
-						SPECIAL_METRONOME);
-					if (sent > 0) {
-						beeper_sound_keyclick();
-					}
-				}
+				send_repeat(vt, repeating->keycode,
+				            SPECIAL_METRONOME, now);
 			}
-			repeating_keycode = repeating->keycode;
-			repeating_next = now + interval;
-			resend = false;
+			/* A key that starts repeating is timed from its own
+			 * timeout. One that resumes repeating after another
+			 * key was released is timed from now. */
+			metronome->repeating_next =
+				repeating->repeating ? now : deadline;
+			metronome->repeating_since = metronome->repeating_next;
+			metronome->repeating_frac = 0;
+			advance_deadline(metronome,
+			                 repeat_rate(metronome, division_id,
+			                             repeat_buffer, now));
+			metronome->repeating_keycode = repeating->keycode;
+			metronome->resend = resend;
 			repeating->repeating = true;
 		}
 		return;
 	}
 
-	if ((repeating_next - now) < 0) {
-		struct repeat_buffer *repeat_buffer = lk201_repeat_buffer_get(
-			division->buffer);
-		int interval = repeat_buffer->interval;
-		repeating_next = now + interval;
-		if (resend) {
-			resend = false;
-			if (auto_repeat_enabled) {
-				int sent = uart_write_byte(repeating->keycode);
-				if (sent > 0) {
-					beeper_sound_keyclick();
-				}
-			}
+	if (now >= metronome->repeating_next) {
+		if ((now - metronome->repeating_next) >
+		    (int64_t)k_ms_to_ticks_ceil64(MAX_LAG_MS)) {
+			/* Don't try to catch up after a long stall. */
+			metronome->repeating_next = now;
+			metronome->repeating_frac = 0;
+		}
+		advance_deadline(metronome,
+		                 repeat_rate(metronome, division_id,
+		                             repeat_buffer, now));
+		if (metronome->resend) {
+			metronome->resend = !send_repeat(vt, repeating->keycode,
+			                                 repeating->keycode, now);
 		} else {
-			if (auto_repeat_enabled) {
-				int sent = uart_write_byte(SPECIAL_METRONOME);
-				if (sent > 0) {
-					beeper_sound_keyclick();
-				}
-			}
+			send_repeat(vt, repeating->keycode, SPECIAL_METRONOME,
+			            now);
 		}
 	}
 }
@@ -5,13 +5,36 @@
 
 #include "vtbt.h"
 
+struct vtbt;
+
+struct metronome {
+	bool auto_repeat_enabled;
+	int repeating_keycode;
+	/* The k_uptime_ticks() deadline when the next metronome should be
+	 * sent. */
+	int64_t repeating_next;
+	/* Fractional ticks carried over between deadlines, in units of 1/rate
+	 * ticks, and the rate they are in. */
+	uint32_t repeating_frac;
+	int repeating_rate;
+	/* The k_uptime_ticks() when the key started repeating. */
+	int64_t repeating_since;
+	/* Set when a keycode has been transmitted while handling another
+	 * event, so the keycode of a repeating key needs to be resent before
+	 * resuming metronomes. */
+	bool resend;
+};
+
+void metronome_init(struct metronome *metronome);
+
 /* Signals the auto-repeater that a keycode has been transmitted and that the
  * current auto-repeating keycode needs to be resent before resuming metronome
  * codes. */
-void metronome_resend(void);
+void metronome_resend(struct metronome *metronome);
 
-void metronome_auto_repeat_enable(void);
-void metronome_auto_repeat_disable(void);
-void metronome_event(const sys_dlist_t *, const struct event *);
+void metronome_auto_repeat_enable(struct metronome *metronome);
+void metronome_auto_repeat_disable(struct metronome *metronome);
+bool metronome_auto_repeat_get(struct metronome *metronome);
+void metronome_event(struct vtbt *vt, const struct event *event);
 
 #endif /* METRONOME_H */
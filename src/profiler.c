@@ -0,0 +1,192 @@
+/* Sampling profiler. A periodic timer records the program counter it
+ * interrupted in a fixed-size histogram. Every CONFIG_VTBT_PROFILER_INTERVAL
+ * seconds the histogram is printed and cleared, along with each thread's
+ * share of the CPU and the idle time since the previous report, from the
+ * kernel's thread runtime statistics. scripts/profile.py symbolizes the
+ * printed samples against the ELF into a flat profile.
+ *
+ * The interrupted program counter is only available on RISC-V (the
+ * ESP32-C3), where the timer runs inside the trap handler and mepc still
+ * holds it. On native_sim, threads are host threads and there is none to
+ * sample, so only the thread statistics are reported. Time spent in interrupt
+ * handlers is counted against the thread they interrupted. */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#ifdef CONFIG_RISCV
+#include <zephyr/arch/riscv/csr.h>
+#endif
+
+#define PROFILER_SLOTS    CONFIG_VTBT_PROFILER_SLOTS
+#define PROFILER_PROBES   8
+#define PROFILER_THREADS  24
+
+BUILD_ASSERT((PROFILER_SLOTS & (PROFILER_SLOTS - 1)) == 0,
+             "Profiler slots must be a power of two");
+
+struct sample {
+	uintptr_t pc;
+	uint32_t count;
+};
+
+struct thread_usage {
+	k_tid_t thread;
+	uint64_t cycles;
+};
+
+static struct sample samples[PROFILER_SLOTS];
+static uint32_t samples_taken;
+/* Samples that found no free slot near their hash. */
+static uint32_t samples_lost;
+
+static struct thread_usage thread_usage[PROFILER_THREADS];
+static uint64_t all_cycles_last;
+static uint64_t idle_cycles_last;
+static uint64_t report_cycles;
+
+static struct k_timer sample_timer;
+
+static uintptr_t
+interrupted_pc(void)
+{
+#ifdef CONFIG_RISCV
+	return csr_read(mepc);
+#else
+	return 0;
+#endif
+}
+
+static void
+sample_expiry(struct k_timer *timer)
+{
+	ARG_UNUSED(timer);
+
+	uintptr_t pc = interrupted_pc();
+
+	samples_taken++;
+	if (pc == 0) {
+		return;
+	}
+
+	/* Instructions are at least 2 bytes apart. */
+	uint32_t hash = (uint32_t)(pc >> 1) * 2654435761u;
+
+	for (int i = 0; i < PROFILER_PROBES; i++) {
+		struct sample *sample =
+			&samples[(hash + i) & (PROFILER_SLOTS - 1)];
+
+		if (sample->pc == pc || sample->pc == 0) {
+			sample->pc = pc;
+			sample->count++;
+			return;
+		}
+	}
+	samples_lost++;
+}
+
+/* Returns the thread's cycles since the previous report. */
+static uint64_t
+thread_cycles_delta(k_tid_t thread, uint64_t cycles)
+{
+	struct thread_usage *free = NULL;
+
+	for (int i = 0; i < PROFILER_THREADS; i++) {
+		if (thread_usage[i].thread == thread) {
+			uint64_t delta = cycles - thread_usage[i].cycles;
+
+			thread_usage[i].cycles = cycles;
+			return delta;
+		} else if (thread_usage[i].thread == NULL && free == NULL) {
+			free = &thread_usage[i];
+		}
+	}
+
+	if (free != NULL) {
+		free->thread = thread;
+		free->cycles = cycles;
+	}
+
+	return cycles;
+}
+
+/* Prints a share of report_cycles as a percentage with one decimal. */
+static void
+print_share(const char *what, uint64_t cycles)
+{
+	uint32_t permille = report_cycles ? cycles * 1000 / report_cycles : 0;
+
+	printk("profile %s %u.%u%%\n", what, permille / 10, permille % 10);
+}
+
+static void
+print_thread(const struct k_thread *cthread, void *user_data)
+{
+	ARG_UNUSED(user_data);
+
+	struct k_thread *thread = (struct k_thread *)cthread;
+	k_thread_runtime_stats_t stats;
+	char name[32];
+
+	if (k_thread_runtime_stats_get(thread, &stats) != 0) {
+		return;
+	}
+
+	const char *thread_name = k_thread_name_get(thread);
+
+	if (thread_name == NULL || thread_name[0] == '\0') {
+		snprintk(name, sizeof(name), "thread %p", thread);
+	} else {
+		snprintk(name, sizeof(name), "thread %s", thread_name);
+	}
+	print_share(name, thread_cycles_delta(thread, stats.execution_cycles));
+}
+
+static void
+report_work_handler(struct k_work *work)
+{
+	k_thread_runtime_stats_t all;
+
+	/* Not sampling while the histogram is printed and cleared. */
+	k_timer_stop(&sample_timer);
+
+	k_thread_runtime_stats_all_get(&all);
+	report_cycles = all.execution_cycles - all_cycles_last;
+	all_cycles_last = all.execution_cycles;
+
+	printk("profile %u samples, %u lost\n", samples_taken, samples_lost);
+	print_share("idle", all.idle_cycles - idle_cycles_last);
+	idle_cycles_last = all.idle_cycles;
+	k_thread_foreach_unlocked(print_thread, NULL);
+
+	for (int i = 0; i < PROFILER_SLOTS; i++) {
+		if (samples[i].count > 0) {
+			printk("profile pc 0x%lx %u\n",
+			       (unsigned long)samples[i].pc, samples[i].count);
+		}
+	}
+	memset(samples, 0, sizeof(samples));
+	samples_taken = 0;
+	samples_lost = 0;
+
+	k_timer_start(&sample_timer, K_USEC(CONFIG_VTBT_PROFILER_PERIOD_US),
+	              K_USEC(CONFIG_VTBT_PROFILER_PERIOD_US));
+	k_work_schedule(k_work_delayable_from_work(work),
+	                K_SECONDS(CONFIG_VTBT_PROFILER_INTERVAL));
+}
+
+K_WORK_DELAYABLE_DEFINE(report_work, report_work_handler);
+
+static int
+profiler_init(void)
+{
+	k_timer_init(&sample_timer, sample_expiry, NULL);
+	k_timer_start(&sample_timer, K_USEC(CONFIG_VTBT_PROFILER_PERIOD_US),
+	              K_USEC(CONFIG_VTBT_PROFILER_PERIOD_US));
+	k_work_schedule(&report_work, K_SECONDS(CONFIG_VTBT_PROFILER_INTERVAL));
+
+	return 0;
+}
+
+SYS_INIT(profiler_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,198 @@
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+
+#include "repeat_profile.h"
+
+#include "background.h"
+#include "iram.h"
+
+LOG_MODULE_REGISTER(repeat_profile, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define REPEAT_PROFILE_SETTINGS_KEY "vtbt/repeat"
+
+struct repeat_profile {
+	bool enabled;
+	bool clamp;
+	struct repeat_override divisions[NUM_DIVISIONS];
+};
+
+/* Quicker typing and deleting, and cursor keys that speed up from 30 to 120
+ * codes per second over the first second of repeating. */
+static struct repeat_profile profile = {
+	.enabled = false,
+	.clamp = true,
+	.divisions = {
+		[DIVISION_MAIN_ARRAY] = { .timeout = 250, .rate = 40 },
+		[DIVISION_KEYPAD] = { .timeout = 250, .rate = 40 },
+		[DIVISION_DELETE] = { .timeout = 250, .rate = 40 },
+		[DIVISION_HORIZONTAL_CURSORS] = {
+			.timeout = 200, .rate = 30,
+			.rate_max = 120, .accel_ms = 1000,
+		},
+		[DIVISION_VERTICAL_CURSORS] = {
+			.timeout = 200, .rate = 30,
+			.rate_max = 120, .accel_ms = 1000,
+		},
+	},
+};
+
+/* Changes come from the event thread and the low-priority work queue, and the
+ * event thread reads the profile in between, so a division's override is
+ * always read and written whole under this lock. */
+static struct k_spinlock profile_lock;
+
+static int
+repeat_profile_settings_set(const char *name, size_t len,
+                            settings_read_cb read_cb, void *cb_arg)
+{
+	struct repeat_profile loaded;
+
+	if (len != sizeof(loaded) ||
+	    read_cb(cb_arg, &loaded, len) != (ssize_t)len) {
+		return -EINVAL;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&profile_lock);
+	profile = loaded;
+	k_spin_unlock(&profile_lock, key);
+
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(vtbt_repeat, REPEAT_PROFILE_SETTINGS_KEY, NULL,
+                               repeat_profile_settings_set, NULL, NULL);
+
+/* Flash writes are left to the low-priority work queue, away from the event
+ * thread that toggles the profile. */
+static void
+save_work_handler(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	k_spinlock_key_t key = k_spin_lock(&profile_lock);
+	struct repeat_profile saved = profile;
+	k_spin_unlock(&profile_lock, key);
+
+	int err = settings_save_one(REPEAT_PROFILE_SETTINGS_KEY, &saved,
+	                            sizeof(saved));
+	if (err) {
+		LOG_ERR("Saving repeat profile failed (err %d)", err);
+	}
+}
+
+static K_WORK_DEFINE(save_work, save_work_handler);
+
+bool
+repeat_profile_enabled(void)
+{
+	return profile.enabled;
+}
+
+void
+repeat_profile_enable(bool enabled, bool clamp)
+{
+	k_spinlock_key_t key = k_spin_lock(&profile_lock);
+	profile.enabled = enabled;
+	profile.clamp = clamp;
+	k_spin_unlock(&profile_lock, key);
+
+	k_work_submit_to_queue(&background_work_q, &save_work);
+
+	LOG_INF("Repeat profile %s%s", enabled ? "on" : "off",
+	        clamp ? ", clamping" : "");
+}
+
+bool
+repeat_profile_toggle(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&profile_lock);
+	bool enabled = !profile.enabled;
+	bool clamp = profile.clamp;
+	k_spin_unlock(&profile_lock, key);
+
+	repeat_profile_enable(enabled, clamp);
+
+	return enabled;
+}
+
+int
+repeat_profile_division_set(int division,
+                            const struct repeat_override *override)
+{
+	if (division < 0 || division >= NUM_DIVISIONS ||
+	    override->rate > REPEAT_PROFILE_RATE_MAX ||
+	    override->rate_max > REPEAT_PROFILE_RATE_MAX) {
+		return -1;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&profile_lock);
+	profile.divisions[division] = *override;
+	k_spin_unlock(&profile_lock, key);
+
+	k_work_submit_to_queue(&background_work_q, &save_work);
+
+	return 0;
+}
+
+/* Returns false if the profile is off, and otherwise a copy of a division's
+ * override and whether to clamp. */
+static VTBT_IRAM_ATTR bool
+override_get(int division, struct repeat_override *override, bool *clamp)
+{
+	k_spinlock_key_t key = k_spin_lock(&profile_lock);
+	bool enabled = profile.enabled;
+
+	*override = profile.divisions[division];
+	*clamp = profile.clamp;
+	k_spin_unlock(&profile_lock, key);
+
+	return enabled;
+}
+
+VTBT_IRAM_ATTR int
+repeat_profile_timeout(int division, const struct repeat_buffer *buffer)
+{
+	struct repeat_override override;
+	bool clamp;
+
+	if (!override_get(division, &override, &clamp) ||
+	    override.timeout == 0) {
+		return buffer->timeout;
+	} else if (clamp) {
+		return MIN(buffer->timeout, override.timeout);
+	}
+
+	return override.timeout;
+}
+
+VTBT_IRAM_ATTR int
+repeat_profile_rate(int division, const struct repeat_buffer *buffer,
+                    int64_t repeating_ms)
+{
+	struct repeat_override override;
+	bool clamp;
+	int rate;
+
+	if (!override_get(division, &override, &clamp) || override.rate == 0) {
+		return buffer->rate;
+	} else if (clamp) {
+		rate = MAX(buffer->rate, override.rate);
+	} else {
+		rate = override.rate;
+	}
+
+	/* Ramp up linearly to rate_max. */
+	if (override.rate_max > rate) {
+		if (repeating_ms >= override.accel_ms) {
+			rate = override.rate_max;
+		} else {
+			rate += (override.rate_max - rate) * repeating_ms /
+			        override.accel_ms;
+		}
+	}
+
+	return rate;
+}
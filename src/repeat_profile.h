@@ -0,0 +1,50 @@
+#ifndef REPEAT_PROFILE_H
+#define REPEAT_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lk201.h"
+
+/* Local auto-repeat timing that overrides the terminal's repeat buffers. The
+ * LK201 encoding limits the terminal to 127 codes per second and most hosts
+ * never change the slow defaults, while the line has room for much more. The
+ * profile sets a timeout and rate per division, and can speed repeating up
+ * the longer a key is held, e.g. for the cursor keys. It is kept in settings,
+ * off until turned on with Right Alt and R or from the telemetry service.
+ *
+ * When clamping, the profile only makes repeating faster than the terminal
+ * asked for; otherwise it replaces the terminal's timing. Divisions with
+ * zeroes keep the terminal's timing either way. */
+
+/* Half of a 4800 baud line, leaving room for other keys. */
+#define REPEAT_PROFILE_RATE_MAX 240
+
+struct repeat_override {
+	/* Milliseconds before auto-repeating, or 0. */
+	uint16_t timeout;
+	/* Metronome codes per second once repeating starts, or 0. */
+	uint16_t rate;
+	/* Codes per second reached after accel_ms of repeating, or 0 for a
+	 * steady rate. */
+	uint16_t rate_max;
+	uint16_t accel_ms;
+};
+
+bool repeat_profile_enabled(void);
+void repeat_profile_enable(bool enabled, bool clamp);
+/* Turn the profile on or off. Returns true if it is now on. */
+bool repeat_profile_toggle(void);
+/* Change a division's override. Returns -1 if it is out of range. */
+int repeat_profile_division_set(int division,
+                                const struct repeat_override *override);
+
+/* Timeout in milliseconds for a key in a division, given the terminal's
+ * repeat buffer for it. */
+int repeat_profile_timeout(int division, const struct repeat_buffer *buffer);
+/* Rate in codes per second for a key in a division that has been repeating
+ * for repeating_ms. */
+int repeat_profile_rate(int division, const struct repeat_buffer *buffer,
+                        int64_t repeating_ms);
+
+#endif /* REPEAT_PROFILE_H */
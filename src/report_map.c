@@ -0,0 +1,140 @@
+#include <string.h>
+
+#include "report_map.h"
+
+#define ITEM_LONG 0xfe
+
+#define ITEM_TYPE_MAIN   0
+#define ITEM_TYPE_GLOBAL 1
+#define ITEM_TYPE_LOCAL  2
+
+#define MAIN_COLLECTION     0xa
+#define MAIN_END_COLLECTION 0xc
+#define GLOBAL_USAGE_PAGE   0x0
+#define GLOBAL_REPORT_ID    0x8
+#define LOCAL_USAGE         0x0
+
+#define COLLECTION_APPLICATION 0x01
+/* Generic Desktop page, Keyboard usage. */
+#define USAGE_KEYBOARD 0x00010006
+
+void
+report_map_init(struct report_map_parser *parser)
+{
+	memset(parser, 0, sizeof(*parser));
+}
+
+static void
+main_item(struct report_map_parser *parser, uint8_t tag)
+{
+	uint32_t usage = parser->usage;
+
+	/* Usages of up to 16 bits are on the current usage page. */
+	if (usage <= UINT16_MAX) {
+		usage |= (uint32_t)parser->usage_page << 16;
+	}
+
+	switch (tag) {
+		case MAIN_COLLECTION:
+			if (parser->depth == 0 && !parser->found &&
+			    parser->data == COLLECTION_APPLICATION &&
+			    usage == USAGE_KEYBOARD) {
+				parser->found = true;
+				parser->in_keyboard = true;
+				parser->keyboard_id = parser->report_id;
+			}
+			parser->depth++;
+			break;
+		case MAIN_END_COLLECTION:
+			if (parser->depth > 0 && --parser->depth == 0) {
+				parser->in_keyboard = false;
+			}
+			break;
+		default:
+			break;
+	}
+
+	/* Local items only apply to the next main item. */
+	parser->usage = 0;
+}
+
+static void
+item(struct report_map_parser *parser)
+{
+	uint8_t type = (parser->prefix >> 2) & 0x3;
+	uint8_t tag = parser->prefix >> 4;
+
+	switch (type) {
+		case ITEM_TYPE_MAIN:
+			main_item(parser, tag);
+			break;
+		case ITEM_TYPE_GLOBAL:
+			if (tag == GLOBAL_USAGE_PAGE) {
+				parser->usage_page = parser->data;
+			} else if (tag == GLOBAL_REPORT_ID) {
+				parser->report_id = parser->data;
+				if (parser->in_keyboard) {
+					parser->keyboard_id = parser->data;
+					parser->in_keyboard = false;
+				}
+			}
+			break;
+		case ITEM_TYPE_LOCAL:
+			/* The first usage names the collection. */
+			if (tag == LOCAL_USAGE && parser->usage == 0) {
+				parser->usage = parser->data;
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+void
+report_map_parse(struct report_map_parser *parser, const uint8_t *data,
+                 size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		uint8_t c = data[i];
+
+		if (parser->skip > 0) {
+			parser->skip--;
+			continue;
+		}
+
+		if (parser->remaining == 0) {
+			parser->prefix = c;
+			parser->data = 0;
+			parser->shift = 0;
+			if (c == ITEM_LONG) {
+				/* Followed by its data size and tag. */
+				parser->remaining = 2;
+			} else {
+				parser->remaining = (c & 0x3) == 0x3 ?
+					4 : (c & 0x3);
+				if (parser->remaining == 0) {
+					item(parser);
+				}
+			}
+			continue;
+		}
+
+		parser->data |= (uint32_t)c << parser->shift;
+		parser->shift += 8;
+		if (--parser->remaining > 0) {
+			continue;
+		}
+
+		if (parser->prefix == ITEM_LONG) {
+			parser->skip = parser->data & 0xff;
+		} else {
+			item(parser);
+		}
+	}
+}
+
+int
+report_map_keyboard_id(const struct report_map_parser *parser)
+{
+	return parser->found ? parser->keyboard_id : -1;
+}
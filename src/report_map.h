@@ -0,0 +1,43 @@
+#ifndef REPORT_MAP_H
+#define REPORT_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Finds the report ID of the keyboard in a HID report map, the report
+ * descriptor of a HID service. The map is read over several ATT reads, so it
+ * is parsed a piece at a time.
+ *
+ * The keyboard is the first application collection with the Generic Desktop
+ * Keyboard usage, and its report ID the first one inside that collection. */
+
+struct report_map_parser {
+	/* Item being parsed: its prefix, its data so far and the data bytes
+	 * still to come. Long items are skipped. */
+	uint8_t prefix;
+	uint32_t data;
+	uint8_t shift;
+	uint8_t remaining;
+	uint8_t skip;
+
+	/* Global and local item state. */
+	uint16_t usage_page;
+	uint32_t usage;
+	uint8_t report_id;
+
+	int depth;
+	/* Set until the keyboard collection's first report ID. */
+	bool in_keyboard;
+	bool found;
+	uint8_t keyboard_id;
+};
+
+void report_map_init(struct report_map_parser *parser);
+void report_map_parse(struct report_map_parser *parser, const uint8_t *data,
+                      size_t len);
+/* Returns the keyboard's report ID, 0 if the map doesn't use report IDs, or
+ * -1 if the map has no keyboard. */
+int report_map_keyboard_id(const struct report_map_parser *parser);
+
+#endif /* REPORT_MAP_H */
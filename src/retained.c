@@ -0,0 +1,135 @@
+#include <stddef.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/hwinfo.h>
+#include <zephyr/linker/section_tags.h>
+#include <zephyr/sys/crc.h>
+
+#include "retained.h"
+
+#include "instance.h"
+
+/* Change this whenever struct retained_state or anything in it changes, so
+ * that a new firmware doesn't restore state saved by an old one. */
+#define RETAINED_MAGIC 0x4c4b3231 /* "LK21" */
+
+struct retained_state {
+	uint32_t magic;
+	struct repeat_buffer repeat_buffers[NUM_REPEAT_BUFFERS];
+	struct division divisions[NUM_DIVISIONS];
+	int8_t keyclick_volume;
+	int8_t bell_volume;
+	bool ctrl_keyclick;
+	bool auto_repeat_enabled;
+	bool locked;
+	uint8_t leds;
+	/* CRC-32 of everything above. */
+	uint32_t crc;
+};
+
+static VTBT_RETAINED_ATTR struct retained_state retained_states[NUM_VT_PORTS];
+
+static uint32_t
+retained_crc(const struct retained_state *retained)
+{
+	return crc32_ieee((const uint8_t *)retained,
+	                  offsetof(struct retained_state, crc));
+}
+
+static bool
+read_reset_cause(void)
+{
+	uint32_t cause;
+	int ret = hwinfo_get_reset_cause(&cause);
+	if (ret == -ENOSYS) {
+		/* No reset cause available, so rely on the checksum alone. */
+		return true;
+	} else if (ret < 0) {
+		return false;
+	}
+
+	hwinfo_clear_reset_cause();
+
+	return (cause & (RESET_WATCHDOG | RESET_SOFTWARE)) &&
+	       !(cause & (RESET_POR | RESET_BROWNOUT | RESET_PIN));
+}
+
+static bool
+is_warm_boot(void)
+{
+	/* The reset cause is cleared once read, so it's only read for the
+	 * first instance. */
+	static int warm_boot = -1;
+
+	if (warm_boot < 0) {
+		warm_boot = read_reset_cause();
+	}
+
+	return warm_boot;
+}
+
+void
+retained_save(struct vtbt *vt)
+{
+	struct retained_state *retained = &retained_states[vt->id];
+
+	for (int i = 0; i < NUM_REPEAT_BUFFERS; i++) {
+		retained->repeat_buffers[i] =
+			*lk201_repeat_buffer_get(&vt->lk201, i);
+	}
+	for (int i = 0; i < NUM_DIVISIONS; i++) {
+		retained->divisions[i] = *lk201_division_get(&vt->lk201, i);
+	}
+	retained->keyclick_volume = beeper_get_keyclick_volume(&vt->beeper);
+	retained->bell_volume = beeper_get_bell_volume(&vt->beeper);
+	retained->ctrl_keyclick = keyboard_ctrl_keyclick_get(&vt->keyboard);
+	retained->auto_repeat_enabled =
+		metronome_auto_repeat_get(&vt->metronome);
+	retained->locked = uart_locked_get(&vt->uart);
+	retained->leds = leds_get(&vt->leds);
+	retained->magic = RETAINED_MAGIC;
+	retained->crc = retained_crc(retained);
+}
+
+bool
+retained_restore(struct vtbt *vt)
+{
+	struct retained_state *retained = &retained_states[vt->id];
+
+	if (!is_warm_boot() ||
+	    (retained->magic != RETAINED_MAGIC) ||
+	    (retained->crc != retained_crc(retained))) {
+		retained->magic = 0;
+		return false;
+	}
+
+	for (int i = 0; i < NUM_REPEAT_BUFFERS; i++) {
+		*lk201_repeat_buffer_get(&vt->lk201, i) =
+			retained->repeat_buffers[i];
+	}
+	for (int i = 0; i < NUM_DIVISIONS; i++) {
+		*lk201_division_get(&vt->lk201, i) = retained->divisions[i];
+	}
+	beeper_set_keyclick_volume(&vt->beeper, retained->keyclick_volume);
+	beeper_set_bell_volume(&vt->beeper, retained->bell_volume);
+	if (retained->ctrl_keyclick) {
+		keyboard_ctrl_keyclick_enable(&vt->keyboard);
+	} else {
+		keyboard_ctrl_keyclick_disable(&vt->keyboard);
+	}
+	if (retained->auto_repeat_enabled) {
+		metronome_auto_repeat_enable(&vt->metronome);
+	} else {
+		metronome_auto_repeat_disable(&vt->metronome);
+	}
+	if (retained->locked) {
+		uart_lock(&vt->uart);
+	}
+	for (int i = 0; i < NUM_LEDS; i++) {
+		if (retained->leds & BIT(i)) {
+			leds_on(&vt->leds, i);
+		}
+	}
+
+	return true;
+}
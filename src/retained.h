@@ -0,0 +1,34 @@
+#ifndef RETAINED_H
+#define RETAINED_H
+
+#include <stdbool.h>
+
+#include <zephyr/toolchain.h>
+#include <zephyr/linker/section_tags.h>
+
+struct vtbt;
+
+/* The LK201 state configured by the terminal is mirrored to RAM that survives
+ * a warm (watchdog or software) reset, so the keyboard can carry on where it
+ * left off without the terminal noticing that it rebooted. */
+
+/* Places a variable in RAM that isn't initialized at startup and that the
+ * boot ROM and the second-stage bootloader leave alone on a warm reset. On
+ * the ESP32-C3 that is RTC fast memory, in the .rtc_noinit section that
+ * ESP-IDF's RTC_NOINIT_ATTR uses, since ordinary DRAM is used by the
+ * bootloaders themselves. Elsewhere, e.g. on native_sim, plain .noinit. */
+#ifdef CONFIG_SOC_SERIES_ESP32C3
+#define VTBT_RETAINED_ATTR \
+	__attribute__((section(".rtc_noinit." STRINGIFY(__COUNTER__))))
+#else
+#define VTBT_RETAINED_ATTR __noinit
+#endif
+
+/* Copy the instance's current LK201 state to retained RAM. */
+void retained_save(struct vtbt *vt);
+/* Restore the instance's LK201 state after a warm reset. Returns false on a
+ * cold boot or if the retained state is invalid, in which case nothing is
+ * restored and the retained state is discarded. */
+bool retained_restore(struct vtbt *vt);
+
+#endif /* RETAINED_H */
@@ -0,0 +1,190 @@
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/logging/log.h>
+
+#include "serial_input.h"
+
+#include "vtbt.h"
+#include "instance.h"
+#include "input.h"
+#include "metrics.h"
+#include "iram.h"
+
+LOG_MODULE_REGISTER(serial_input, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define DT_DRV_COMPAT vtbt_vt_port
+
+#define FRAME_SYNC1 0x57
+#define FRAME_SYNC2 0xab
+
+enum frame_state {
+	FRAME_STATE_SYNC1,
+	FRAME_STATE_SYNC2,
+	FRAME_STATE_LENGTH,
+	FRAME_STATE_REPORT,
+	FRAME_STATE_CHECKSUM,
+};
+
+struct serial_input {
+	const struct device *dev;
+	hid_report_cb_t callback;
+	link_lost_cb_t link_lost;
+	void *user_data;
+
+	/* Frame being received, and the time of its first byte. */
+	enum frame_state state;
+	uint8_t report[HID_REPORT_SIZE];
+	int received;
+	uint8_t checksum;
+	int64_t start;
+
+	/* Runs out when the bridge goes quiet. */
+	struct k_timer timeout_timer;
+	bool connected;
+
+	/* Written by the ISR only. */
+	struct input_stats stats;
+};
+
+#define SERIAL_INPUT_DEV(inst)                                          \
+	[inst] = COND_CODE_1(DT_INST_NODE_HAS_PROP(inst, input_uart),   \
+		(DEVICE_DT_GET(DT_INST_PHANDLE(inst, input_uart))),     \
+		(NULL)),
+
+static const struct device *const devs[NUM_VT_PORTS] = {
+	DT_INST_FOREACH_STATUS_OKAY(SERIAL_INPUT_DEV)
+};
+
+static struct serial_input sources[NUM_VT_PORTS];
+
+static void
+timeout_timer_handler(struct k_timer *timer)
+{
+	struct serial_input *source =
+		CONTAINER_OF(timer, struct serial_input, timeout_timer);
+
+	source->connected = false;
+	source->link_lost(k_uptime_ticks(), source->user_data);
+	LOG_WRN("Serial keyboard lost");
+}
+
+static VTBT_IRAM_ATTR void
+frame_complete(struct serial_input *source)
+{
+	if (!source->connected) {
+		source->connected = true;
+		LOG_INF("Serial keyboard found");
+	}
+	k_timer_start(&source->timeout_timer, K_MSEC(SERIAL_INPUT_TIMEOUT_MS),
+	              K_NO_WAIT);
+
+	source->stats.reports++;
+	latency_stats_add(&source->stats.transfer,
+	                  k_uptime_ticks() - source->start);
+	source->callback(source->report, source->start, source->user_data);
+}
+
+static VTBT_IRAM_ATTR void
+frame_byte(struct serial_input *source, uint8_t c)
+{
+	switch (source->state) {
+		case FRAME_STATE_SYNC1:
+			if (c == FRAME_SYNC1) {
+				source->start = k_uptime_ticks();
+				source->state = FRAME_STATE_SYNC2;
+			}
+			break;
+		case FRAME_STATE_SYNC2:
+			if (c == FRAME_SYNC2) {
+				source->state = FRAME_STATE_LENGTH;
+			} else if (c == FRAME_SYNC1) {
+				/* The first was noise. */
+				source->start = k_uptime_ticks();
+			} else {
+				source->stats.errors++;
+				source->state = FRAME_STATE_SYNC1;
+			}
+			break;
+		case FRAME_STATE_LENGTH:
+			if (c == HID_REPORT_SIZE) {
+				source->checksum = c;
+				source->received = 0;
+				source->state = FRAME_STATE_REPORT;
+			} else {
+				source->stats.errors++;
+				source->state = FRAME_STATE_SYNC1;
+			}
+			break;
+		case FRAME_STATE_REPORT:
+			source->report[source->received++] = c;
+			source->checksum += c;
+			if (source->received == HID_REPORT_SIZE) {
+				source->state = FRAME_STATE_CHECKSUM;
+			}
+			break;
+		case FRAME_STATE_CHECKSUM:
+			if (c == source->checksum) {
+				frame_complete(source);
+			} else {
+				source->stats.errors++;
+			}
+			source->state = FRAME_STATE_SYNC1;
+			break;
+	}
+}
+
+static VTBT_IRAM_ATTR void
+callback(const struct device *dev, void *user_data)
+{
+	struct serial_input *source = user_data;
+	uint8_t c;
+
+	if (uart_irq_update(dev) < 0) {
+		return;
+	}
+
+	if (uart_irq_rx_ready(dev) > 0) {
+		while (uart_fifo_read(dev, &c, 1) == 1) {
+			frame_byte(source, c);
+		}
+	}
+}
+
+int
+serial_input_start(int id, hid_report_cb_t callback_fn,
+                   link_lost_cb_t link_lost, void *user_data)
+{
+	struct serial_input *source = &sources[id];
+	int ret;
+
+	source->dev = devs[id];
+	if (source->dev == NULL) {
+		LOG_ERR("vt%d has no input-uart", id);
+		return -1;
+	}
+	if (!device_is_ready(source->dev)) {
+		LOG_ERR("Input UART device not found");
+		return -1;
+	}
+
+	source->callback = callback_fn;
+	source->link_lost = link_lost;
+	source->user_data = user_data;
+	source->state = FRAME_STATE_SYNC1;
+	k_timer_init(&source->timeout_timer, timeout_timer_handler, NULL);
+
+	ret = uart_irq_callback_user_data_set(source->dev, callback, source);
+	if (ret < 0) {
+		LOG_ERR("Error setting input UART callback: %d", ret);
+		return -1;
+	}
+	uart_irq_rx_enable(source->dev);
+
+	return 0;
+}
+
+void
+serial_input_stats_get(int id, struct input_stats *stats)
+{
+	*stats = sources[id].stats;
+}
@@ -0,0 +1,26 @@
+#ifndef SERIAL_INPUT_H
+#define SERIAL_INPUT_H
+
+#include "vtbt.h"
+#include "input.h"
+
+/* A keyboard source on the port's input-uart, for a bridge that forwards a
+ * wired keyboard's boot reports. Each report is framed as
+ *
+ *   0x57 0xab <length> <report> <checksum>
+ *
+ * where length is HID_REPORT_SIZE and the checksum is the low byte of the sum
+ * of the length and report bytes. The bridge sends a frame on every change
+ * and repeats the current report at least every SERIAL_INPUT_KEEPALIVE_MS;
+ * after SERIAL_INPUT_TIMEOUT_MS without a valid frame the keyboard counts as
+ * lost and its keys are released. Reports are timestamped at the first byte
+ * of their frame and passed to the callback from the UART ISR. */
+
+#define SERIAL_INPUT_KEEPALIVE_MS 250
+#define SERIAL_INPUT_TIMEOUT_MS   1000
+
+int serial_input_start(int id, hid_report_cb_t callback,
+                       link_lost_cb_t link_lost, void *user_data);
+void serial_input_stats_get(int id, struct input_stats *stats);
+
+#endif /* SERIAL_INPUT_H */
@@ -0,0 +1,333 @@
+/* Recording stand-ins for the beeper's PWM, the LED GPIOs and the status LED
+ * strip on native_sim, see sim-recorder.overlay. Every state change is
+ * written with its time in microseconds as a line to the file given with
+ * --recorder=<file>:
+ *
+ *   <us> pwm <device> <channel> <period ns> <pulse ns>
+ *   <us> gpio <device> <pin> <0|1>
+ *   <us> strip <device> <pixel> <r> <g> <b>
+ *   <us> key vt<port> <LK201 keycode>
+ *
+ * Key presses are timed at the arrival of their HID report. The file is
+ * written through the host's C library by sim_recorder_bottom.c, and turned
+ * into timelines, checks and a WAV file by scripts/simrec.py. */
+
+#include <stdarg.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/arch/posix/posix_trace.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/gpio/gpio_utils.h>
+#include <zephyr/drivers/led_strip.h>
+#include <zephyr/drivers/pwm.h>
+
+#include <cmdline.h>
+#include <posix_native_task.h>
+
+#include "sim_recorder.h"
+#include "sim_recorder_bottom.h"
+
+#define LINE_SIZE 80
+
+static const char *path;
+
+static void
+record(int64_t ticks, const char *format, ...)
+{
+	char line[LINE_SIZE];
+	int len;
+	va_list args;
+
+	if (path == NULL) {
+		return;
+	}
+
+	len = snprintk(line, sizeof(line), "%llu ",
+	               (unsigned long long)k_ticks_to_us_floor64(ticks));
+	va_start(args, format);
+	vsnprintk(line + len, sizeof(line) - len, format, args);
+	va_end(args);
+
+	sim_recorder_bottom_write(line);
+}
+
+void
+sim_recorder_key(int port, int keycode, int64_t time)
+{
+	record(time, "key vt%d 0x%02x\n", port, keycode);
+}
+
+static void
+sim_recorder_add_options(void)
+{
+	static struct args_struct_t options[] = {
+		{
+			.option = "recorder",
+			.name = "file",
+			.type = 's',
+			.dest = (void *)&path,
+			.descript = "Record beeper, LED and key events to <file>",
+		},
+		ARG_TABLE_ENDMARKER
+	};
+
+	native_add_command_line_opts(options);
+}
+
+static void
+sim_recorder_open(void)
+{
+	if (path != NULL && sim_recorder_bottom_open(path) != 0) {
+		posix_print_error_and_exit("Cannot open recorder file %s\n",
+		                           path);
+	}
+}
+
+NATIVE_TASK(sim_recorder_add_options, PRE_BOOT_1, 20);
+NATIVE_TASK(sim_recorder_open, PRE_BOOT_2, 20);
+NATIVE_TASK(sim_recorder_bottom_close, ON_EXIT, 20);
+
+/* The beeper. Cycles are nanoseconds. */
+
+#define DT_DRV_COMPAT vtbt_pwm_recorder
+
+static int
+pwm_recorder_set_cycles(const struct device *dev, uint32_t channel,
+                        uint32_t period_cycles, uint32_t pulse_cycles,
+                        pwm_flags_t flags)
+{
+	ARG_UNUSED(flags);
+
+	record(k_uptime_ticks(), "pwm %s %u %u %u\n", dev->name, channel,
+	       period_cycles, pulse_cycles);
+
+	return 0;
+}
+
+static int
+pwm_recorder_get_cycles_per_sec(const struct device *dev, uint32_t channel,
+                                uint64_t *cycles)
+{
+	ARG_UNUSED(dev);
+	ARG_UNUSED(channel);
+
+	*cycles = NSEC_PER_SEC;
+
+	return 0;
+}
+
+static const struct pwm_driver_api pwm_recorder_api = {
+	.set_cycles = pwm_recorder_set_cycles,
+	.get_cycles_per_sec = pwm_recorder_get_cycles_per_sec,
+};
+
+#define PWM_RECORDER_DEFINE(inst)                                       \
+	DEVICE_DT_INST_DEFINE(inst, NULL, NULL, NULL, NULL,             \
+	                      POST_KERNEL,                              \
+	                      CONFIG_KERNEL_INIT_PRIORITY_DEVICE,       \
+	                      &pwm_recorder_api);
+
+DT_INST_FOREACH_STATUS_OKAY(PWM_RECORDER_DEFINE)
+
+/* The LEDs. Only outputs are recorded; inputs read as 0. */
+
+#undef DT_DRV_COMPAT
+#define DT_DRV_COMPAT vtbt_gpio_recorder
+
+struct gpio_recorder_config {
+	struct gpio_driver_config common;
+};
+
+struct gpio_recorder_data {
+	struct gpio_driver_data common;
+	gpio_port_value_t outputs;
+	gpio_port_pins_t recorded;
+};
+
+static void
+gpio_recorder_update(const struct device *dev, gpio_port_pins_t pins,
+                     gpio_port_value_t value)
+{
+	struct gpio_recorder_data *data = dev->data;
+	int64_t now = k_uptime_ticks();
+
+	for (int pin = 0; pin < GPIO_MAX_PINS_PER_PORT; pin++) {
+		if (!(pins & BIT(pin))) {
+			continue;
+		}
+
+		bool on = value & BIT(pin);
+
+		/* The first write of a pin is always recorded. */
+		if ((data->recorded & BIT(pin)) &&
+		    on == !!(data->outputs & BIT(pin))) {
+			continue;
+		}
+		data->recorded |= BIT(pin);
+		WRITE_BIT(data->outputs, pin, on);
+		record(now, "gpio %s %d %d\n", dev->name, pin, on);
+	}
+}
+
+static int
+gpio_recorder_pin_configure(const struct device *dev, gpio_pin_t pin,
+                            gpio_flags_t flags)
+{
+	if (flags & GPIO_OUTPUT_INIT_HIGH) {
+		gpio_recorder_update(dev, BIT(pin), BIT(pin));
+	} else if (flags & GPIO_OUTPUT_INIT_LOW) {
+		gpio_recorder_update(dev, BIT(pin), 0);
+	}
+
+	return 0;
+}
+
+static int
+gpio_recorder_port_get_raw(const struct device *dev, gpio_port_value_t *value)
+{
+	ARG_UNUSED(dev);
+
+	*value = 0;
+
+	return 0;
+}
+
+static int
+gpio_recorder_port_set_masked_raw(const struct device *dev,
+                                  gpio_port_pins_t mask,
+                                  gpio_port_value_t value)
+{
+	gpio_recorder_update(dev, mask, value);
+
+	return 0;
+}
+
+static int
+gpio_recorder_port_set_bits_raw(const struct device *dev,
+                                gpio_port_pins_t pins)
+{
+	gpio_recorder_update(dev, pins, pins);
+
+	return 0;
+}
+
+static int
+gpio_recorder_port_clear_bits_raw(const struct device *dev,
+                                  gpio_port_pins_t pins)
+{
+	gpio_recorder_update(dev, pins, 0);
+
+	return 0;
+}
+
+static int
+gpio_recorder_port_toggle_bits(const struct device *dev,
+                               gpio_port_pins_t pins)
+{
+	struct gpio_recorder_data *data = dev->data;
+
+	gpio_recorder_update(dev, pins, ~data->outputs);
+
+	return 0;
+}
+
+static const struct gpio_driver_api gpio_recorder_api = {
+	.pin_configure = gpio_recorder_pin_configure,
+	.port_get_raw = gpio_recorder_port_get_raw,
+	.port_set_masked_raw = gpio_recorder_port_set_masked_raw,
+	.port_set_bits_raw = gpio_recorder_port_set_bits_raw,
+	.port_clear_bits_raw = gpio_recorder_port_clear_bits_raw,
+	.port_toggle_bits = gpio_recorder_port_toggle_bits,
+};
+
+#define GPIO_RECORDER_DEFINE(inst)                                      \
+	static const struct gpio_recorder_config                        \
+	gpio_recorder_config_##inst = {                                 \
+		.common = {                                             \
+			.port_pin_mask =                                \
+				GPIO_PORT_PIN_MASK_FROM_DT_INST(inst),  \
+		},                                                      \
+	};                                                              \
+	static struct gpio_recorder_data gpio_recorder_data_##inst;     \
+	DEVICE_DT_INST_DEFINE(inst, NULL, NULL,                         \
+	                      &gpio_recorder_data_##inst,               \
+	                      &gpio_recorder_config_##inst,             \
+	                      POST_KERNEL,                              \
+	                      CONFIG_KERNEL_INIT_PRIORITY_DEVICE,       \
+	                      &gpio_recorder_api);
+
+DT_INST_FOREACH_STATUS_OKAY(GPIO_RECORDER_DEFINE)
+
+/* The status LED. */
+
+#undef DT_DRV_COMPAT
+#define DT_DRV_COMPAT vtbt_led_strip_recorder
+
+struct led_strip_recorder_config {
+	struct led_rgb *pixels;
+	size_t length;
+};
+
+static int
+led_strip_recorder_update_rgb(const struct device *dev,
+                              struct led_rgb *pixels, size_t num_pixels)
+{
+	const struct led_strip_recorder_config *config = dev->config;
+	int64_t now = k_uptime_ticks();
+
+	for (size_t i = 0; i < MIN(num_pixels, config->length); i++) {
+		struct led_rgb *last = &config->pixels[i];
+
+		if (last->r == pixels[i].r && last->g == pixels[i].g &&
+		    last->b == pixels[i].b) {
+			continue;
+		}
+		*last = pixels[i];
+		record(now, "strip %s %u %u %u %u\n", dev->name, (unsigned)i,
+		       last->r, last->g, last->b);
+	}
+
+	return 0;
+}
+
+static int
+led_strip_recorder_update_channels(const struct device *dev,
+                                   uint8_t *channels, size_t num_channels)
+{
+	ARG_UNUSED(dev);
+	ARG_UNUSED(channels);
+	ARG_UNUSED(num_channels);
+
+	return -ENOTSUP;
+}
+
+static size_t
+led_strip_recorder_length(const struct device *dev)
+{
+	const struct led_strip_recorder_config *config = dev->config;
+
+	return config->length;
+}
+
+static const struct led_strip_driver_api led_strip_recorder_api = {
+	.update_rgb = led_strip_recorder_update_rgb,
+	.update_channels = led_strip_recorder_update_channels,
+	.length = led_strip_recorder_length,
+};
+
+#define LED_STRIP_RECORDER_DEFINE(inst)                                 \
+	static struct led_rgb                                           \
+	led_strip_recorder_pixels_##inst[DT_INST_PROP(inst, chain_length)]; \
+	static const struct led_strip_recorder_config                   \
+	led_strip_recorder_config_##inst = {                            \
+		.pixels = led_strip_recorder_pixels_##inst,             \
+		.length = DT_INST_PROP(inst, chain_length),             \
+	};                                                              \
+	DEVICE_DT_INST_DEFINE(inst, NULL, NULL, NULL,                   \
+	                      &led_strip_recorder_config_##inst,        \
+	                      POST_KERNEL,                              \
+	                      CONFIG_KERNEL_INIT_PRIORITY_DEVICE,       \
+	                      &led_strip_recorder_api);
+
+DT_INST_FOREACH_STATUS_OKAY(LED_STRIP_RECORDER_DEFINE)
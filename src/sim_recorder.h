@@ -0,0 +1,11 @@
+#ifndef SIM_RECORDER_H
+#define SIM_RECORDER_H
+
+#include <stdint.h>
+
+/* Record a key press that arrived at a k_uptime_ticks() time alongside the
+ * beeper and LED state changes of the simulation build, so that keyclick
+ * latency can be checked by scripts/simrec.py. */
+void sim_recorder_key(int port, int keycode, int64_t time);
+
+#endif /* SIM_RECORDER_H */
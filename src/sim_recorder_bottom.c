@@ -0,0 +1,36 @@
+#include <stdio.h>
+
+#include "sim_recorder_bottom.h"
+
+static FILE *file;
+
+int
+sim_recorder_bottom_open(const char *path)
+{
+	file = fopen(path, "w");
+	if (file == NULL) {
+		return -1;
+	}
+
+	/* Whole lines reach the file even if the simulation is killed. */
+	setvbuf(file, NULL, _IOLBF, 0);
+
+	return 0;
+}
+
+void
+sim_recorder_bottom_write(const char *line)
+{
+	if (file != NULL) {
+		fputs(line, file);
+	}
+}
+
+void
+sim_recorder_bottom_close(void)
+{
+	if (file != NULL) {
+		fclose(file);
+		file = NULL;
+	}
+}
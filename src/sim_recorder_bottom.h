@@ -0,0 +1,11 @@
+#ifndef SIM_RECORDER_BOTTOM_H
+#define SIM_RECORDER_BOTTOM_H
+
+/* Host side of the simulation recorder, built against the host's C library
+ * into the native simulator runner. */
+
+int sim_recorder_bottom_open(const char *path);
+void sim_recorder_bottom_write(const char *line);
+void sim_recorder_bottom_close(void);
+
+#endif /* SIM_RECORDER_BOTTOM_H */
@@ -0,0 +1,134 @@
+/* Stand-ins for the terminals on ports whose UART is emulated: bytes are taken
+ * from each port at the 4800 baud line rate, transmission is inhibited for a
+ * while every second as a smooth-scrolling terminal would, and every port's
+ * throughput and latencies are printed periodically. Ports typed on by the
+ * workload generator are left to its own terminal, see workload.c. */
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/serial/uart_emul.h>
+
+#include "instance.h"
+#include "lk201.h"
+
+#define DT_DRV_COMPAT vtbt_vt_port
+
+/* Bytes per second at 4800 baud with 8N1 framing. */
+#define LINE_RATE 480
+
+#define REPORT_INTERVAL_SEC 10
+
+#define INHIBIT_INTERVAL_MS 1000
+#define INHIBIT_DURATION_MS 100
+
+#define SIM_TERMINAL_DEV(inst)                                          \
+	[inst] = COND_CODE_1(                                           \
+		DT_NODE_HAS_COMPAT(DT_INST_PHANDLE(inst, uart),         \
+		                   zephyr_uart_emul),                   \
+		(DEVICE_DT_GET(DT_INST_PHANDLE(inst, uart))),           \
+		(NULL)),
+
+static const struct device *const devs[NUM_VT_PORTS] = {
+	DT_INST_FOREACH_STATUS_OKAY(SIM_TERMINAL_DEV)
+};
+
+/* The port's emulated UART, or NULL if it isn't emulated or the workload
+ * generator is its terminal. */
+static const struct device *
+terminal_dev(int i)
+{
+	if (vtbt_instances[i].source == KEYBOARD_SOURCE_WORKLOAD) {
+		return NULL;
+	}
+
+	return devs[i];
+}
+
+static uint32_t rx_counts[NUM_VT_PORTS];
+static uint32_t rx_counts_reported[NUM_VT_PORTS];
+
+static void
+line_timer_handler(struct k_timer *timer)
+{
+	ARG_UNUSED(timer);
+
+	uint8_t c;
+
+	for (int i = 0; i < NUM_VT_PORTS; i++) {
+		const struct device *dev = terminal_dev(i);
+
+		if (dev == NULL) {
+			continue;
+		}
+		rx_counts[i] += uart_emul_get_tx_data(dev, &c, 1);
+	}
+}
+
+K_TIMER_DEFINE(line_timer, line_timer_handler, NULL);
+
+static void
+flow_work_handler(struct k_work *work)
+{
+	static bool inhibited;
+	uint8_t command = inhibited ? COMMAND_RESUME_KEYBOARD_TRANSMISSION :
+	                              COMMAND_INHIBIT_KEYBOARD_TRANSMISSION;
+
+	for (int i = 0; i < NUM_VT_PORTS; i++) {
+		const struct device *dev = terminal_dev(i);
+
+		if (dev == NULL) {
+			continue;
+		}
+		uart_emul_put_rx_data(dev, &command, 1);
+	}
+
+	inhibited = !inhibited;
+	k_work_schedule(k_work_delayable_from_work(work),
+	                K_MSEC(inhibited ? INHIBIT_DURATION_MS :
+	                       INHIBIT_INTERVAL_MS - INHIBIT_DURATION_MS));
+}
+
+K_WORK_DELAYABLE_DEFINE(flow_work, flow_work_handler);
+
+static void
+report_work_handler(struct k_work *work)
+{
+	for (int i = 0; i < NUM_VT_PORTS; i++) {
+		const struct latency_stats *latency =
+			&vtbt_instances[i].key_latency;
+		const struct latency_stats *inhibit =
+			&vtbt_instances[i].inhibit_latency;
+		uint32_t rx_count = rx_counts[i];
+
+		if (terminal_dev(i) == NULL) {
+			continue;
+		}
+
+		printk("vt%d: %u B/s, %u keys, key latency avg %u us "
+		       "max %u us, %u inhibits, inhibit to silence avg %u us "
+		       "max %u us\n", i,
+		       (rx_count - rx_counts_reported[i]) /
+		       REPORT_INTERVAL_SEC,
+		       latency->count, latency_stats_avg_us(latency),
+		       latency->max_us, inhibit->count,
+		       latency_stats_avg_us(inhibit), inhibit->max_us);
+		rx_counts_reported[i] = rx_count;
+	}
+
+	k_work_schedule(k_work_delayable_from_work(work),
+	                K_SECONDS(REPORT_INTERVAL_SEC));
+}
+
+K_WORK_DELAYABLE_DEFINE(report_work, report_work_handler);
+
+static int
+sim_terminal_init(void)
+{
+	k_timer_start(&line_timer, K_USEC(USEC_PER_SEC / LINE_RATE),
+	              K_USEC(USEC_PER_SEC / LINE_RATE));
+	k_work_schedule(&flow_work, K_MSEC(INHIBIT_INTERVAL_MS));
+	k_work_schedule(&report_work, K_SECONDS(REPORT_INTERVAL_SEC));
+
+	return 0;
+}
+
+SYS_INIT(sim_terminal_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
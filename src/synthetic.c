@@ -0,0 +1,52 @@
+#include <zephyr/kernel.h>
+
+#include "synthetic.h"
+
+#include "vtbt.h"
+#include "instance.h"
+
+#define HID_USAGE_KEY_A 0x04
+
+struct synthetic {
+	struct k_timer timer;
+	hid_report_cb_t callback;
+	void *user_data;
+	uint32_t step;
+};
+
+static struct synthetic sources[NUM_VT_PORTS];
+
+static void
+synthetic_timer(struct k_timer *timer)
+{
+	struct synthetic *source = CONTAINER_OF(timer, struct synthetic, timer);
+	uint8_t report[HID_REPORT_SIZE] = { 0x00 };
+
+	/* Even steps press the next letter, odd steps release it. */
+	if ((source->step % 2) == 0) {
+		report[HID_REPORT_FIRST_KEY] =
+			HID_USAGE_KEY_A + (source->step / 2) % 26;
+	}
+	source->step++;
+
+	source->callback(report, k_uptime_ticks(), source->user_data);
+}
+
+int
+synthetic_start(int id, hid_report_cb_t callback, void *user_data)
+{
+	struct synthetic *source = &sources[id];
+
+	source->callback = callback;
+	source->user_data = user_data;
+	source->step = 0;
+
+	/* A press and a release per key. */
+	k_timeout_t period =
+		K_USEC(USEC_PER_SEC / (2 * CONFIG_VTBT_SYNTHETIC_KEYS_PER_SEC));
+
+	k_timer_init(&source->timer, synthetic_timer, NULL);
+	k_timer_start(&source->timer, period, period);
+
+	return 0;
+}
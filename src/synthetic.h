@@ -0,0 +1,11 @@
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include "vtbt.h"
+
+/* A keyboard source that types a steady load for simulation: presses and
+ * releases cycling through the letters at CONFIG_VTBT_SYNTHETIC_KEYS_PER_SEC.
+ * Reports are passed to the callback from a timer ISR. */
+int synthetic_start(int id, hid_report_cb_t callback, void *user_data);
+
+#endif /* SYNTHETIC_H */
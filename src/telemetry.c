@@ -0,0 +1,504 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "telemetry.h"
+
+#include "background.h"
+#include "bluetooth.h"
+#include "instance.h"
+#include "key_stats.h"
+#include "lk201.h"
+#include "metrics.h"
+#include "repeat_profile.h"
+#include "retained.h"
+#include "uart.h"
+
+LOG_MODULE_REGISTER(telemetry, CONFIG_LOG_DEFAULT_LEVEL);
+
+/* Records fit in a notification at the default ATT MTU of 23. */
+#define COUNTERS_RECORD_SIZE  19
+#define HISTOGRAM_RECORD_SIZE (2 + 2 * LATENCY_HISTOGRAM_BUCKETS)
+#define LINK_RECORD_SIZE      19
+#define LINE_RECORD_SIZE      14
+#define KEY_RECORD_SIZE       10
+#define DWELL_RECORD_SIZE     19
+#define FLUSH_RECORD_SIZE     19
+#define BOOT_RECORD_SIZE      (4 * NUM_BOOT_PHASES)
+
+/* Key statistics record types. */
+#define KEY_STATS_KEY   0x00
+#define KEY_STATS_DWELL 0x01
+#define KEY_STATS_FLUSH 0x02
+#define DWELL_BUCKETS_PER_RECORD 4
+
+/* Control characteristic opcodes. */
+#define CONTROL_SET_REPEAT       0x01 /* port, buffer, timeout (ms, le16), rate */
+#define CONTROL_SET_LINK_PROFILE 0x02 /* profile */
+#define CONTROL_RESET_STATS      0x03
+/* division (1-14), timeout (ms, le16), rate, rate max, accel (ms, le16) */
+#define CONTROL_SET_REPEAT_PROFILE    0x04
+#define CONTROL_ENABLE_REPEAT_PROFILE 0x05 /* enabled, clamp */
+#define CONTROL_DUMP_KEY_STATS        0x06
+
+#define CONTROL_QUEUE_SIZE 4
+#define CONTROL_MAX_SIZE   8
+
+#define TELEMETRY_UUID(n) \
+	BT_UUID_128_ENCODE(0x7674627a, 0x0000 + (n), 0x4c4b, 0x8201, \
+	                   0x564554424c45)
+
+static const struct bt_uuid_128 service_uuid =
+	BT_UUID_INIT_128(TELEMETRY_UUID(0));
+static const struct bt_uuid_128 counters_uuid =
+	BT_UUID_INIT_128(TELEMETRY_UUID(1));
+static const struct bt_uuid_128 histogram_uuid =
+	BT_UUID_INIT_128(TELEMETRY_UUID(2));
+static const struct bt_uuid_128 link_uuid =
+	BT_UUID_INIT_128(TELEMETRY_UUID(3));
+static const struct bt_uuid_128 control_uuid =
+	BT_UUID_INIT_128(TELEMETRY_UUID(4));
+static const struct bt_uuid_128 line_uuid =
+	BT_UUID_INIT_128(TELEMETRY_UUID(5));
+static const struct bt_uuid_128 keys_uuid =
+	BT_UUID_INIT_128(TELEMETRY_UUID(6));
+static const struct bt_uuid_128 boot_uuid =
+	BT_UUID_INIT_128(TELEMETRY_UUID(7));
+
+struct control_request {
+	uint8_t size;
+	uint8_t buf[CONTROL_MAX_SIZE];
+};
+
+static bool started;
+static struct k_work control_work;
+
+K_MSGQ_DEFINE(control_msgq, sizeof(struct control_request),
+              CONTROL_QUEUE_SIZE, 1);
+
+static void
+link_record(uint8_t *record)
+{
+	struct link_stats stats;
+
+	bluetooth_link_stats_get(&stats);
+
+	record[0] = stats.connected;
+	record[1] = stats.security;
+	sys_put_le16(stats.interval, &record[2]);
+	sys_put_le16(stats.latency, &record[4]);
+	sys_put_le16(stats.timeout, &record[6]);
+	sys_put_le32(stats.reports, &record[8]);
+	sys_put_le16(MIN(stats.disconnects, UINT16_MAX), &record[12]);
+	record[14] = stats.profile;
+	sys_put_le32(stats.setup_us, &record[15]);
+}
+
+static ssize_t
+read_link(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf,
+          uint16_t len, uint16_t offset)
+{
+	uint8_t record[LINK_RECORD_SIZE];
+
+	link_record(record);
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, record,
+	                         sizeof(record));
+}
+
+static ssize_t
+read_boot(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf,
+          uint16_t len, uint16_t offset)
+{
+	uint8_t record[BOOT_RECORD_SIZE];
+
+	for (int phase = 0; phase < NUM_BOOT_PHASES; phase++) {
+		int64_t us = metrics_boot_phase_get(phase);
+
+		sys_put_le32(us < 0 ? UINT32_MAX : MIN(us, UINT32_MAX - 1),
+		             &record[4 * phase]);
+	}
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, record,
+	                         sizeof(record));
+}
+
+static ssize_t
+write_control(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+              const void *buf, uint16_t len, uint16_t offset, uint8_t flags)
+{
+	ARG_UNUSED(conn);
+	ARG_UNUSED(attr);
+	ARG_UNUSED(flags);
+
+	struct control_request request;
+
+	if (offset != 0) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+	if (len == 0 || len > sizeof(request.buf)) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	/* Requests are carried out on the low-priority work queue, which may
+	 * block on the instance lock or on HCI commands. Neither is allowed on
+	 * the Bluetooth RX thread this is called from. */
+	request.size = len;
+	memcpy(request.buf, buf, len);
+	if (k_msgq_put(&control_msgq, &request, K_NO_WAIT) != 0) {
+		return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+	}
+	k_work_submit_to_queue(&background_work_q, &control_work);
+
+	return len;
+}
+
+BT_GATT_SERVICE_DEFINE(telemetry_svc,
+	BT_GATT_PRIMARY_SERVICE(&service_uuid),
+	BT_GATT_CHARACTERISTIC(&counters_uuid.uuid, BT_GATT_CHRC_NOTIFY,
+	                       BT_GATT_PERM_NONE, NULL, NULL, NULL),
+	BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+	BT_GATT_CHARACTERISTIC(&histogram_uuid.uuid, BT_GATT_CHRC_NOTIFY,
+	                       BT_GATT_PERM_NONE, NULL, NULL, NULL),
+	BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+	BT_GATT_CHARACTERISTIC(&link_uuid.uuid,
+	                       BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+	                       BT_GATT_PERM_READ, read_link, NULL, NULL),
+	BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+	BT_GATT_CHARACTERISTIC(&control_uuid.uuid, BT_GATT_CHRC_WRITE,
+	                       BT_GATT_PERM_WRITE_ENCRYPT, NULL,
+	                       write_control, NULL),
+	BT_GATT_CHARACTERISTIC(&line_uuid.uuid, BT_GATT_CHRC_NOTIFY,
+	                       BT_GATT_PERM_NONE, NULL, NULL, NULL),
+	BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+	BT_GATT_CHARACTERISTIC(&keys_uuid.uuid, BT_GATT_CHRC_NOTIFY,
+	                       BT_GATT_PERM_NONE, NULL, NULL, NULL),
+	BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+	BT_GATT_CHARACTERISTIC(&boot_uuid.uuid, BT_GATT_CHRC_READ,
+	                       BT_GATT_PERM_READ, read_boot, NULL, NULL),
+);
+
+/* Value attributes of the characteristics in telemetry_svc. */
+#define COUNTERS_ATTR  (&telemetry_svc.attrs[2])
+#define HISTOGRAM_ATTR (&telemetry_svc.attrs[5])
+#define LINK_ATTR      (&telemetry_svc.attrs[8])
+#define LINE_ATTR      (&telemetry_svc.attrs[13])
+#define KEYS_ATTR      (&telemetry_svc.attrs[16])
+
+static void
+counters_record(struct vtbt *vt, uint8_t *record)
+{
+	const struct latency_stats *latency = &vt->key_latency;
+
+	/* Read without the instance lock, so a record may mix values from
+	 * just before and just after an update. */
+	record[0] = vt->id;
+	record[1] = k_msgq_num_used_get(&vt->host_msgq);
+	record[2] = atomic_get(&vt->host_msgq_max);
+	record[3] = k_msgq_num_used_get(&vt->msgq);
+	record[4] = atomic_get(&vt->msgq_max);
+	sys_put_le16(MIN(atomic_get(&vt->events_dropped), UINT16_MAX),
+	             &record[5]);
+	sys_put_le16(uart_journal_depth_get(&vt->uart), &record[7]);
+	sys_put_le16(MIN(uart_journal_overflow_count_get(&vt->uart),
+	                 UINT16_MAX), &record[9]);
+	sys_put_le32(latency->count, &record[11]);
+	sys_put_le16(MIN(latency_stats_avg_us(latency), UINT16_MAX),
+	             &record[15]);
+	sys_put_le16(MIN(latency->max_us, UINT16_MAX), &record[17]);
+}
+
+static void
+histogram_record(struct vtbt *vt, uint8_t *record)
+{
+	record[0] = vt->id;
+	record[1] = LATENCY_HISTOGRAM_BUCKETS;
+	for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+		sys_put_le16(MIN(vt->key_latency.histogram[i], UINT16_MAX),
+		             &record[2 + 2 * i]);
+	}
+}
+
+static void
+line_record(struct vtbt *vt, enum line_class line_class, uint8_t *record)
+{
+	const struct line_stats *stats =
+		uart_line_stats_get(&vt->uart, line_class);
+
+	record[0] = vt->id;
+	record[1] = line_class;
+	sys_put_le32(stats->bytes, &record[2]);
+	sys_put_le32(stats->dropped, &record[6]);
+	sys_put_le16(MIN(latency_stats_avg_us(&stats->delay), UINT16_MAX),
+	             &record[10]);
+	sys_put_le16(MIN(stats->delay.max_us, UINT16_MAX), &record[12]);
+}
+
+static void
+notify_work_handler(struct k_work *work)
+{
+	uint8_t counters[COUNTERS_RECORD_SIZE];
+	uint8_t histogram[HISTOGRAM_RECORD_SIZE];
+	uint8_t link[LINK_RECORD_SIZE];
+	uint8_t line[LINE_RECORD_SIZE];
+
+	/* bt_gatt_notify() only sends to subscribed clients. */
+	for (int i = 0; i < NUM_VT_PORTS; i++) {
+		counters_record(&vtbt_instances[i], counters);
+		bt_gatt_notify(NULL, COUNTERS_ATTR, counters, sizeof(counters));
+		histogram_record(&vtbt_instances[i], histogram);
+		bt_gatt_notify(NULL, HISTOGRAM_ATTR, histogram,
+		               sizeof(histogram));
+		for (int j = 0; j < NUM_LINE_CLASSES; j++) {
+			line_record(&vtbt_instances[i], j, line);
+			bt_gatt_notify(NULL, LINE_ATTR, line, sizeof(line));
+		}
+	}
+	link_record(link);
+	bt_gatt_notify(NULL, LINK_ATTR, link, sizeof(link));
+
+	k_work_schedule_for_queue(&background_work_q,
+	                          k_work_delayable_from_work(work),
+	                          K_MSEC(CONFIG_VTBT_TELEMETRY_INTERVAL_MS));
+}
+
+K_WORK_DELAYABLE_DEFINE(notify_work, notify_work_handler);
+
+static int
+set_repeat(const struct control_request *request)
+{
+	if (request->size != 6) {
+		return -1;
+	}
+
+	int port = request->buf[1];
+	int buffer = request->buf[2];
+	int timeout = sys_get_le16(&request->buf[3]);
+	int rate = request->buf[5];
+
+	/* The ranges the terminal can set. */
+	if (port >= NUM_VT_PORTS || buffer >= NUM_REPEAT_BUFFERS ||
+	    timeout > 0x7f * 5 || rate == 0 || rate > 0x7f) {
+		return -1;
+	}
+
+	struct vtbt *vt = &vtbt_instances[port];
+
+	k_mutex_lock(&vt->lock, K_FOREVER);
+	lk201_repeat_buffer_get(&vt->lk201, buffer)->timeout = timeout;
+	lk201_repeat_buffer_get(&vt->lk201, buffer)->rate = rate;
+	if (IS_ENABLED(CONFIG_VTBT_WARM_BOOT)) {
+		retained_save(vt);
+	}
+	k_mutex_unlock(&vt->lock);
+
+	LOG_INF("vt%d: repeat buffer %d set to %d ms, %d/s", port, buffer,
+	        timeout, rate);
+
+	return 0;
+}
+
+static int
+set_repeat_profile(const struct control_request *request)
+{
+	if (request->size != 8) {
+		return -1;
+	}
+
+	int division = request->buf[1];
+	struct repeat_override override = {
+		.timeout = sys_get_le16(&request->buf[2]),
+		.rate = request->buf[4],
+		.rate_max = request->buf[5],
+		.accel_ms = sys_get_le16(&request->buf[6]),
+	};
+
+	/* Divisions are numbered as in the LK201 protocol. */
+	if (division == 0 ||
+	    repeat_profile_division_set(division - 1, &override) < 0) {
+		return -1;
+	}
+
+	LOG_INF("Repeat profile division %d set to %u ms, %u/s to %u/s over "
+	        "%u ms", division, override.timeout, override.rate,
+	        override.rate_max, override.accel_ms);
+
+	return 0;
+}
+
+static void
+reset_stats(void)
+{
+	for (int i = 0; i < NUM_VT_PORTS; i++) {
+		struct vtbt *vt = &vtbt_instances[i];
+
+		k_mutex_lock(&vt->lock, K_FOREVER);
+		memset(&vt->key_latency, 0, sizeof(vt->key_latency));
+		memset(&vt->inhibit_latency, 0, sizeof(vt->inhibit_latency));
+		uart_line_stats_reset(&vt->uart);
+		atomic_clear(&vt->host_msgq_max);
+		atomic_clear(&vt->msgq_max);
+		atomic_clear(&vt->events_dropped);
+		k_mutex_unlock(&vt->lock);
+	}
+}
+
+/* Every key that was used, the dwell histograms and the flush statistics, as
+ * a burst of notifications. */
+static void
+dump_key_stats(void)
+{
+	const struct key_counts *counts = key_stats_counts_get();
+	struct key_stats_flush flush;
+	uint8_t record[MAX(KEY_RECORD_SIZE,
+	                   MAX(DWELL_RECORD_SIZE, FLUSH_RECORD_SIZE))];
+
+	for (int keycode = 0; keycode < NUM_KEYS; keycode++) {
+		if (counts[keycode].presses == 0 &&
+		    counts[keycode].repeats == 0) {
+			continue;
+		}
+		record[0] = KEY_STATS_KEY;
+		record[1] = keycode;
+		sys_put_le32(counts[keycode].presses, &record[2]);
+		sys_put_le32(counts[keycode].repeats, &record[6]);
+		bt_gatt_notify(NULL, KEYS_ATTR, record, KEY_RECORD_SIZE);
+	}
+
+	for (int division = 0; division < NUM_DIVISIONS; division++) {
+		const uint32_t *dwell = key_stats_dwell_get(division);
+
+		for (int first = 0; first < KEY_STATS_DWELL_BUCKETS;
+		     first += DWELL_BUCKETS_PER_RECORD) {
+			record[0] = KEY_STATS_DWELL;
+			/* Numbered as in the LK201 protocol. */
+			record[1] = division + 1;
+			record[2] = first;
+			for (int i = 0; i < DWELL_BUCKETS_PER_RECORD; i++) {
+				sys_put_le32(dwell[first + i],
+				             &record[3 + 4 * i]);
+			}
+			bt_gatt_notify(NULL, KEYS_ATTR, record,
+			               DWELL_RECORD_SIZE);
+		}
+	}
+
+	key_stats_flush_get(&flush);
+	record[0] = KEY_STATS_FLUSH;
+	sys_put_le32(flush.flushes, &record[1]);
+	sys_put_le16(MIN(flush.deferrals, UINT16_MAX), &record[5]);
+	sys_put_le32(flush.bytes, &record[7]);
+	sys_put_le16(MIN(flush.max_ms, UINT16_MAX), &record[11]);
+	sys_put_le16(MIN(flush.key_latency.count, UINT16_MAX), &record[13]);
+	sys_put_le16(MIN(latency_stats_avg_us(&flush.key_latency),
+	                 UINT16_MAX), &record[15]);
+	sys_put_le16(MIN(flush.key_latency.max_us, UINT16_MAX), &record[17]);
+	bt_gatt_notify(NULL, KEYS_ATTR, record, FLUSH_RECORD_SIZE);
+}
+
+static void
+control_work_handler(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	struct control_request request;
+	int ret;
+
+	while (k_msgq_get(&control_msgq, &request, K_NO_WAIT) == 0) {
+		switch (request.buf[0]) {
+			case CONTROL_SET_REPEAT:
+				ret = set_repeat(&request);
+				break;
+			case CONTROL_SET_LINK_PROFILE:
+				ret = (request.size == 2) ?
+				      bluetooth_link_profile_set(request.buf[1]) :
+				      -1;
+				break;
+			case CONTROL_RESET_STATS:
+				reset_stats();
+				ret = 0;
+				break;
+			case CONTROL_SET_REPEAT_PROFILE:
+				ret = IS_ENABLED(CONFIG_VTBT_REPEAT_PROFILE) ?
+				      set_repeat_profile(&request) : -1;
+				break;
+			case CONTROL_ENABLE_REPEAT_PROFILE:
+				if (!IS_ENABLED(CONFIG_VTBT_REPEAT_PROFILE) ||
+				    request.size != 3) {
+					ret = -1;
+					break;
+				}
+				repeat_profile_enable(request.buf[1],
+				                      request.buf[2]);
+				ret = 0;
+				break;
+			case CONTROL_DUMP_KEY_STATS:
+				if (!IS_ENABLED(CONFIG_VTBT_KEY_STATS)) {
+					ret = -1;
+					break;
+				}
+				dump_key_stats();
+				ret = 0;
+				break;
+			default:
+				ret = -1;
+				break;
+		}
+		if (ret < 0) {
+			LOG_ERR("Control request 0x%02x failed",
+			        request.buf[0]);
+		}
+	}
+}
+
+static const struct bt_data ad[] = {
+	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+	BT_DATA_BYTES(BT_DATA_UUID128_ALL, TELEMETRY_UUID(0)),
+};
+
+static const struct bt_data sd[] = {
+	BT_DATA(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME,
+	        sizeof(CONFIG_BT_DEVICE_NAME) - 1),
+};
+
+static void
+advertise_work_handler(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	int err = bt_le_adv_start(BT_LE_ADV_CONN, ad, ARRAY_SIZE(ad), sd,
+	                          ARRAY_SIZE(sd));
+	if (err && err != -EALREADY) {
+		LOG_ERR("Advertising failed to start (err %d)", err);
+	}
+}
+
+K_WORK_DEFINE(advertise_work, advertise_work_handler);
+
+static void
+recycled(void)
+{
+	/* A connection object is free again, so a telemetry client can
+	 * connect once more. Advertising is stopped by a connection. */
+	if (started) {
+		k_work_submit_to_queue(&background_work_q, &advertise_work);
+	}
+}
+
+BT_CONN_CB_DEFINE(telemetry_conn_callbacks) = {
+	.recycled = recycled,
+};
+
+void
+telemetry_start(void)
+{
+	k_work_init(&control_work, control_work_handler);
+	k_work_submit_to_queue(&background_work_q, &advertise_work);
+	k_work_schedule_for_queue(&background_work_q, &notify_work,
+	                          K_MSEC(CONFIG_VTBT_TELEMETRY_INTERVAL_MS));
+	started = true;
+}
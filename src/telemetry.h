@@ -0,0 +1,20 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+/* A GATT service for watching and tuning the vtbt from a laptop while it
+ * serves terminals. The vtbt advertises as a peripheral alongside its central
+ * connection to the keyboard. Subscribers get notifications with each
+ * instance's counters, key latency histogram and line statistics, and with
+ * the state of the keyboard link. Writes to the control characteristic
+ * override repeat buffers, change the repeat profile, select a link profile,
+ * reset the statistics or ask for the lifetime key statistics. All the work
+ * is done on a thread below the vtbt's own threads, so keystrokes aren't
+ * delayed.
+ *
+ * The record layouts are little-endian and described in
+ * scripts/telemetry_client.py, which is a client for the service. */
+
+/* Start advertising the service. Called once Bluetooth is ready. */
+void telemetry_start(void);
+
+#endif /* TELEMETRY_H */
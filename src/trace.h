@@ -0,0 +1,34 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Named trace points on the keystroke path, emitted through Zephyr's tracing
+ * subsystem as named events. Names are kept short enough for the CTF backend's
+ * bounded strings. Without CONFIG_VTBT_TRACING the arguments aren't evaluated
+ * and the trace points compile to nothing. */
+
+#ifdef CONFIG_VTBT_TRACING
+
+#include <zephyr/tracing/tracing.h>
+
+#define VTBT_TRACE(name, arg0, arg1) \
+	sys_trace_named_event(name, (uint32_t)(arg0), (uint32_t)(arg1))
+
+#else
+
+#define VTBT_TRACE(name, arg0, arg1) \
+	do { \
+		if (0) { \
+			(void)(arg0); \
+			(void)(arg1); \
+		} \
+	} while (0)
+
+#endif
+
+/* Emitted once at startup so that the addresses of kernel objects seen in the
+ * object tracking events can be matched to their names in a trace viewer. */
+#define VTBT_TRACE_OBJECT(name, obj) VTBT_TRACE(name, (uintptr_t)(obj), 0)
+
+#endif /* TRACE_H */
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include <zephyr/kernel.h>
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/drivers/uart.h>
@@ -5,109 +7,211 @@
 #include <zephyr/sys/ring_buffer.h>
 
 #include "uart.h"
+#include "lk201.h"
+#include "metrics.h"
+#include "trace.h"
+#include "iram.h"
 
 LOG_MODULE_REGISTER(uart, CONFIG_LOG_DEFAULT_LEVEL);
 
-#define UART_DEVICE_NODE DT_CHOSEN(zephyr_vt_uart)
+/* Waits for TX buffer space are bounded and their condition re-tested. A
+ * writer, uart_inhibit() and uart_flush() can wait at once, and the last give
+ * before the TX interrupt is disabled only wakes one of them. A writer that
+ * is about to wait when the UART gets locked also has to see the lock. */
+#define TX_SPACE_WAIT K_MSEC(5)
+
+static VTBT_IRAM_ATTR enum line_class
+line_class_get(unsigned char c)
+{
+	switch (c) {
+		case SPECIAL_KEYBOARD_ID_FIRMWARE:
+		case SPECIAL_KEYBOARD_ID_HARDWARE:
+		case SPECIAL_KEY_DOWN_ON_POWER_UP_ERROR:
+		case SPECIAL_POWER_UP_SELF_TEST_ERROR:
+		case SPECIAL_OUTPUT_ERROR:
+		case SPECIAL_INPUT_ERROR:
+		case SPECIAL_KBD_LOCKED_ACK:
+		case SPECIAL_TEST_MODE_ACK:
+		case SPECIAL_PREFIX_TO_KEYS_DOWN:
+		case SPECIAL_MODE_CHANGE_ACK:
+			return LINE_CLASS_SPECIAL;
+		case SPECIAL_METRONOME:
+			return LINE_CLASS_METRONOME;
+		default:
+			return LINE_CLASS_KEY;
+	}
+}
+
+/* Called with tx_lock held for each byte put in the TX buffer. */
+static VTBT_IRAM_ATTR void
+tx_meta_push(struct vt_uart *uart, enum line_class line_class)
+{
+	struct tx_meta *meta = &uart->tx_meta[uart->tx_meta_in];
+
+	meta->line_class = line_class;
+	meta->time = k_uptime_ticks();
+	uart->tx_meta_in = (uart->tx_meta_in + 1) % UART_TX_BUF_SIZE;
+}
+
+/* Called with tx_lock held. Moves bytes from a buffer of bytes written while
+ * locked into the TX buffer, as far as it has room. */
+static VTBT_IRAM_ATTR void
+backlog_move(struct vt_uart *uart, struct ring_buf *from)
+{
+	uint8_t c;
+
+	while (ring_buf_space_get(&uart->tx_buf) > 0 &&
+	       ring_buf_get(from, &c, 1) == 1) {
+		ring_buf_put(&uart->tx_buf, &c, 1);
+		tx_meta_push(uart, line_class_get(c));
+	}
+}
+
+/* Called from the TX interrupt. While unlocked, the bytes written while locked
+ * are sent from here a few at a time: first the hold buffer, then the
+ * journal. Locking the UART again stops them where they are. */
+static VTBT_IRAM_ATTR void
+backlog_refill(struct vt_uart *uart)
+{
+	k_spinlock_key_t key = k_spin_lock(&uart->tx_lock);
 
-/* 4-byte TX buffer, just like on the LK201. */
-RING_BUF_DECLARE(tx_buf, 4);
+	if (!atomic_get(&uart->locked)) {
+		backlog_move(uart, &uart->hold_buf);
+#ifdef CONFIG_VTBT_TYPEAHEAD_JOURNAL
+		backlog_move(uart, &uart->journal_buf);
+#endif
+	}
 
-/* Given by TX callback when new space is available in the TX buffer. */
-K_SEM_DEFINE(tx_space_sem, 0, 1);
+	k_spin_unlock(&uart->tx_lock, key);
+}
 
-static const struct device *const uart_dev = DEVICE_DT_GET(UART_DEVICE_NODE);
+/* Called with tx_lock held. */
+static VTBT_IRAM_ATTR bool
+backlog_is_empty(struct vt_uart *uart)
+{
+#ifdef CONFIG_VTBT_TYPEAHEAD_JOURNAL
+	if (!ring_buf_is_empty(&uart->journal_buf)) {
+		return false;
+	}
+#endif
+	return ring_buf_is_empty(&uart->hold_buf);
+}
 
-/* Enable the RS-423 driver. It is disabled by default in order to prevent
- * transmission of bootloader, etc. output from the devkit. */
-static const struct gpio_dt_spec uart_tx_enable =
-	GPIO_DT_SPEC_GET_OR(DT_NODELABEL(uart_tx_enable), gpios, {0});
+/* Called from the TX interrupt for bytes that left the TX buffer. */
+static VTBT_IRAM_ATTR void
+tx_meta_pop(struct vt_uart *uart, int count)
+{
+	int64_t now = k_uptime_ticks();
 
-static serial_cb user_callback = NULL;
+	while (count--) {
+		struct tx_meta *meta = &uart->tx_meta[uart->tx_meta_out];
+		struct line_stats *stats = &uart->line_stats[meta->line_class];
 
-static atomic_t locked;
-static bool overflow;
+		stats->bytes++;
+		latency_stats_add(&stats->delay, now - meta->time);
+		uart->tx_meta_out = (uart->tx_meta_out + 1) % UART_TX_BUF_SIZE;
+	}
+}
 
-static void
-callback_tx(void)
+static VTBT_IRAM_ATTR void
+callback_tx(struct vt_uart *uart)
 {
 	uint32_t size;
 	int filled_size;
 	uint8_t *data;
 
-	if (atomic_get(&locked)) {
-		uart_irq_tx_disable(uart_dev);
-		return;
-	}
-
-	while (!ring_buf_is_empty(&tx_buf)) {
-		size = ring_buf_get_claim(&tx_buf, &data, 4);
-		filled_size = uart_fifo_fill(uart_dev, data, size);
-		if (filled_size < 0) {
-			ring_buf_get_finish(&tx_buf, 0);
+	backlog_refill(uart);
+	while (!ring_buf_is_empty(&uart->tx_buf)) {
+		size = ring_buf_get_claim(&uart->tx_buf, &data,
+		                          UART_TX_BUF_SIZE);
+		filled_size = uart_fifo_fill(uart->dev, data, size);
+		if (filled_size <= 0) {
+			/* The FIFO is full. Leave TX enabled so this is called
+			 * again when there's room. */
+			ring_buf_get_finish(&uart->tx_buf, 0);
 			return;
 		}
-		int ret = ring_buf_get_finish(&tx_buf, (uint32_t)filled_size);
-		if (filled_size > 0) {
-			k_sem_give(&tx_space_sem);
-		}
+		int ret = ring_buf_get_finish(&uart->tx_buf,
+		                              (uint32_t)filled_size);
+		tx_meta_pop(uart, filled_size);
+		backlog_refill(uart);
+		VTBT_TRACE("uart_tx_isr", filled_size,
+		           ring_buf_size_get(&uart->tx_buf));
+		metrics_boot_phase_mark(BOOT_PHASE_FIRST_TX);
+		k_sem_give(&uart->tx_space_sem);
 		if (ret < 0) {
 			return;
 		}
 	}
 
-	uart_irq_tx_disable(uart_dev);
+	uart_irq_tx_disable(uart->dev);
 }
 
-static void
-callback_rx(void)
+static VTBT_IRAM_ATTR void
+callback_rx(struct vt_uart *uart)
 {
 	uint8_t c;
 
 	/* read until FIFO empty */
-	while (uart_fifo_read(uart_dev, &c, 1) == 1) {
-		if (user_callback) {
-			user_callback(c);
+	while (uart_fifo_read(uart->dev, &c, 1) == 1) {
+		if (uart->rx_callback) {
+			uart->rx_callback(c, uart->rx_user_data);
 		}
 	}
 }
 
 
-static void
+static VTBT_IRAM_ATTR void
 callback(const struct device *dev, void *user_data)
 {
-	ARG_UNUSED(dev);
-	ARG_UNUSED(user_data);
+	struct vt_uart *uart = user_data;
 
-	if (uart_irq_update(uart_dev) < 0) {
+	if (uart_irq_update(dev) < 0) {
 		return;
 	}
 
-	if (uart_irq_tx_ready(uart_dev) > 0) {
-		callback_tx();
+	if (uart_irq_tx_ready(dev) > 0) {
+		callback_tx(uart);
 	}
 
-	if (uart_irq_rx_ready(uart_dev) > 0) {
-		callback_rx();
+	if (uart_irq_rx_ready(dev) > 0) {
+		callback_rx(uart);
 	}
 }
 
 int
-uart_init(void)
+uart_init(struct vt_uart *uart)
 {
 	int ret;
 
-	if (!device_is_ready(uart_dev)) {
+	ring_buf_init(&uart->tx_buf, sizeof(uart->tx_buf_data),
+	              uart->tx_buf_data);
+	k_sem_init(&uart->tx_space_sem, 0, 1);
+	ring_buf_init(&uart->hold_buf, sizeof(uart->hold_buf_data),
+	              uart->hold_buf_data);
+#ifdef CONFIG_VTBT_TYPEAHEAD_JOURNAL
+	ring_buf_init(&uart->journal_buf, sizeof(uart->journal_buf_data),
+	              uart->journal_buf_data);
+#endif
+
+	VTBT_TRACE_OBJECT("tx_space_sem", &uart->tx_space_sem);
+
+	if (!device_is_ready(uart->dev)) {
 		LOG_ERR("UART device not found");
 		return -1;
 	}
 
-	if (!gpio_is_ready_dt(&uart_tx_enable)) {
+	/* Not every port has a driver enable pin. */
+	if (uart->tx_enable.port == NULL) {
+		return 0;
+	}
+
+	if (!gpio_is_ready_dt(&uart->tx_enable)) {
 		LOG_ERR("UART TX enable pin GPIO port is not ready.");
 		return -1;
 	}
 
-	ret = gpio_pin_configure_dt(&uart_tx_enable, GPIO_OUTPUT_ACTIVE);
+	ret = gpio_pin_configure_dt(&uart->tx_enable, GPIO_OUTPUT_ACTIVE);
 	if (ret != 0) {
 		LOG_ERR("Configuring GPIO pin failed: %d", ret);
 		return -1;
@@ -117,13 +221,15 @@ uart_init(void)
 }
 
 int
-uart_set_rx_callback(serial_cb serial_cb)
+uart_set_rx_callback(struct vt_uart *uart, serial_cb serial_cb,
+                     void *user_data)
 {
 	int ret;
 
-	user_callback = serial_cb;
+	uart->rx_callback = serial_cb;
+	uart->rx_user_data = user_data;
 
-	ret = uart_irq_callback_user_data_set(uart_dev, callback, NULL);
+	ret = uart_irq_callback_user_data_set(uart->dev, callback, uart);
 	if (ret < 0) {
 		if (ret == -ENOTSUP) {
 			LOG_ERR("Interrupt-driven UART not enabled");
@@ -134,84 +240,262 @@ uart_set_rx_callback(serial_cb serial_cb)
 		}
 		return -1;
 	}
-	uart_irq_rx_enable(uart_dev);
+	uart_irq_rx_enable(uart->dev);
 	return 0;
 }
 
-int
-uart_write_byte(unsigned char out_char)
+/* Called with tx_lock held. Returns the number of bytes that fit in the
+ * journal. */
+static VTBT_IRAM_ATTR uint32_t
+journal_append(struct vt_uart *uart, const unsigned char buf[], size_t count)
+{
+#ifdef CONFIG_VTBT_TYPEAHEAD_JOURNAL
+	uint32_t wrote = ring_buf_put(&uart->journal_buf, buf, count);
+	uint32_t depth = ring_buf_size_get(&uart->journal_buf);
+
+	if (depth > uart->journal_depth_max) {
+		uart->journal_depth_max = depth;
+	}
+
+	return wrote;
+#else
+	ARG_UNUSED(uart);
+	ARG_UNUSED(buf);
+	ARG_UNUSED(count);
+
+	return 0;
+#endif
+}
+
+/* Called when locked and the hold buffer is full. Returns the number of bytes
+ * kept for transmission after the UART is unlocked. */
+static VTBT_IRAM_ATTR uint32_t
+journal_put(struct vt_uart *uart, const unsigned char buf[], size_t count)
 {
-	while (ring_buf_put(&tx_buf, &out_char, 1) < 1) {
-		if (atomic_get(&locked)) {
-			overflow = true;
-			return 0;
+	uint32_t wrote = journal_append(uart, buf, count);
+
+	if (wrote < count) {
+		uart->overflow = true;
+#ifdef CONFIG_VTBT_TYPEAHEAD_JOURNAL
+		uart->journal_overflow_count += count - wrote;
+#endif
+	}
+
+	return wrote;
+}
+
+/* Put bytes in the TX buffer, or in the hold buffer and journal when locked.
+ * While bytes written while locked are still waiting to be sent, new bytes
+ * queue behind them in the journal. Returns the number of bytes taken and sets
+ * held if they were held. */
+static VTBT_IRAM_ATTR uint32_t
+tx_put(struct vt_uart *uart, const unsigned char buf[], size_t count,
+       bool *held)
+{
+	k_spinlock_key_t key = k_spin_lock(&uart->tx_lock);
+	uint32_t wrote;
+
+	*held = atomic_get(&uart->locked);
+	if (*held) {
+		/* The hold buffer is sent first, so it can only take bytes
+		 * when nothing is journaled from before. */
+		wrote = backlog_is_empty(uart) ?
+			ring_buf_put(&uart->hold_buf, buf, count) : 0;
+		if (wrote < count) {
+			wrote += journal_put(uart, &buf[wrote], count - wrote);
+		}
+	} else if (!backlog_is_empty(uart)) {
+		wrote = journal_append(uart, buf, count);
+	} else {
+		wrote = ring_buf_put(&uart->tx_buf, buf, count);
+		for (uint32_t i = 0; i < wrote; i++) {
+			tx_meta_push(uart, line_class_get(buf[i]));
 		}
-		k_sem_take(&tx_space_sem, K_FOREVER);
 	}
-	uart_irq_tx_enable(uart_dev);
-	return 1;
+
+	k_spin_unlock(&uart->tx_lock, key);
+
+	return wrote;
 }
 
-int
-uart_write(const unsigned char buf[], size_t count)
+VTBT_IRAM_ATTR int
+uart_write_byte(struct vt_uart *uart, unsigned char out_char)
+{
+	VTBT_TRACE("uart_write", out_char, atomic_get(&uart->locked));
+
+	return uart_write(uart, &out_char, 1);
+}
+
+VTBT_IRAM_ATTR int
+uart_write(struct vt_uart *uart, const unsigned char buf[], size_t count)
 {
 	uint32_t total = 0;
-	while (true) {
-		uint32_t wrote = ring_buf_put(
-			&tx_buf, &buf[total], count - total);
-		if (atomic_get(&locked)) {
-			if (wrote < count) {
-				overflow = true;
-			}
-			return (int)wrote;
+	bool held;
+
+	while (total < count) {
+		uint32_t wrote = tx_put(uart, &buf[total], count - total,
+		                        &held);
+		total += wrote;
+		if (held) {
+			return (int)total;
 		}
 		if (wrote > 0) {
-			uart_irq_tx_enable(uart_dev);
+			uart_irq_tx_enable(uart->dev);
 		}
-		total += wrote;
-		if (total >= count) {
-			break;
+		if (total < count) {
+			k_sem_take(&uart->tx_space_sem, TX_SPACE_WAIT);
 		}
-		k_sem_take(&tx_space_sem, K_FOREVER);
 	}
 
 	return count;
 }
 
+VTBT_IRAM_ATTR int
+uart_write_metronome(struct vt_uart *uart, unsigned char out_char)
+{
+	k_spinlock_key_t key = k_spin_lock(&uart->tx_lock);
+	/* Bytes in the UART's own FIFO count too. Drivers that can't tell
+	 * are taken to be idle. */
+	bool idle = !atomic_get(&uart->locked) &&
+	            ring_buf_is_empty(&uart->tx_buf) &&
+	            backlog_is_empty(uart) &&
+	            uart_irq_tx_complete(uart->dev) != 0;
+
+	if (idle) {
+		ring_buf_put(&uart->tx_buf, &out_char, 1);
+		tx_meta_push(uart, LINE_CLASS_METRONOME);
+	} else {
+		uart->line_stats[LINE_CLASS_METRONOME].dropped++;
+	}
+
+	k_spin_unlock(&uart->tx_lock, key);
+
+	VTBT_TRACE("uart_metronome", out_char, idle);
+	if (!idle) {
+		return 0;
+	}
+
+	uart_irq_tx_enable(uart->dev);
+
+	return 1;
+}
+
 void
-uart_flush(void)
+uart_flush(struct vt_uart *uart)
 {
-	uart_irq_tx_enable(uart_dev);
-	while (!ring_buf_is_empty(&tx_buf)) {
-		k_sem_take(&tx_space_sem, K_FOREVER);
+	uart_irq_tx_enable(uart->dev);
+	while (!ring_buf_is_empty(&uart->tx_buf)) {
+		k_sem_take(&uart->tx_space_sem, TX_SPACE_WAIT);
 	}
 }
 
 void
-uart_lock(void)
+uart_lock(struct vt_uart *uart)
 {
-	if (atomic_get(&locked)) {
+	if (atomic_get(&uart->locked)) {
 		return;
 	}
 
-	atomic_set(&locked, 1);
-	overflow = false;
+	atomic_set(&uart->locked, 1);
+	uart->overflow = false;
+}
+
+void
+uart_inhibit(struct vt_uart *uart, unsigned char ack)
+{
+	uint32_t wrote;
+
+	uart_lock(uart);
+
+	while (true) {
+		k_spinlock_key_t key = k_spin_lock(&uart->tx_lock);
+		wrote = ring_buf_put(&uart->tx_buf, &ack, 1);
+		if (wrote == 1) {
+			tx_meta_push(uart, LINE_CLASS_SPECIAL);
+		}
+		k_spin_unlock(&uart->tx_lock, key);
+		if (wrote == 1) {
+			break;
+		}
+		uart_irq_tx_enable(uart->dev);
+		k_sem_take(&uart->tx_space_sem, TX_SPACE_WAIT);
+	}
+
+	uart_flush(uart);
 }
 
 void
-uart_unlock(void)
+uart_unlock(struct vt_uart *uart)
 {
-	if (!atomic_get(&locked)) {
+	if (!atomic_get(&uart->locked)) {
 		return;
 	}
 
-	atomic_set(&locked, 0);
+	k_spinlock_key_t key = k_spin_lock(&uart->tx_lock);
+	atomic_set(&uart->locked, 0);
+	k_spin_unlock(&uart->tx_lock, key);
 
-	uart_flush();
+	/* The TX interrupt sends the hold buffer and the journal. */
+	uart_irq_tx_enable(uart->dev);
 }
 
 bool
-uart_overflow_get(void)
+uart_locked_get(struct vt_uart *uart)
+{
+	return atomic_get(&uart->locked) != 0;
+}
+
+bool
+uart_overflow_get(struct vt_uart *uart)
+{
+	return uart->overflow;
+}
+
+uint32_t
+uart_journal_depth_get(struct vt_uart *uart)
 {
-	return overflow;
+#ifdef CONFIG_VTBT_TYPEAHEAD_JOURNAL
+	return ring_buf_size_get(&uart->journal_buf);
+#else
+	ARG_UNUSED(uart);
+	return 0;
+#endif
+}
+
+uint32_t
+uart_journal_depth_max_get(struct vt_uart *uart)
+{
+#ifdef CONFIG_VTBT_TYPEAHEAD_JOURNAL
+	return uart->journal_depth_max;
+#else
+	ARG_UNUSED(uart);
+	return 0;
+#endif
+}
+
+uint32_t
+uart_journal_overflow_count_get(struct vt_uart *uart)
+{
+#ifdef CONFIG_VTBT_TYPEAHEAD_JOURNAL
+	return uart->journal_overflow_count;
+#else
+	ARG_UNUSED(uart);
+	return 0;
+#endif
+}
+
+const struct line_stats *
+uart_line_stats_get(struct vt_uart *uart, enum line_class line_class)
+{
+	return &uart->line_stats[line_class];
+}
+
+void
+uart_line_stats_reset(struct vt_uart *uart)
+{
+	k_spinlock_key_t key = k_spin_lock(&uart->tx_lock);
+
+	memset(uart->line_stats, 0, sizeof(uart->line_stats));
+
+	k_spin_unlock(&uart->tx_lock, key);
 }
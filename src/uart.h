@@ -1,27 +1,146 @@
 #ifndef UART_H
 #define UART_H
 
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/sys/ring_buffer.h>
+
+#include "metrics.h"
+
 /* This implements an LK201-style UART with a 4-byte TX buffer and flow control
- * via locking. */
+ * via locking.
+ *
+ * Key transitions and special codes go out in the order they were written.
+ * Metronome codes only go out on an idle line and are dropped otherwise, so a
+ * key transition never waits behind auto-repeat traffic. */
+
+/* Size of the TX buffer, just like on the LK201. */
+#define UART_TX_BUF_SIZE 4
+/* Bytes the LK201 keeps while transmission is inhibited. */
+#define UART_HOLD_BUF_SIZE 4
+
+typedef void (*serial_cb)(uint8_t c, void *user_data);
+
+/* Classes of bytes sent on the line. */
+enum line_class {
+	/* Keycodes and ALL UPS. */
+	LINE_CLASS_KEY,
+	/* Acks, errors and keyboard IDs. */
+	LINE_CLASS_SPECIAL,
+	/* Metronome codes and keycodes resent by the auto-repeater. */
+	LINE_CLASS_METRONOME,
+	NUM_LINE_CLASSES,
+};
+
+struct line_stats {
+	uint32_t bytes;
+	/* Metronome codes dropped because the line was busy. */
+	uint32_t dropped;
+	/* From a byte being written to it leaving the TX buffer. */
+	struct latency_stats delay;
+};
+
+/* Class and write time of a byte in the TX buffer. */
+struct tx_meta {
+	enum line_class line_class;
+	int64_t time;
+};
+
+struct vt_uart {
+	const struct device *dev;
+	/* Enables the RS-423 driver. It is disabled by default in order to
+	 * prevent transmission of bootloader, etc. output from the devkit. */
+	struct gpio_dt_spec tx_enable;
 
-typedef void (*serial_cb)(uint8_t c);
+	struct ring_buf tx_buf;
+	uint8_t tx_buf_data[UART_TX_BUF_SIZE];
+	/* One entry per byte in the TX buffer, in the same order. Filled
+	 * under tx_lock and emptied by the TX interrupt. */
+	struct tx_meta tx_meta[UART_TX_BUF_SIZE];
+	uint8_t tx_meta_in;
+	uint8_t tx_meta_out;
+	/* Updated by the TX interrupt, except for drops. */
+	struct line_stats line_stats[NUM_LINE_CLASSES];
+	/* Given by TX callback when new space is available in the TX
+	 * buffer. */
+	struct k_sem tx_space_sem;
+	/* Bytes written while locked. Moved to the TX buffer by the TX
+	 * interrupt once unlocked. */
+	struct ring_buf hold_buf;
+	uint8_t hold_buf_data[UART_HOLD_BUF_SIZE];
+	/* Serializes writers, which may be on different threads. */
+	struct k_spinlock tx_lock;
 
-int uart_init(void);
-int uart_set_rx_callback(serial_cb serial_cb);
+	serial_cb rx_callback;
+	void *rx_user_data;
+
+	atomic_t locked;
+	bool overflow;
+
+#ifdef CONFIG_VTBT_TYPEAHEAD_JOURNAL
+	/* Bytes that didn't fit in the hold buffer while locked, in the order
+	 * they were written, and bytes written after unlocking until it is
+	 * empty. The TX interrupt drains it at line rate while unlocked. */
+	struct ring_buf journal_buf;
+	uint8_t journal_buf_data[CONFIG_VTBT_TYPEAHEAD_JOURNAL_SIZE];
+	uint32_t journal_depth_max;
+	uint32_t journal_overflow_count;
+#endif
+};
+
+/* Static initializer for the devicetree parts of a struct vt_uart. */
+#define VT_UART_DT_INIT(node_id)                                        \
+	{                                                               \
+		.dev = DEVICE_DT_GET(DT_PHANDLE(node_id, uart)),        \
+		.tx_enable = GPIO_DT_SPEC_GET_OR(node_id,               \
+		                                 tx_enable_gpios, {0}), \
+	}
+
+int uart_init(struct vt_uart *uart);
+int uart_set_rx_callback(struct vt_uart *uart, serial_cb serial_cb,
+                         void *user_data);
 
 /* These return the number of bytes written. When unlocked, the functions block
- * until all bytes have been written, but when locked, they return once the TX
- * buffer is full. */
-int uart_write_byte(unsigned char out_char);
-int uart_write(const unsigned char buf[], size_t count);
-
-/* Lock the UART LK201-style. Let the TX buffer fill up. */
-void uart_lock(void);
-/* Unlock the UART and flush the TX buffer, blocking until it is empty. */
-void uart_unlock(void);
+ * until all bytes have been written, but when locked, they return once the
+ * 4-byte hold buffer is full. With CONFIG_VTBT_TYPEAHEAD_JOURNAL, bytes that
+ * don't fit in the hold buffer while locked are journaled and count as
+ * written, and until the journal has been sent after unlocking, bytes written
+ * are queued behind it. Safe to call from several threads. */
+int uart_write_byte(struct vt_uart *uart, unsigned char out_char);
+int uart_write(struct vt_uart *uart, const unsigned char buf[], size_t count);
+/* Write a metronome code or a resent keycode if the line is idle: the UART is
+ * unlocked and nothing is waiting to be sent. Never blocks. Returns 1 if the
+ * byte was written and 0 if it was dropped. */
+int uart_write_metronome(struct vt_uart *uart, unsigned char out_char);
+
+/* Lock the UART LK201-style. Writes fill up the hold buffer. */
+void uart_lock(struct vt_uart *uart);
+/* Lock the UART and send ack after the bytes already in the TX buffer. Writers
+ * blocked on a full TX buffer, and anything written from now on, go to the
+ * hold buffer instead. Blocks until ack has left the TX buffer, after which the
+ * line stays silent until the UART is unlocked. */
+void uart_inhibit(struct vt_uart *uart, unsigned char ack);
+/* Unlock the UART. The hold buffer and the typeahead journal are sent in the
+ * background, and stop where they are if the UART is locked again. Doesn't
+ * block. */
+void uart_unlock(struct vt_uart *uart);
+/* Returns true if the UART is currently locked. */
+bool uart_locked_get(struct vt_uart *uart);
 /* Returns true if an overflow occurred since the keyboard was last locked. */
-bool uart_overflow_get(void);
+bool uart_overflow_get(struct vt_uart *uart);
 /* Flush the TX buffer and block until it is empty. */
-void uart_flush(void);
+void uart_flush(struct vt_uart *uart);
+
+/* Typeahead journal statistics: bytes currently journaled, the high-water mark
+ * since boot and the number of bytes lost to journal overflow. These are
+ * always 0 without CONFIG_VTBT_TYPEAHEAD_JOURNAL. */
+uint32_t uart_journal_depth_get(struct vt_uart *uart);
+uint32_t uart_journal_depth_max_get(struct vt_uart *uart);
+uint32_t uart_journal_overflow_count_get(struct vt_uart *uart);
+
+/* Byte counts and queueing delays of a class of bytes since boot. */
+const struct line_stats *uart_line_stats_get(struct vt_uart *uart,
+                                             enum line_class line_class);
+void uart_line_stats_reset(struct vt_uart *uart);
 
 #endif /* UART_H */
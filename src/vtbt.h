@@ -6,12 +6,20 @@
 #define HID_REPORT_SIZE 8
 #define HID_REPORT_FIRST_KEY 2
 
+/* Bits of the HID keyboard LED output report. */
+#define HID_LED_NUM_LOCK    BIT(0)
+#define HID_LED_CAPS_LOCK   BIT(1)
+#define HID_LED_SCROLL_LOCK BIT(2)
+#define HID_LED_COMPOSE     BIT(3)
+#define HID_LED_KANA        BIT(4)
+
 /* A node for the list of keys currently down */
 struct key_down {
 	sys_dnode_t node;
 	/* LK201 keycode. */
 	int keycode;
-	/* Timestamp from k_uptime_get() when the key was first pressed. */
+	/* Timestamp from k_uptime_ticks() when the key was first pressed, taken
+	 * when the HID report arrived. */
 	int64_t time;
 	/* True if the key has been held long enough to trigger auto-repeat. */
 	bool repeating;
@@ -27,11 +35,22 @@ enum event_source {
 	EVT_HOST,      /* A message from the terminal. */
 	EVT_KEYBOARD,  /* A HID report from the Bluetooth keyboard. */
 	EVT_METRONOME, /* The 1 ms auto-repeat timer has triggered. */
+	EVT_LINK_LOST, /* The keyboard disconnected. */
 };
 
-/* An event for the main thread's event queue. */
+/* Receives an HID report from a keyboard source along with the
+ * k_uptime_ticks() timestamp of its arrival. */
+typedef void (*hid_report_cb_t)(const uint8_t *report, int64_t time,
+                                void *user_data);
+/* Told that a keyboard source went away, with whatever keys it held. */
+typedef void (*link_lost_cb_t)(int64_t time, void *user_data);
+
+/* An event for an instance's event queue. */
 struct event {
 	enum event_source source;
+	/* Timestamp from k_uptime_ticks() taken where the event originated:
+	 * on notification, in the UART ISR or in the metronome timer. */
+	int64_t time;
 	/* Number of used bytes in buf. Always 0 for EVT_METRONOME. */
 	uint8_t size;
 	/* Message from host (EVT_HOST) or HID report (EVT_KEYBOARD). */
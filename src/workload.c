@@ -0,0 +1,927 @@
+/* Realistic typing for soak tests in simulation, on ports whose
+ * keyboard-source is "workload". The generator types a text corpus at
+ * CONFIG_VTBT_WORKLOAD_WPM, often holding a key past the next press for heavy
+ * rollover, with occasional Ctrl chords and long holds of auto-repeating
+ * keys. Its HID reports go through the port's real keyboard, metronome and
+ * UART code, one key transition per report.
+ *
+ * It is also the port's terminal: the emulated UART is drained at the 4800
+ * baud line rate, keyboard transmission is inhibited and resumed at random,
+ * and division modes are changed or the defaults reinstated while no keys are
+ * down. A reference model of the LK201 predicts the keycodes each transition
+ * should send, and the received stream is checked against it for lost,
+ * duplicated and reordered keycodes. The counts, with the events dropped from
+ * the event queue, the exhaustion of the keys-down slab, the bytes lost to
+ * typeahead journal overflow and the metronome codes dropped while the line
+ * was busy, are printed every CONFIG_VTBT_WORKLOAD_REPORT_INTERVAL simulated
+ * seconds, along with their rates per simulated hour.
+ *
+ * The model accepts what the protocol leaves open: metronome codes and acks
+ * are ignored, an auto-repeating key's keycode may be resent while it is held
+ * or shortly after, and keycodes from before an output error may be missing
+ * or resent after it. Runs are repeatable for a given
+ * CONFIG_VTBT_WORKLOAD_SEED. */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/drivers/serial/uart_emul.h>
+
+#include "workload.h"
+
+#include "vtbt.h"
+#include "instance.h"
+#include "keyboard.h"
+#include "lk201.h"
+
+LOG_MODULE_REGISTER(workload, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define DT_DRV_COMPAT vtbt_vt_port
+
+/* Bytes per second at 4800 baud with 8N1 framing. */
+#define LINE_RATE 480
+
+/* Milliseconds per character at five characters a word. */
+#define CHAR_MS (60000 / (5 * CONFIG_VTBT_WORKLOAD_WPM))
+
+#define START_DELAY_MS 1000
+
+/* Shares of typed units that are Ctrl chords and long holds, in percent. */
+#define CHORD_PERCENT 3
+#define HOLD_PERCENT  1
+#define HOLD_MIN_MS   500
+#define HOLD_MAX_MS   3000
+/* From a modifier's press to its key's, and from the key's release to the
+ * modifier's. */
+#define MODIFIER_LAG_MS 15
+
+/* Keys other than modifiers down at once. */
+#define ROLLOVER_MAX 5
+
+#define INHIBIT_INTERVAL_MIN_MS 200
+#define INHIBIT_INTERVAL_MAX_MS 3000
+#define INHIBIT_MIN_MS          10
+#define INHIBIT_MAX_MS          400
+/* Mode changes are made with no keys down and this long without key
+ * transitions on either side, so the model and the keyboard agree on the mode
+ * of every key. */
+#define MODE_CHANGE_INTERVAL_MIN_MS 2000
+#define MODE_CHANGE_INTERVAL_MAX_MS 20000
+#define MODE_CHANGE_QUIET_MS        50
+
+/* An expected keycode not received for this long, not counting time with
+ * transmission inhibited, is lost. */
+#define LOST_AFTER_MS 5000
+/* How many expected keycodes a received one is looked for in. */
+#define MATCH_WINDOW 16
+/* How long after its release, or after an output error, a held key's
+ * keycode may be resent. */
+#define RESEND_GRACE_MS 500
+
+#define TRANSITIONS_MAX 32
+#define EXPECTED_MAX    256
+#define LATE_MAX        32
+
+#define HID_USAGE_A          0x04
+#define HID_USAGE_1          0x1e
+#define HID_USAGE_BACKSPACE  0x2a
+#define HID_USAGE_RIGHT      0x4f
+#define HID_USAGE_LEFT       0x50
+#define HID_USAGE_DOWN       0x51
+#define HID_USAGE_UP         0x52
+/* Usages from Left Ctrl on are the bits of the modifier byte. */
+#define HID_USAGE_LEFT_CTRL  0xe0
+#define HID_USAGE_LEFT_SHIFT 0xe1
+
+/* Characters of the usages from 1 (0x1e) to / (0x38), without and with
+ * Shift. \a marks usages that aren't typed. */
+static const char usage_chars[2][28] = {
+	"1234567890\n\a\a\t -=[]\\\a;'`,./",
+	"!@#$%^&*()\a\a\a\a\a_+{}|\a:\"~<>?",
+};
+
+static const char corpus[] =
+	"The quick brown fox jumps over the lazy dog. "
+	"Pack my box with five dozen liquor jugs! "
+	"How vexingly quick daft zebras jump; sphinx of black quartz, "
+	"judge my vow.\n"
+	"$ grep -n \"key_down\" src/*.c | wc -l\n"
+	"if (len > 0 && buf[len - 1] == '\\n') { buf[--len] = 0; }\n"
+	"Order #4711: 12 x 3.5 mm @ $0.25 = $3.00 (10% off: ~$2.70)\n"
+	"\tWaltz, bad nymph, for quick jigs vex? <Yes> or [no]...\n"
+	"Jackdaws love my big sphinx of quartz; 1234567890 + 0987654321.\n";
+
+/* Keys held long enough to auto-repeat. */
+static const uint8_t hold_usages[] = {
+	HID_USAGE_BACKSPACE,
+	HID_USAGE_RIGHT,
+	HID_USAGE_LEFT,
+	HID_USAGE_DOWN,
+	HID_USAGE_UP,
+	HID_USAGE_A + ('x' - 'a'),
+};
+
+static const uint8_t mode_change_divisions[] = {
+	DIVISION_MAIN_ARRAY,
+	DIVISION_DELETE,
+	DIVISION_RETURN_AND_TAB,
+	DIVISION_SHIFT_AND_CTRL,
+	DIVISION_HORIZONTAL_CURSORS,
+	DIVISION_VERTICAL_CURSORS,
+};
+
+static const uint8_t mode_change_modes[] = {
+	MODE_DOWN_ONLY,
+	MODE_AUTO_REPEAT,
+	MODE_DOWN_UP,
+};
+
+struct transition {
+	int64_t time;
+	uint8_t usage;
+	bool press;
+};
+
+struct expected {
+	int64_t time;
+	uint8_t keycode;
+};
+
+struct workload {
+	struct vtbt *vt;
+	const struct device *dev;
+	hid_report_cb_t callback;
+	void *user_data;
+	uint32_t random;
+
+	/* Generator. Transitions are kept in time order. */
+	struct k_timer key_timer;
+	struct transition transitions[TRANSITIONS_MAX];
+	int num_transitions;
+	uint8_t report[HID_REPORT_SIZE];
+	size_t corpus_pos;
+	int64_t next_press;
+	int64_t last_transition;
+
+	/* Terminal */
+	struct k_timer line_timer;
+	struct k_timer inhibit_timer;
+	struct k_timer mode_timer;
+	bool inhibited;
+	int64_t resumed;
+	bool mode_change_due;
+
+	/* Reference model. Expected keycodes are a ring, oldest first, and
+	 * late ones were skipped over by a later keycode. */
+	struct lk201 lk201;
+	bool held[NUM_KEYS];
+	int64_t released[NUM_KEYS];
+	struct expected expected[EXPECTED_MAX];
+	int expected_first;
+	int num_expected;
+	struct expected late[LATE_MAX];
+	int num_late;
+	int64_t output_error;
+	uint8_t last_keycode;
+
+	int64_t start;
+	uint32_t presses;
+	uint32_t bytes;
+	uint32_t inhibits;
+	uint32_t mode_changes;
+	uint32_t lost;
+	uint32_t duplicated;
+	uint32_t reordered;
+	uint32_t forgiven;
+	uint32_t input_errors;
+	uint32_t output_errors;
+};
+
+#define WORKLOAD_DEV(inst)                                              \
+	[inst] = COND_CODE_1(                                           \
+		DT_NODE_HAS_COMPAT(DT_INST_PHANDLE(inst, uart),         \
+		                   zephyr_uart_emul),                   \
+		(DEVICE_DT_GET(DT_INST_PHANDLE(inst, uart))),           \
+		(NULL)),
+
+static const struct device *const devs[NUM_VT_PORTS] = {
+	DT_INST_FOREACH_STATUS_OKAY(WORKLOAD_DEV)
+};
+
+static struct workload workloads[NUM_VT_PORTS];
+
+/* xorshift32 */
+static uint32_t
+random_next(struct workload *w)
+{
+	uint32_t x = w->random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	w->random = x;
+
+	return x;
+}
+
+/* Returns a number from min to max inclusive. */
+static uint32_t
+random_range(struct workload *w, uint32_t min, uint32_t max)
+{
+	return min + random_next(w) % (max - min + 1);
+}
+
+/* REFERENCE MODEL */
+
+static struct expected *
+expected_at(struct workload *w, int i)
+{
+	return &w->expected[(w->expected_first + i) % EXPECTED_MAX];
+}
+
+static void
+expected_remove(struct workload *w, int i)
+{
+	for (; i > 0; i--) {
+		*expected_at(w, i) = *expected_at(w, i - 1);
+	}
+	w->expected_first = (w->expected_first + 1) % EXPECTED_MAX;
+	w->num_expected--;
+}
+
+static void
+expect(struct workload *w, uint8_t keycode, int64_t now)
+{
+	if (w->num_expected == EXPECTED_MAX) {
+		/* Nothing has been received for a long time. */
+		expected_remove(w, 0);
+		w->lost++;
+	}
+
+	struct expected *e = expected_at(w, w->num_expected++);
+
+	e->time = now;
+	e->keycode = keycode;
+}
+
+static void
+late_add(struct workload *w, const struct expected *e)
+{
+	if (w->num_late == LATE_MAX) {
+		w->late[0] = w->late[--w->num_late];
+		w->lost++;
+	}
+	w->late[w->num_late++] = *e;
+}
+
+static bool
+late_take(struct workload *w, uint8_t keycode)
+{
+	for (int i = 0; i < w->num_late; i++) {
+		if (w->late[i].keycode == keycode) {
+			w->late[i] = w->late[--w->num_late];
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool
+down_up_held(struct workload *w)
+{
+	for (int keycode = 0; keycode < NUM_KEYS; keycode++) {
+		if (!w->held[keycode]) {
+			continue;
+		}
+
+		struct division *division =
+			lk201_division_get_from_keycode(&w->lk201, keycode);
+		if (division != NULL && division->mode == MODE_DOWN_UP) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Records what a key transition should send: the keycode on a press, and on
+ * the release of a Down/Up key either the keycode, if other Down/Up keys are
+ * still down, or ALL UPS. */
+static void
+model_transition(struct workload *w, int keycode, bool press, int64_t now)
+{
+	if (press) {
+		w->held[keycode] = true;
+		expect(w, keycode, now);
+		return;
+	}
+
+	w->held[keycode] = false;
+	w->released[keycode] = now;
+
+	struct division *division =
+		lk201_division_get_from_keycode(&w->lk201, keycode);
+	if (division == NULL || division->mode != MODE_DOWN_UP) {
+		return;
+	}
+	expect(w, down_up_held(w) ? keycode : SPECIAL_ALL_UPS, now);
+}
+
+/* Whether the keycode may be sent again without a new press. */
+static bool
+resendable(struct workload *w, uint8_t keycode, int64_t now)
+{
+	/* Keys down during an overflow are resent on resume. */
+	if (w->held[keycode] && now - w->output_error < RESEND_GRACE_MS) {
+		return true;
+	}
+
+	struct division *division =
+		lk201_division_get_from_keycode(&w->lk201, keycode);
+	if (division == NULL || division->mode != MODE_AUTO_REPEAT) {
+		return false;
+	}
+
+	return w->held[keycode] || now - w->released[keycode] < RESEND_GRACE_MS;
+}
+
+/* Keycodes expected from before the resume that reported an output error
+ * may have been lost in the overflow. */
+static void
+forgive(struct workload *w)
+{
+	for (int i = 0; i < w->num_expected; ) {
+		if (expected_at(w, i)->time < w->resumed) {
+			expected_remove(w, i);
+			w->forgiven++;
+		} else {
+			i++;
+		}
+	}
+	for (int i = 0; i < w->num_late; ) {
+		if (w->late[i].time < w->resumed) {
+			w->late[i] = w->late[--w->num_late];
+			w->forgiven++;
+		} else {
+			i++;
+		}
+	}
+}
+
+static void
+check_byte(struct workload *w, uint8_t c, int64_t now)
+{
+	w->bytes++;
+
+	/* The power-up self-test result */
+	if (c == SPECIAL_KEYBOARD_ID_FIRMWARE ||
+	    c == SPECIAL_KEYBOARD_ID_HARDWARE || c == 0x00) {
+		return;
+	}
+
+	switch (c) {
+		case SPECIAL_METRONOME:
+		case SPECIAL_KBD_LOCKED_ACK:
+		case SPECIAL_MODE_CHANGE_ACK:
+			return;
+		case SPECIAL_INPUT_ERROR:
+			w->input_errors++;
+			return;
+		case SPECIAL_OUTPUT_ERROR:
+			w->output_errors++;
+			w->output_error = now;
+			forgive(w);
+			return;
+	}
+
+	if (w->num_expected > 0 && expected_at(w, 0)->keycode == c) {
+		expected_remove(w, 0);
+		w->last_keycode = c;
+		return;
+	}
+
+	/* A repeat of the last keycode isn't looked for further on, where
+	 * another press of the key may be expected. */
+	if (c == w->last_keycode) {
+		if (!resendable(w, c, now)) {
+			w->duplicated++;
+		}
+		return;
+	}
+	w->last_keycode = c;
+
+	/* Skipped keycodes may still come. */
+	for (int i = 1; i < MIN(w->num_expected, MATCH_WINDOW); i++) {
+		if (expected_at(w, i)->keycode != c) {
+			continue;
+		}
+
+		while (i-- > 0) {
+			late_add(w, expected_at(w, 0));
+			expected_remove(w, 0);
+		}
+		expected_remove(w, 0);
+		return;
+	}
+
+	if (late_take(w, c)) {
+		w->reordered++;
+	} else if (!resendable(w, c, now)) {
+		w->duplicated++;
+	}
+}
+
+static void
+expire(struct workload *w, int64_t now)
+{
+	if (w->inhibited) {
+		return;
+	}
+
+	while (w->num_expected > 0 &&
+	       now - MAX(expected_at(w, 0)->time, w->resumed) > LOST_AFTER_MS) {
+		expected_remove(w, 0);
+		w->lost++;
+	}
+
+	for (int i = 0; i < w->num_late; ) {
+		if (now - MAX(w->late[i].time, w->resumed) > LOST_AFTER_MS) {
+			w->late[i] = w->late[--w->num_late];
+			w->lost++;
+		} else {
+			i++;
+		}
+	}
+}
+
+/* TERMINAL */
+
+static void
+line_timer_handler(struct k_timer *timer)
+{
+	struct workload *w = CONTAINER_OF(timer, struct workload, line_timer);
+	int64_t now = k_uptime_get();
+	uint8_t c;
+
+	if (uart_emul_get_tx_data(w->dev, &c, 1) == 1) {
+		check_byte(w, c, now);
+	}
+	expire(w, now);
+}
+
+static void
+inhibit_timer_handler(struct k_timer *timer)
+{
+	struct workload *w = CONTAINER_OF(timer, struct workload,
+	                                  inhibit_timer);
+	uint8_t command;
+	uint32_t ms;
+
+	if (w->inhibited) {
+		command = COMMAND_RESUME_KEYBOARD_TRANSMISSION;
+		w->inhibited = false;
+		w->resumed = k_uptime_get();
+		ms = random_range(w, INHIBIT_INTERVAL_MIN_MS,
+		                  INHIBIT_INTERVAL_MAX_MS);
+	} else {
+		command = COMMAND_INHIBIT_KEYBOARD_TRANSMISSION;
+		w->inhibited = true;
+		w->inhibits++;
+		ms = random_range(w, INHIBIT_MIN_MS, INHIBIT_MAX_MS);
+	}
+
+	uart_emul_put_rx_data(w->dev, &command, 1);
+	k_timer_start(timer, K_MSEC(ms), K_NO_WAIT);
+}
+
+static void
+mode_timer_handler(struct k_timer *timer)
+{
+	struct workload *w = CONTAINER_OF(timer, struct workload, mode_timer);
+
+	/* Made by the generator once the keys are up. */
+	w->mode_change_due = true;
+}
+
+static void
+mode_timer_start(struct workload *w)
+{
+	k_timer_start(&w->mode_timer,
+	              K_MSEC(random_range(w, MODE_CHANGE_INTERVAL_MIN_MS,
+	                                  MODE_CHANGE_INTERVAL_MAX_MS)),
+	              K_NO_WAIT);
+}
+
+static void
+change_mode(struct workload *w)
+{
+	uint8_t command;
+
+	if (random_range(w, 0, 7) == 0) {
+		command = COMMAND_REINSTATE_DEFAULTS;
+		lk201_init_defaults(&w->lk201);
+	} else {
+		int division = mode_change_divisions[
+			random_next(w) % ARRAY_SIZE(mode_change_divisions)];
+		int mode = mode_change_modes[
+			random_next(w) % ARRAY_SIZE(mode_change_modes)];
+
+		/* Without a parameter, auto-repeat uses buffer 0. */
+		command = 0x80 | ((division + 1) << 3) | (mode << 1);
+		lk201_division_get(&w->lk201, division)->mode = mode;
+		lk201_division_get(&w->lk201, division)->buffer = 0;
+	}
+
+	uart_emul_put_rx_data(w->dev, &command, 1);
+	w->mode_changes++;
+}
+
+/* GENERATOR */
+
+static bool
+usage_get(char c, uint8_t *usage, uint8_t *modifier)
+{
+	*modifier = 0;
+
+	if (c >= 'a' && c <= 'z') {
+		*usage = HID_USAGE_A + (c - 'a');
+		return true;
+	} else if (c >= 'A' && c <= 'Z') {
+		*usage = HID_USAGE_A + (c - 'A');
+		*modifier = HID_USAGE_LEFT_SHIFT;
+		return true;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		const char *found = memchr(usage_chars[i], c,
+		                           sizeof(usage_chars[i]) - 1);
+		if (found != NULL) {
+			*usage = HID_USAGE_1 + (found - usage_chars[i]);
+			*modifier = i ? HID_USAGE_LEFT_SHIFT : 0;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void
+next_char(struct workload *w, uint8_t *usage, uint8_t *modifier)
+{
+	char c;
+
+	do {
+		c = corpus[w->corpus_pos++];
+		if (corpus[w->corpus_pos] == '\0') {
+			w->corpus_pos = 0;
+		}
+	} while (!usage_get(c, usage, modifier));
+}
+
+static void
+transition_add(struct workload *w, int64_t time, uint8_t usage, bool press)
+{
+	int i;
+
+	if (w->num_transitions == TRANSITIONS_MAX) {
+		return;
+	}
+
+	/* After any at the same time, so a unit's transitions keep their
+	 * order. */
+	for (i = w->num_transitions; i > 0; i--) {
+		if (w->transitions[i - 1].time <= time) {
+			break;
+		}
+		w->transitions[i] = w->transitions[i - 1];
+	}
+	w->transitions[i].time = time;
+	w->transitions[i].usage = usage;
+	w->transitions[i].press = press;
+	w->num_transitions++;
+}
+
+static void
+transition_remove(struct workload *w, int i)
+{
+	w->num_transitions--;
+	memmove(&w->transitions[i], &w->transitions[i + 1],
+	        (w->num_transitions - i) * sizeof(w->transitions[0]));
+}
+
+/* Index of the usage's pending release, or -1 if it is up. */
+static int
+release_find(struct workload *w, uint8_t usage)
+{
+	for (int i = 0; i < w->num_transitions; i++) {
+		if (w->transitions[i].usage == usage &&
+		    !w->transitions[i].press) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/* Returns the earliest release after the time if the rollover limit would be
+ * reached by a press at it, or -1. */
+static int64_t
+rollover_full(struct workload *w, int64_t time)
+{
+	int64_t first = -1;
+	int down = 0;
+
+	for (int i = 0; i < w->num_transitions; i++) {
+		const struct transition *t = &w->transitions[i];
+
+		if (t->press || t->usage >= HID_USAGE_LEFT_CTRL ||
+		    t->time <= time) {
+			continue;
+		}
+		if (first < 0) {
+			first = t->time;
+		}
+		down++;
+	}
+
+	return down >= ROLLOVER_MAX ? first : -1;
+}
+
+/* Adds a press of the usage no earlier than start, held for hold_ms, with the
+ * modifier held around it unless it is 0. Returns the time of the press. */
+static int64_t
+key_add(struct workload *w, uint8_t usage, uint8_t modifier, int64_t start,
+        int hold_ms)
+{
+	int64_t press = start;
+	int64_t time;
+	int i;
+
+	for (;;) {
+		/* A key still down is released before it is pressed again. */
+		i = release_find(w, usage);
+		if (i >= 0 && w->transitions[i].time >= press) {
+			press = w->transitions[i].time + 1;
+			continue;
+		}
+		time = rollover_full(w, press);
+		if (time >= 0) {
+			press = time + 1;
+			continue;
+		}
+		break;
+	}
+
+	if (modifier != 0) {
+		i = release_find(w, modifier);
+		if (i >= 0 && w->transitions[i].time >= press) {
+			/* Still down from the previous key, so it is held
+			 * until after this one too. */
+			time = MAX(w->transitions[i].time,
+			           press + hold_ms + MODIFIER_LAG_MS);
+			transition_remove(w, i);
+		} else {
+			transition_add(w, press, modifier, true);
+			press += MODIFIER_LAG_MS;
+			time = press + hold_ms + MODIFIER_LAG_MS;
+		}
+		transition_add(w, time, modifier, false);
+	}
+
+	transition_add(w, press, usage, true);
+	transition_add(w, press + hold_ms, usage, false);
+
+	return press;
+}
+
+static void
+unit_add(struct workload *w, int64_t start)
+{
+	uint32_t kind = random_range(w, 0, 99);
+	uint32_t char_ms = random_range(w, CHAR_MS * 7 / 10, CHAR_MS * 13 / 10);
+	uint8_t usage;
+	uint8_t modifier;
+	int hold_ms;
+	int64_t press;
+
+	if (kind < HOLD_PERCENT) {
+		usage = hold_usages[random_next(w) % ARRAY_SIZE(hold_usages)];
+		hold_ms = random_range(w, HOLD_MIN_MS, HOLD_MAX_MS);
+		press = key_add(w, usage, 0, start, hold_ms);
+		/* Typing resumes after the hold. */
+		w->next_press = press + hold_ms + char_ms;
+		return;
+	}
+
+	if (kind < HOLD_PERCENT + CHORD_PERCENT) {
+		usage = HID_USAGE_A + random_range(w, 0, 25);
+		modifier = HID_USAGE_LEFT_CTRL;
+	} else {
+		next_char(w, &usage, &modifier);
+	}
+
+	/* Rolled-over keys are held past the next press. */
+	if (random_range(w, 0, 99) < CONFIG_VTBT_WORKLOAD_ROLLOVER_PERCENT) {
+		hold_ms = random_range(w, char_ms * 3 / 2, char_ms * 3);
+	} else {
+		hold_ms = random_range(w, char_ms * 3 / 10, char_ms * 8 / 10);
+	}
+	press = key_add(w, usage, modifier, start, hold_ms);
+	w->next_press = press + char_ms;
+}
+
+static void
+report_update(uint8_t *report, uint8_t usage, bool press)
+{
+	if (usage >= HID_USAGE_LEFT_CTRL) {
+		WRITE_BIT(report[0], usage - HID_USAGE_LEFT_CTRL, press);
+		return;
+	}
+
+	for (int i = HID_REPORT_FIRST_KEY; i < HID_REPORT_SIZE; i++) {
+		if (press && report[i] == 0x00) {
+			report[i] = usage;
+			return;
+		} else if (!press && report[i] == usage) {
+			/* Keys still down stay in order. */
+			memmove(&report[i], &report[i + 1],
+			        HID_REPORT_SIZE - i - 1);
+			report[HID_REPORT_SIZE - 1] = 0x00;
+			return;
+		}
+	}
+}
+
+static void
+transition_apply(struct workload *w, const struct transition *t,
+                 int64_t now)
+{
+	int keycode;
+
+	if (t->usage >= HID_USAGE_LEFT_CTRL) {
+		keycode = lk201_keycode_get_from_modifier(t->usage -
+		                                          HID_USAGE_LEFT_CTRL);
+	} else {
+		keycode = lk201_keycode_get_from_hid(t->usage);
+	}
+
+	report_update(w->report, t->usage, t->press);
+	w->callback(w->report, k_uptime_ticks(), w->user_data);
+	w->last_transition = now;
+
+	if (keycode != 0x00) {
+		w->presses += t->press;
+		model_transition(w, keycode, t->press, now);
+	}
+}
+
+static bool
+press_pending(struct workload *w)
+{
+	for (int i = 0; i < w->num_transitions; i++) {
+		if (w->transitions[i].press) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void
+key_timer_handler(struct k_timer *timer)
+{
+	struct workload *w = CONTAINER_OF(timer, struct workload, key_timer);
+	int64_t now = k_uptime_get();
+	int64_t next;
+
+	/* One report per transition */
+	while (w->num_transitions > 0 && w->transitions[0].time <= now) {
+		struct transition t = w->transitions[0];
+
+		transition_remove(w, 0);
+		transition_apply(w, &t, now);
+	}
+
+	if (w->mode_change_due && w->num_transitions == 0 &&
+	    now >= w->last_transition + MODE_CHANGE_QUIET_MS) {
+		change_mode(w);
+		w->mode_change_due = false;
+		w->next_press = MAX(w->next_press, now + MODE_CHANGE_QUIET_MS);
+		mode_timer_start(w);
+	}
+
+	if (!w->mode_change_due && !press_pending(w)) {
+		unit_add(w, MAX(w->next_press, now));
+	}
+
+	if (w->num_transitions > 0) {
+		next = w->transitions[0].time;
+	} else {
+		/* Waiting to change modes */
+		next = w->last_transition + MODE_CHANGE_QUIET_MS;
+	}
+	k_timer_start(timer, K_MSEC(MAX(next - now, 0)), K_NO_WAIT);
+}
+
+/* REPORT */
+
+/* Prints a count and its rate per simulated hour. */
+static void
+print_count(int id, const char *name, uint32_t count, int64_t elapsed_ms)
+{
+	printk("vt%d:   %-22s %8u %8u/h\n", id, name, count,
+	       (uint32_t)(count * 3600000ULL / MAX(elapsed_ms, 1)));
+}
+
+static void
+report_work_handler(struct k_work *work)
+{
+	int64_t now = k_uptime_get();
+
+	for (int i = 0; i < NUM_VT_PORTS; i++) {
+		struct workload *w = &workloads[i];
+		int64_t elapsed_ms = now - w->start;
+
+		if (w->vt == NULL) {
+			continue;
+		}
+
+		printk("vt%d: workload %lld s simulated, %u presses, %u bytes, "
+		       "%u inhibits, %u mode changes, %u forgiven after "
+		       "output errors\n", i, elapsed_ms / 1000, w->presses,
+		       w->bytes, w->inhibits, w->mode_changes, w->forgiven);
+		print_count(i, "lost", w->lost, elapsed_ms);
+		print_count(i, "duplicated", w->duplicated, elapsed_ms);
+		print_count(i, "reordered", w->reordered, elapsed_ms);
+		print_count(i, "input errors", w->input_errors, elapsed_ms);
+		print_count(i, "output errors", w->output_errors, elapsed_ms);
+		print_count(i, "events dropped",
+		            atomic_get(&w->vt->events_dropped), elapsed_ms);
+		print_count(i, "journal overflow",
+		            uart_journal_overflow_count_get(&w->vt->uart),
+		            elapsed_ms);
+		/* Since boot or the last telemetry reset */
+		print_count(i, "metronome drops",
+		            uart_line_stats_get(&w->vt->uart,
+		                                LINE_CLASS_METRONOME)->dropped,
+		            elapsed_ms);
+		/* Shared by all ports */
+		print_count(i, "keys-down slab full",
+		            keyboard_keys_down_exhausted_get(), elapsed_ms);
+	}
+
+	k_work_schedule(k_work_delayable_from_work(work),
+	                K_SECONDS(CONFIG_VTBT_WORKLOAD_REPORT_INTERVAL));
+}
+
+K_WORK_DELAYABLE_DEFINE(report_work, report_work_handler);
+
+int
+workload_start(int id, hid_report_cb_t callback, void *user_data)
+{
+	struct workload *w = &workloads[id];
+
+	if (devs[id] == NULL) {
+		LOG_ERR("vt%d: workload needs a zephyr,uart-emul UART", id);
+		return -1;
+	}
+
+	w->vt = &vtbt_instances[id];
+	w->dev = devs[id];
+	w->callback = callback;
+	w->user_data = user_data;
+	w->random = CONFIG_VTBT_WORKLOAD_SEED * 2654435761u + id + 1;
+	if (w->random == 0) {
+		w->random = 1;
+	}
+
+	lk201_init_defaults(&w->lk201);
+	for (int keycode = 0; keycode < NUM_KEYS; keycode++) {
+		w->released[keycode] = -RESEND_GRACE_MS;
+	}
+	w->output_error = -RESEND_GRACE_MS;
+	w->start = k_uptime_get();
+	w->next_press = w->start + START_DELAY_MS;
+
+	k_timer_init(&w->key_timer, key_timer_handler, NULL);
+	k_timer_init(&w->line_timer, line_timer_handler, NULL);
+	k_timer_init(&w->inhibit_timer, inhibit_timer_handler, NULL);
+	k_timer_init(&w->mode_timer, mode_timer_handler, NULL);
+
+	k_timer_start(&w->key_timer, K_MSEC(START_DELAY_MS), K_NO_WAIT);
+	k_timer_start(&w->line_timer, K_USEC(USEC_PER_SEC / LINE_RATE),
+	              K_USEC(USEC_PER_SEC / LINE_RATE));
+	k_timer_start(&w->inhibit_timer,
+	              K_MSEC(START_DELAY_MS +
+	                     random_range(w, INHIBIT_INTERVAL_MIN_MS,
+	                                  INHIBIT_INTERVAL_MAX_MS)),
+	              K_NO_WAIT);
+	mode_timer_start(w);
+
+	k_work_schedule(&report_work,
+	                K_SECONDS(CONFIG_VTBT_WORKLOAD_REPORT_INTERVAL));
+
+	return 0;
+}
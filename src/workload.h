@@ -0,0 +1,14 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include "vtbt.h"
+
+/* A keyboard source for soak tests in simulation: types a text corpus at
+ * CONFIG_VTBT_WORKLOAD_WPM with rollover, Ctrl chords and long auto-repeat
+ * holds, while acting as the port's terminal with random inhibits, resumes
+ * and mode changes. The LK201 output is checked against a reference model
+ * and violations are reported periodically. The port's UART must be a
+ * zephyr,uart-emul. Reports are passed to the callback from a timer ISR. */
+int workload_start(int id, hid_report_cb_t callback, void *user_data);
+
+#endif /* WORKLOAD_H */